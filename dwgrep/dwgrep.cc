@@ -28,13 +28,20 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <memory>
 #include <libintl.h>
 #include <vector>
 #include <cassert>
+#include <cstdlib>
 #include <getopt.h>
 #include <map>
 #include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 #include "libzwerg.h"
 #include "libzwerg-dw.h"
@@ -90,6 +97,228 @@ show_help (std::vector <ext_option> const &ext_opts)
     }
 }
 
+struct output_settings
+{
+  int verbosity;
+  bool no_messages;
+  bool show_count;
+  bool with_filename;
+
+  // When non-zero, DIE caches are prebuilt using this many threads.
+  unsigned prebuild_threads;
+
+  // At most this many results are taken from each file.
+  uint64_t max_count;
+};
+
+// Run QUERY over file FN, or over an empty stack if FN is empty.
+// Results are written to OUT and error messages to ERR.  MATCH and
+// ERRORS are set as appropriate.  Returns -1 if processing of further
+// files should go on, otherwise the status that dwgrep should exit
+// with.  If CANCEL becomes set, stops at the next query result.
+int
+process_file (zw_query const *query, std::string const &fn,
+	      output_settings const &settings,
+	      std::ostream &out, std::ostream &err,
+	      bool &match, bool &errors, std::atomic <bool> const &cancel)
+{
+  zw_error *zerr;
+  auto die = [&err] (zw_error *zerr)
+    {
+      err << "Error: " << zw_error_message (zerr) << std::endl;
+      zw_error_destroy (zerr);
+      return 2;
+    };
+
+  auto fail = [&] ()
+    {
+      if (! settings.no_messages)
+	out << "dwgrep: " << fn << ": "
+	    << zw_error_message (zerr) << std::endl;
+      zw_error_destroy (zerr);
+      if (settings.verbosity >= 0)
+	errors = true;
+      return -1;
+    };
+
+  std::shared_ptr <zw_stack> stack (zw_stack_init (&zerr),
+				    &zw_stack_destroy);
+  if (stack == nullptr)
+    return fail ();
+
+  if (fn != "")
+    {
+      zw_value *dwv = zw_value_init_dwarf (fn.c_str (), 0, &zerr);
+      if (dwv == nullptr
+	  || (settings.prebuild_threads > 0
+	      && ! zw_value_dwarf_prebuild (dwv, settings.prebuild_threads,
+					    &zerr))
+	  || ! zw_stack_push_take (&*stack, dwv, &zerr))
+	{
+	  zw_value_destroy (dwv);
+	  return fail ();
+	}
+    }
+
+  std::shared_ptr <zw_result> result
+    (zw_query_execute (query, &*stack, &zerr),
+     &zw_result_destroy);
+  if (result == nullptr)
+    return fail ();
+
+  // With -q, the first result is all that's needed.
+  uint64_t limit = settings.max_count;
+  if (settings.verbosity < 0)
+    limit = std::min (limit, (uint64_t) 1);
+  if (limit != UINT64_MAX)
+    zw_result_set_limit (&*result, limit);
+
+  uint64_t count = 0;
+  while (! cancel)
+    {
+      zw_stack *zout;
+      if (! zw_result_next (&*result, &zout, &zerr))
+	{
+	  if (! settings.no_messages)
+	    err << "dwgrep: " << fn << ": "
+		<< zw_error_message (zerr) << std::endl;
+	  zw_error_destroy (zerr);
+	  break;
+	}
+      if (zout == nullptr)
+	break;
+
+      std::shared_ptr <zw_stack> result_stack (zout, &zw_stack_destroy);
+
+      // grep: Exit immediately with zero status if any match
+      // is found, even if an error was detected.
+      if (settings.verbosity < 0)
+	return 0;
+
+      match = true;
+      if (! settings.show_count)
+	{
+	  if (settings.with_filename)
+	    out << fn << ":\n";
+	  size_t depth = zw_stack_depth (zout);
+	  if (depth > 1)
+	    out << "---\n";
+	  for (size_t i = 0; i < depth; ++i)
+	    {
+	      char *str = zw_value_show (zw_stack_at (zout, i), &zerr);
+	      if (str == nullptr)
+		return die (zerr);
+	      out << str << std::endl;
+	      free (str);
+	    }
+	}
+      else
+	++count;
+    }
+
+  if (settings.show_count)
+    {
+      if (settings.with_filename)
+	out << fn << ":";
+      out << std::dec << count << std::endl;
+    }
+
+  return -1;
+}
+
+// Process files in TO_PROCESS on NJOBS worker threads.  The output
+// of each file is buffered and then emitted in order in which the
+// files were given, so that it looks the same as if the files were
+// processed serially.
+int
+process_files_parallel (zw_query const *query,
+			std::vector <std::string> const &to_process,
+			output_settings const &settings, unsigned njobs,
+			bool &match, bool &errors)
+{
+  struct job
+  {
+    std::ostringstream out;
+    std::ostringstream err;
+    bool match = false;
+    bool errors = false;
+    int status = -1;
+    bool done = false;
+  };
+
+  std::vector <job> jobs (to_process.size ());
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::atomic <bool> cancel {false};
+  size_t next = 0;
+  bool quit = false;
+
+  auto work = [&] ()
+    {
+      while (true)
+	{
+	  size_t i;
+	  {
+	    std::lock_guard <std::mutex> lock {mutex};
+	    if (cancel || next >= jobs.size ())
+	      return;
+	    i = next++;
+	  }
+
+	  job &j = jobs[i];
+	  int status = process_file (query, to_process[i], settings,
+				     j.out, j.err, j.match, j.errors, cancel);
+
+	  {
+	    std::lock_guard <std::mutex> lock {mutex};
+	    j.status = status;
+	    j.done = true;
+	    // With -q, one match anywhere is enough.
+	    if (settings.verbosity < 0 && status == 0)
+	      {
+		quit = true;
+		cancel = true;
+	      }
+	  }
+	  cv.notify_all ();
+	}
+    };
+
+  std::vector <std::thread> workers;
+  for (unsigned i = 0; i < njobs && i < jobs.size (); ++i)
+    workers.push_back (std::thread {work});
+
+  auto finish = [&] (int status)
+    {
+      cancel = true;
+      for (auto &w: workers)
+	w.join ();
+      return status;
+    };
+
+  for (auto &j: jobs)
+    {
+      {
+	std::unique_lock <std::mutex> lock {mutex};
+	cv.wait (lock, [&] () { return j.done || quit; });
+	if (quit)
+	  {
+	    lock.unlock ();
+	    return finish (0);
+	  }
+      }
+
+      std::cout << j.out.str () << std::flush;
+      std::cerr << j.err.str () << std::flush;
+      match = match || j.match;
+      errors = errors || j.errors;
+      if (j.status >= 0)
+	return finish (j.status);
+    }
+
+  return finish (-1);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -104,6 +333,9 @@ main(int argc, char *argv[])
   bool show_count = false;
   bool with_filename = false;
   bool no_filename = false;
+  unsigned njobs = 1;
+  unsigned prebuild_threads = 0;
+  uint64_t max_count = UINT64_MAX;
 
   std::vector <std::string> to_process;
 
@@ -164,6 +396,32 @@ main(int argc, char *argv[])
 	  no_messages = true;
 	  break;
 
+	case 'm':
+	  {
+	    char *endptr;
+	    long n = strtol (optarg, &endptr, 10);
+	    if (*optarg == '\0' || *endptr != '\0' || n < 0)
+	      {
+		std::cerr << "Invalid max count: " << optarg << ".\n";
+		return 2;
+	      }
+	    max_count = n;
+	    break;
+	  }
+
+	case 'j':
+	  {
+	    char *endptr;
+	    long n = strtol (optarg, &endptr, 10);
+	    if (*optarg == '\0' || *endptr != '\0' || n < 1)
+	      {
+		std::cerr << "Invalid number of jobs: " << optarg << ".\n";
+		return 2;
+	      }
+	    njobs = n;
+	    break;
+	  }
+
 	case 'f':
 	  {
 	    if (strcmp (optarg, "-") != 0)
@@ -180,6 +438,45 @@ main(int argc, char *argv[])
 	  }
 
 	default:
+	  if (c == prebuild)
+	    {
+	      if (optarg == nullptr)
+		prebuild_threads = std::max (std::thread::hardware_concurrency (),
+					     1u);
+	      else
+		{
+		  char *endptr;
+		  long n = strtol (optarg, &endptr, 10);
+		  if (*optarg == '\0' || *endptr != '\0' || n < 1)
+		    {
+		      std::cerr << "Invalid number of threads: "
+				<< optarg << ".\n";
+		      return 2;
+		    }
+		  prebuild_threads = n;
+		}
+	      break;
+	    }
+
+	  if (c == index_cache)
+	    {
+	      long n = 256;
+	      if (optarg != nullptr)
+		{
+		  char *endptr;
+		  n = strtol (optarg, &endptr, 10);
+		  if (*optarg == '\0' || *endptr != '\0' || n < 1
+		      || (uint64_t) n > UINT64_MAX >> 20)
+		    {
+		      std::cerr << "Invalid index cache size: "
+				<< optarg << ".\n";
+		      return 2;
+		    }
+		}
+	      zw_dwarf_index_cache_set_limit ((uint64_t) n << 20);
+	      break;
+	    }
+
 	  if (c == help)
 	    {
 	      show_help (ext_options);
@@ -228,82 +525,29 @@ main(int argc, char *argv[])
   if (no_filename)
     with_filename = false;
 
+  output_settings settings {verbosity, no_messages,
+			    show_count, with_filename, prebuild_threads,
+			    max_count};
+
   bool errors = false;
   bool match = false;
-  for (auto const &fn: to_process)
+  if (njobs > 1 && to_process.size () > 1)
     {
-      std::shared_ptr <zw_stack> stack (zw_stack_init (&err),
-					&zw_stack_destroy);
-      if (stack == nullptr)
-	{
-	fail:
-	  if (! no_messages)
-	    std::cout << "dwgrep: " << fn << ": "
-		      << zw_error_message (err) << std::endl;
-	  zw_error_destroy (err);
-	  if (verbosity >= 0)
-	    errors = true;
-	  continue;
-	}
-
-      if (fn != "")
-	{
-	  zw_value *dwv = zw_value_init_dwarf (fn.c_str (), 0, &err);
-	  if (dwv == nullptr
-	      || ! zw_stack_push_take (&*stack, dwv, &err))
-	    {
-	      zw_value_destroy (dwv);
-	      goto fail;
-	    }
-	}
-
-      std::shared_ptr <zw_result> result
-	(zw_query_execute (&*query, &*stack, &err),
-	 &zw_result_destroy);
-      if (result == nullptr)
-	goto fail;
-
-      uint64_t count = 0;
-      while (true)
-	{
-	  zw_stack *out;
-	  if (! zw_result_next (&*result, &out, &err))
-	    {
-	      if (! no_messages)
-		std::cerr << "dwgrep: " << fn << ": "
-			  << zw_error_message (err) << std::endl;
-	      zw_error_destroy (err);
-	      break;
-	    }
-	  if (out == nullptr)
-	    break;
-
-	  // grep: Exit immediately with zero status if any match
-	  // is found, even if an error was detected.
-	  if (verbosity < 0)
-	    return 0;
-
-	  match = true;
-	  if (! show_count)
-	    {
-	      if (with_filename)
-		std::cout << fn << ":\n";
-	      if (zw_stack_depth (out) > 1)
-		std::cout << "---\n";
-	      if (! zw_stack_dump_xxx (out, &err))
-		return die (err);
-	    }
-	  else
-	    ++count;
-
-	  zw_stack_destroy (out);
-	}
-
-      if (show_count)
+      int status = process_files_parallel (&*query, to_process, settings,
+					   njobs, match, errors);
+      if (status >= 0)
+	return status;
+    }
+  else
+    {
+      std::atomic <bool> cancel {false};
+      for (auto const &fn: to_process)
 	{
-	  if (with_filename)
-	    std::cout << fn << ":";
-	  std::cout << std::dec << count << std::endl;
+	  int status = process_file (&*query, fn, settings,
+				     std::cout, std::cerr,
+				     match, errors, cancel);
+	  if (status >= 0)
+	    return status;
 	}
     }
 
@@ -54,6 +54,8 @@ merge_options (std::vector <ext_option> const &ext_opts)
 }
 
 ext_shopt help;
+ext_shopt prebuild;
+ext_shopt index_cache;
 
 std::vector <ext_option> ext_options = {
   {'q', "silent", ext_argument::no, ""},
@@ -88,6 +90,14 @@ std::vector <ext_option> ext_options = {
 	Print only a count of query results, not the results
 	themselves.
 
+)docstring"},
+
+  {'m', "max-count", ext_argument::required ("N"), R"docstring(
+
+	Stop processing a file after *N* query results.  The query is
+	not evaluated any further than what it takes to produce those.
+	With ``-c``, at most *N* is counted.
+
 )docstring"},
 
   {'H', "with-filename", ext_argument::no,  R"docstring(
@@ -110,6 +120,38 @@ std::vector <ext_option> ext_options = {
 	file is read and run over the input file(s).  At most one
 	``-e`` or ``-f`` option shall be present.
 
+)docstring"},
+
+  {'j', "jobs", ext_argument::required ("N"), R"docstring(
+
+	Process up to *N* input files concurrently.  Output of each
+	file is collected and printed as a whole, in the order in
+	which the files were given, so the output is the same as when
+	the files are processed one after another.  With ``-q``, the
+	first match found in any file ends the search.
+
+)docstring"},
+
+  {prebuild, "prebuild-caches", ext_argument::optional ("N"), R"docstring(
+
+	Before running the query, walk each input file once and build
+	caches that map DIE's to their parents, using *N* threads (by
+	default as many as there are processors).  Queries that go up
+	the DIE tree a lot (e.g. via ``parent`` or ``?root``) then don't
+	pay for building the caches piecemeal.  Files whose index is
+	already cached on disk are left alone.
+
+)docstring"},
+
+  {index_cache, "index-cache", ext_argument::optional ("MB"), R"docstring(
+
+	Save indices of DIE's of input files that carry a build ID
+	under ``$XDG_CACHE_HOME/dwgrep``, and load them back when the
+	same file is searched again.  Queries that look up DIE's by
+	name, tag or address then don't need to build the index first.
+	At most *MB* megabytes of indices are kept (256 by default),
+	least recently used ones are removed first.
+
 )docstring"},
 
   {help, "help", ext_argument::no, R"docstring(
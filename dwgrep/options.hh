@@ -157,4 +157,6 @@ std::map <int, std::pair <std::vector <std::string>, std::string>>
 merge_options (std::vector <ext_option> const &ext_opts);
 
 extern ext_shopt help;
+extern ext_shopt prebuild;
+extern ext_shopt index_cache;
 extern std::vector <ext_option> ext_options;
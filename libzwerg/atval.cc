@@ -238,7 +238,7 @@ namespace
 	    if (dwarf_macro_param2 (macro, nullptr, &str) < 0)
 	      throw_libdw ();
 	    seq.push_back
-	      (std::make_unique <value_str> (std::string {str}, 0));
+	      (std::make_unique <value_str> (str, retp->first.m_dwctx, 0));
 	    break;
 	  }
 
@@ -369,7 +369,8 @@ namespace
 	  if (fn == nullptr)
 	    throw_libdw ();
 
-	  return pass_single_value (std::make_unique <value_str> (fn, 0));
+	  return pass_single_value
+	    (std::make_unique <value_str> (fn, dwctx, 0));
 	}
 
       case DW_AT_const_value:
@@ -616,7 +617,8 @@ at_value (std::shared_ptr <dwfl_context> dwctx,
 	const char *str = dwarf_formstring (&attr);
 	if (str == nullptr)
 	  throw_libdw ();
-	return pass_single_value (std::make_unique <value_str> (str, 0));
+	return pass_single_value
+	  (std::make_unique <value_str> (str, dwctx, 0));
       }
 
     case DW_FORM_ref_addr:
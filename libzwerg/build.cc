@@ -27,16 +27,35 @@
    not, see <http://www.gnu.org/licenses/>.  */
 
 #include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <memory>
 
 #include "op.hh"
+#include "planner.hh"
 #include "scope.hh"
 #include "tree.hh"
 #include "value-cst.hh"
 #include "value-seq.hh"
 #include "value-str.hh"
 
+namespace
+{
+  // Type of value that builtin B leaves on TOS, as its protomap
+  // tells, or value::vtype if that's not known.
+  value_type
+  tos_type (builtin const &b)
+  {
+    auto pm = b.protomap ();
+    if (pm.size () != 1
+	|| std::get <1> (pm.front ()) == yield::pred
+	|| std::get <2> (pm.front ()).empty ())
+      return value::vtype;
+    return std::get <2> (pm.front ()).back ();
+  }
+}
+
 std::unique_ptr <pred>
 tree::build_pred () const
 {
@@ -110,8 +129,77 @@ tree::build_exec (std::shared_ptr <op> upstream) const
   switch (m_tt)
     {
     case tree_type::CAT:
-      for (auto const &tree: m_children)
-	upstream = tree.build_exec (upstream);
+      for (size_t i = 0; i < m_children.size (); ++i)
+	{
+	  tree const &t = m_children[i];
+
+	  // [X] elem followed by a bound on pos only looks at a prefix
+	  // of what X yields.  Don't compute the rest.
+	  if (t.m_tt == tree_type::CAPTURE && i + 1 < m_children.size ()
+	      && m_children[i + 1].m_tt == tree_type::F_BUILTIN
+	      && strcmp (m_children[i + 1].m_builtin->name (), "elem") == 0)
+	    {
+	      size_t k = i + 2;
+	      while (k < m_children.size () && is_filter (m_children[k]))
+		++k;
+
+	      uint64_t bound;
+	      if (find_cst_upper_bound (m_children.data () + i + 2,
+					m_children.data () + k,
+					{"pos"}, &bound))
+		{
+		  auto origin = std::make_shared <op_origin> (nullptr);
+		  auto op = t.child (0).build_exec (origin);
+		  upstream = std::make_shared <op_capture>
+		    (upstream, origin, op,
+		     std::min (bound, (uint64_t) SIZE_MAX));
+		  continue;
+		}
+	    }
+
+	  size_t j = i + 1;
+	  if (t.m_tt == tree_type::F_BUILTIN)
+	    while (j < m_children.size () && is_filter (m_children[j]))
+	      ++j;
+
+	  if (j == i + 1)
+	    {
+	      upstream = t.build_exec (upstream);
+	      continue;
+	    }
+
+	  // Give the builtin a chance to make use of the filters that
+	  // follow it.
+	  tree const *begin = m_children.data () + i + 1;
+	  tree const *end = m_children.data () + j;
+	  if (auto b = t.m_builtin->reduce (begin, end))
+	    {
+	      upstream = b->build_exec (upstream);
+	      assert (upstream != nullptr);
+	    }
+	  else
+	    upstream = t.build_exec (upstream);
+
+	  // If it's known what the builtin leaves on TOS, the filters
+	  // may be fused into a single op.
+	  value_type vt = tos_type (*t.m_builtin);
+	  if (vt == value::vtype)
+	    continue;
+
+	  tree const *fused_end;
+	  if (auto test = fuse_filters (begin, end, vt, &fused_end))
+	    {
+	      std::vector <std::unique_ptr <pred>> preds;
+	      for (tree const *it = begin; it != fused_end; ++it)
+		preds.push_back (it->m_tt == tree_type::ASSERT
+				 ? it->child (0).build_pred ()
+				 : it->build_pred ());
+
+	      upstream = std::make_shared <op_fused_filter>
+		(upstream, vt, std::move (test), std::move (preds));
+	      i = fused_end - m_children.data () - 1;
+	    }
+	}
       return upstream;
 
     case tree_type::ALT:
@@ -223,7 +311,20 @@ tree::build_exec (std::shared_ptr <op> upstream) const
       {
 	auto origin = std::make_shared <op_origin> (nullptr);
 	auto op = child (0).build_exec (origin);
-	return std::make_shared <op_tr_closure> (upstream, origin, op);
+
+	// X* is parsed as CLOSE_STAR(SCOPE(X)).  Closures over a bare
+	// builtin may know where they can't loop.
+	tree const *body = &child (0);
+	while (body->tt () == tree_type::SCOPE
+	       && body->scp ()->num_names () == 0)
+	  body = &body->child (0);
+
+	std::unique_ptr <value_test> acyclic;
+	if (body->tt () == tree_type::F_BUILTIN)
+	  acyclic = body->m_builtin->build_acyclic_test ();
+
+	return std::make_shared <op_tr_closure> (upstream, origin, op,
+						 std::move (acyclic));
       }
 
     case tree_type::SCOPE:
@@ -27,6 +27,7 @@
    not, see <http://www.gnu.org/licenses/>.  */
 
 #include <iostream>
+#include <vector>
 #include "std-memory.hh"
 
 #include "builtin-closure.hh"
@@ -34,7 +35,21 @@
 
 struct op_apply::pimpl
 {
+  // Op graphs built for closures that this op has applied.  Applying
+  // a closure whose tree is among these just re-primes the graph.
+  struct built_closure
+  {
+    std::shared_ptr <tree const> m_t;
+    std::shared_ptr <op_origin> m_origin;
+    std::shared_ptr <op> m_op;
+  };
+
+  // Typically all applied closures come from one lambda.  The limit
+  // is there for closures that come from many.
+  static size_t const max_built = 8;
+
   std::shared_ptr <op> m_upstream;
+  std::vector <built_closure> m_built;
   std::shared_ptr <op> m_op;
   std::shared_ptr <frame> m_old_frame;
 
@@ -42,6 +57,27 @@ struct op_apply::pimpl
     : m_upstream {upstream}
   {}
 
+  std::shared_ptr <op>
+  prime (value_closure const &cl, stack::uptr stk)
+  {
+    auto t = cl.get_tree_ptr ();
+    for (auto &b: m_built)
+      if (b.m_t == t)
+	{
+	  b.m_op->reset ();
+	  b.m_origin->set_next (std::move (stk));
+	  return b.m_op;
+	}
+
+    if (m_built.size () == max_built)
+      m_built.erase (m_built.begin ());
+
+    auto origin = std::make_shared <op_origin> (std::move (stk));
+    auto op = t->build_exec (origin);
+    m_built.push_back ({t, origin, op});
+    return op;
+  }
+
   void
   reset_me ()
   {
@@ -68,8 +104,7 @@ struct op_apply::pimpl
 
 	      m_old_frame = stk->nth_frame (0);
 	      stk->set_frame (cl.get_frame ());
-	      auto origin = std::make_shared <op_origin> (std::move (stk));
-	      m_op = cl.get_tree ().build_exec (origin);
+	      m_op = prime (cl, std::move (stk));
 	    }
 	  else
 	    return nullptr;
@@ -100,7 +135,7 @@ op_apply::~op_apply ()
 {}
 
 void
-op_apply::reset ()
+op_apply::do_reset ()
 {
   m_pimpl->reset ();
 }
@@ -43,7 +43,7 @@ public:
   op_apply (std::shared_ptr <op> upstream);
   ~op_apply ();
 
-  void reset () override;
+  void do_reset () override;
   stack::uptr next () override;
   std::string name () const override;
 };
@@ -143,6 +143,15 @@ of any assertion is always either ``?`` or ``!``, and both flavors are
 always available.
 
 )docstring";
+
+  // Comparisons work with values of any type.
+  builtin_protomap
+  cmp_protomap ()
+  {
+    return {
+      builtin_prototype ({value::vtype, value::vtype}, yield::pred, {}),
+    };
+  }
 }
 
 std::unique_ptr <pred>
@@ -166,6 +175,12 @@ builtin_eq::docstring () const
   return cmp_docstring;
 }
 
+builtin_protomap
+builtin_eq::protomap () const
+{
+  return cmp_protomap ();
+}
+
 
 std::unique_ptr <pred>
 builtin_lt::build_pred () const
@@ -188,6 +203,12 @@ builtin_lt::docstring () const
   return cmp_docstring;
 }
 
+builtin_protomap
+builtin_lt::protomap () const
+{
+  return cmp_protomap ();
+}
+
 
 std::unique_ptr <pred>
 builtin_gt::build_pred () const
@@ -209,3 +230,9 @@ builtin_gt::docstring () const
 {
   return cmp_docstring;
 }
+
+builtin_protomap
+builtin_gt::protomap () const
+{
+  return cmp_protomap ();
+}
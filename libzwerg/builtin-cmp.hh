@@ -40,6 +40,7 @@ struct builtin_eq
 
   char const *name () const override;
   std::string docstring () const override;
+  builtin_protomap protomap () const override;
 };
 
 struct builtin_lt
@@ -51,6 +52,7 @@ struct builtin_lt
 
   char const *name () const override;
   std::string docstring () const override;
+  builtin_protomap protomap () const override;
 };
 
 struct builtin_gt
@@ -62,6 +64,7 @@ struct builtin_gt
 
   char const *name () const override;
   std::string docstring () const override;
+  builtin_protomap protomap () const override;
 };
 
 #endif /* _BUILTIN_CMP_H_ */
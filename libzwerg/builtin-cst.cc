@@ -75,7 +75,7 @@ namespace
       return ss.str ();
     }
 
-    void reset () override
+    void do_reset () override
     {
       return m_upstream->reset ();
     }
@@ -104,6 +104,14 @@ builtin_constant::docstring () const
   return std::string ("@") + dom->name ();
 }
 
+builtin_protomap
+builtin_constant::protomap () const
+{
+  return {
+    builtin_prototype ({}, yield::once, {m_value->get_type ()}),
+  };
+}
+
 
 namespace
 {
@@ -137,6 +145,16 @@ Though you can achieve the same effect with formatting directives
 	=0x3=
 
 )docstring";
+
+  // Casts take a constant and yield it in a different domain.
+  builtin_protomap
+  cast_protomap ()
+  {
+    return {
+      builtin_prototype ({value_cst::vtype}, yield::maybe,
+			 {value_cst::vtype}),
+    };
+  }
 }
 
 
@@ -158,6 +176,12 @@ builtin_hex::docstring () const
   return radices_docstring;
 }
 
+builtin_protomap
+builtin_hex::protomap () const
+{
+  return cast_protomap ();
+}
+
 
 std::shared_ptr <op>
 builtin_dec::build_exec (std::shared_ptr <op> upstream) const
@@ -177,6 +201,12 @@ builtin_dec::docstring () const
   return radices_docstring;
 }
 
+builtin_protomap
+builtin_dec::protomap () const
+{
+  return cast_protomap ();
+}
+
 
 std::shared_ptr <op>
 builtin_oct::build_exec (std::shared_ptr <op> upstream) const
@@ -196,6 +226,12 @@ builtin_oct::docstring () const
   return radices_docstring;
 }
 
+builtin_protomap
+builtin_oct::protomap () const
+{
+  return cast_protomap ();
+}
+
 
 std::shared_ptr <op>
 builtin_bin::build_exec (std::shared_ptr <op> upstream) const
@@ -215,6 +251,12 @@ builtin_bin::docstring () const
   return radices_docstring;
 }
 
+builtin_protomap
+builtin_bin::protomap () const
+{
+  return cast_protomap ();
+}
+
 
 stack::uptr
 op_type::next ()
@@ -241,6 +283,14 @@ as T_CONST, T_DIE, T_STR, etc.).
 )docstring";
 }
 
+builtin_protomap
+op_type::protomap ()
+{
+  return {
+    builtin_prototype ({value::vtype}, yield::once, {value_cst::vtype}),
+  };
+}
+
 stack::uptr
 op_pos::next ()
 {
@@ -291,3 +341,11 @@ absolute and relative position of a given element.
 
 )docstring";
 }
+
+builtin_protomap
+op_pos::protomap ()
+{
+  return {
+    builtin_prototype ({value::vtype}, yield::once, {value_cst::vtype}),
+  };
+}
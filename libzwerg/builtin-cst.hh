@@ -51,6 +51,7 @@ public:
   char const *name () const override;
 
   std::string docstring () const override;
+  builtin_protomap protomap () const override;
 };
 
 struct builtin_hex
@@ -61,6 +62,7 @@ struct builtin_hex
 
   char const *name () const override;
   std::string docstring () const override;
+  builtin_protomap protomap () const override;
 };
 
 struct builtin_dec
@@ -71,6 +73,7 @@ struct builtin_dec
 
   char const *name () const override;
   std::string docstring () const override;
+  builtin_protomap protomap () const override;
 };
 
 struct builtin_oct
@@ -81,6 +84,7 @@ struct builtin_oct
 
   char const *name () const override;
   std::string docstring () const override;
+  builtin_protomap protomap () const override;
 };
 
 struct builtin_bin
@@ -91,6 +95,7 @@ struct builtin_bin
 
   char const *name () const override;
   std::string docstring () const override;
+  builtin_protomap protomap () const override;
 };
 
 struct op_type
@@ -100,6 +105,7 @@ struct op_type
   stack::uptr next () override;
 
   static std::string docstring ();
+  static builtin_protomap protomap ();
 };
 
 struct op_pos
@@ -109,6 +115,7 @@ struct op_pos
   stack::uptr next () override;
 
   static std::string docstring ();
+  static builtin_protomap protomap ();
 };
 
 #endif /* _BUILTIN_CST_H_ */
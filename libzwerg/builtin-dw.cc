@@ -26,6 +26,10 @@
    the GNU Lesser General Public License along with this program.  If
    not, see <http://www.gnu.org/licenses/>.  */
 
+#include <algorithm>
+#include <bitset>
+#include <cstring>
+#include <map>
 #include <memory>
 #include <sstream>
 
@@ -41,6 +45,7 @@
 #include "known-dwarf.h"
 #include "op.hh"
 #include "overload.hh"
+#include "planner.hh"
 #include "value-closure.hh"
 #include "value-cst.hh"
 #include "value-str.hh"
@@ -58,7 +63,8 @@ namespace
     value_dwarf
     operate (std::unique_ptr <value_str> a) override
     {
-      return value_dwarf (a->get_string (), 0, doneness::cooked);
+      std::string fn {a->c_str (), a->length ()};
+      return value_dwarf (fn, 0, doneness::cooked);
     }
 
     static std::string
@@ -82,53 +88,92 @@ opened, and a Dwarf value representing that file is yielded::
 // unit
 namespace
 {
-  bool
-  next_acceptable_unit (doneness d, cu_iterator &it)
-  {
-    if (d == doneness::raw)
-      return true;
-
-    for (; it != cu_iterator::end (); ++it)
-      // In cooked mode, we reject partial units.
-      // XXX Should we reject type units as well?
-      if (dwarf_tag (*it) != DW_TAG_partial_unit)
-	return true;
-
-    return false;
-  }
-
-  struct dwarf_unit_producer
+  // Yields the units whose header is at a given offset, like
+  // dwarf_unit_producer followed by (offset == OFF) would, but finds
+  // them by a binary search through CU DIE's that die_index keeps.
+  struct dwarf_unit_at_producer
     : public value_producer <value_cu>
   {
     std::shared_ptr <dwfl_context> m_dwctx;
     std::vector <Dwarf *> m_dwarfs;
     std::vector <Dwarf *>::iterator m_it;
-    cu_iterator m_cuit;
+    Dwarf_Off m_off;
     size_t m_i;
     doneness m_doneness;
 
-    dwarf_unit_producer (std::shared_ptr <dwfl_context> dwctx, doneness d)
+    dwarf_unit_at_producer (std::shared_ptr <dwfl_context> dwctx,
+			    Dwarf_Off off, doneness d)
       : m_dwctx {dwctx}
       , m_dwarfs {all_dwarfs (*dwctx)}
       , m_it {m_dwarfs.begin ()}
-      , m_cuit {cu_iterator::end ()}
+      , m_off {off}
       , m_i {0}
       , m_doneness {d}
     {}
 
+    // How many units that dwarf_unit_producer would yield have their
+    // CU DIE's in the roots of IDX before IT.
+    size_t
+    units_before (die_index const &idx, uint64_t const *it) const
+    {
+      auto roots = idx.roots ();
+      size_t n = it - roots.begin ();
+      if (m_doneness == doneness::cooked)
+	{
+	  auto pus = idx.tag_offsets (DW_TAG_partial_unit);
+	  n -= it == roots.end () ? pus.size ()
+	    : std::lower_bound (pus.begin (), pus.end (), *it) - pus.begin ();
+	}
+      return n;
+    }
+
     std::unique_ptr <value_cu>
     next () override
     {
-      do
-	if (! maybe_next_dwarf (m_cuit, m_it, m_dwarfs.end ()))
-	  return nullptr;
-      while (! next_acceptable_unit (m_doneness, m_cuit));
+      while (m_it != m_dwarfs.end ())
+	{
+	  Dwarf *dw = *m_it++;
+	  die_index const &idx = m_dwctx->get_die_index (dw);
+	  auto roots = idx.roots ();
+	  size_t i = m_i;
+	  m_i += units_before (idx, roots.end ());
+
+	  // The CU DIE follows right after the unit header.
+	  auto it = std::upper_bound (roots.begin (), roots.end (), m_off);
+	  if (it == roots.end ())
+	    continue;
+
+	  Dwarf_Die cudie = dwpp_offdie (dw, *it);
+	  if (dwarf_dieoffset (&cudie) - dwarf_cuoffset (&cudie) != m_off
+	      || (m_doneness == doneness::cooked
+		  && dwarf_tag (&cudie) == DW_TAG_partial_unit))
+	    continue;
+
+	  return std::make_unique <value_cu>
+	    (m_dwctx, *cudie.cu, m_off, i + units_before (idx, it),
+	     m_doneness);
+	}
+
+      return nullptr;
+    }
+  };
+
+  // `unit` on a Dwarf followed by (offset == OFF).
+  struct op_unit_dwarf_at
+    : public op_yielding_overload <value_cu, value_dwarf>
+  {
+    Dwarf_Off m_off;
 
-      Dwarf_CU &cu = *(*m_cuit)->cu;
-      Dwarf_Off off = m_cuit.offset ();
-      m_cuit++;
+    op_unit_dwarf_at (std::shared_ptr <op> upstream, Dwarf_Off off)
+      : op_yielding_overload {upstream}
+      , m_off {off}
+    {}
 
-      return std::make_unique <value_cu> (m_dwctx, cu, off, m_i++, m_doneness);
+    std::unique_ptr <value_producer <value_cu>>
+    operate (std::unique_ptr <value_dwarf> a) override
+    {
+      return std::make_unique <dwarf_unit_at_producer>
+	(a->get_dwctx (), m_off, a->get_doneness ());
     }
   };
 
@@ -137,6 +182,15 @@ namespace
   {
     using op_yielding_overload::op_yielding_overload;
 
+    static std::shared_ptr <builtin>
+    reduce (tree const *begin, tree const *end)
+    {
+      if (auto cst = find_cst_equality (begin, end, {"offset"}))
+	return make_reduced_overload <op_unit_dwarf_at>
+	  ((Dwarf_Off) cst->value ().uval ());
+      return nullptr;
+    }
+
     std::unique_ptr <value_producer <value_cu>>
     operate (std::unique_ptr <value_dwarf> a) override
     {
@@ -258,16 +312,20 @@ originated::
 // entry
 namespace
 {
+  // MAX_DEPTH limits how deep below CUDIE the range goes, if the
+  // iterator supports that.
   template <class It>
-  std::pair <It, It> get_it_range (Dwarf_Die cudie, bool skip);
+  std::pair <It, It> get_it_range (Dwarf_Die cudie, bool skip,
+				   size_t max_depth
+					= all_dies_iterator::no_max_depth);
 
   template <>
   std::pair <all_dies_iterator, all_dies_iterator>
-  get_it_range (Dwarf_Die cudie, bool skip)
+  get_it_range (Dwarf_Die cudie, bool skip, size_t max_depth)
   {
     Dwarf *dw = dwarf_cu_getdwarf (cudie.cu);
     cu_iterator cuit {dw, cudie};
-    all_dies_iterator a (cuit);
+    all_dies_iterator a (cuit, max_depth);
     all_dies_iterator e (++cuit);
     if (skip)
       ++a;
@@ -276,7 +334,7 @@ namespace
 
   template <>
   std::pair <child_iterator, child_iterator>
-  get_it_range (Dwarf_Die cudie, bool skip)
+  get_it_range (Dwarf_Die cudie, bool skip, size_t max_depth)
   {
     // N.B. this always skips the passed-in DIE.
     child_iterator a {cudie};
@@ -332,9 +390,145 @@ namespace
     return true;
   }
 
+  bool attr_should_be_integrated (int code);
+
+  // What filters after `entry` assert about DIE's that they accept.
+  // A DIE's abbreviation decides what tag it has and (for raw DIE's)
+  // which attributes, so a DIE whose abbreviation can't satisfy
+  // M_TAGS and M_ATNAMES can be skipped without making a value of it.
+  // Subtrees deeper than M_MAX_DEPTH need not be visited at all.
+  struct entry_assertions
+  {
+    std::vector <int> m_tags;
+    std::vector <int> m_atnames;
+    size_t m_max_depth = all_dies_iterator::no_max_depth;
+
+    bool
+    constrains_abbrevs () const
+    {
+      return ! m_tags.empty () || ! m_atnames.empty ();
+    }
+  };
+
+  // Tables of abbreviation codes of each unit, telling which codes
+  // might satisfy given entry_assertions.
+  class abbrev_filter
+  {
+    std::shared_ptr <entry_assertions const> m_asserts;
+    doneness m_doneness;
+    std::map <Dwarf_CU *, std::vector <bool>> m_tables;
+    Dwarf_CU *m_last_cu;
+    std::vector <bool> const *m_last;
+
+    bool
+    may_match (Dwarf_Abbrev &abbrev) const
+    {
+      for (int tag: m_asserts->m_tags)
+	if (dwarf_getabbrevtag (&abbrev) != (unsigned) tag)
+	  return false;
+
+      size_t cnt = dwpp_abbrev_attrcnt (abbrev);
+      auto has = [&] (int atname)
+	{
+	  for (size_t i = 0; i < cnt; ++i)
+	    {
+	      unsigned int name;
+	      if (dwarf_getabbrevattr (&abbrev, i,
+				       &name, nullptr, nullptr) != 0)
+		throw_libdw ();
+	      if (name == (unsigned) atname)
+		return true;
+	    }
+	  return false;
+	};
+
+      // Cooked DIE's integrate attributes of DIE's that they refer
+      // to, which their abbreviation can't tell anything about.
+      bool integrates = m_doneness == doneness::cooked
+	&& (has (DW_AT_specification) || has (DW_AT_abstract_origin));
+
+      for (int atname: m_asserts->m_atnames)
+	if (! has (atname)
+	    && ! (integrates && attr_should_be_integrated (atname)))
+	  return false;
+
+      return true;
+    }
+
+    std::vector <bool>
+    build_table (Dwarf_Die die) const
+    {
+      std::vector <bool> ret;
+      Dwarf_Off offset = 0;
+      while (true)
+	{
+	  size_t length;
+	  Dwarf_Abbrev *abbrev = dwarf_getabbrev (&die, offset, &length);
+	  if (abbrev == nullptr)
+	    throw_libdw ();
+	  if (abbrev == DWARF_END_ABBREV)
+	    return ret;
+	  offset += length;
+
+	  // Codes past the end of the table are let through, so don't
+	  // let a stray huge code blow the table up.
+	  unsigned int code = dwarf_getabbrevcode (abbrev);
+	  if (code >= 0x10000)
+	    continue;
+	  if (code >= ret.size ())
+	    ret.resize (code + 1, true);
+	  ret[code] = may_match (*abbrev);
+	}
+    }
+
+  public:
+    abbrev_filter (std::shared_ptr <entry_assertions const> asserts,
+		   doneness d)
+      : m_asserts {asserts}
+      , m_doneness {d}
+      , m_last_cu {nullptr}
+      , m_last {nullptr}
+    {}
+
+    bool
+    accepts (Dwarf_Die &die)
+    {
+      if (die.cu != m_last_cu)
+	{
+	  auto it = m_tables.find (die.cu);
+	  if (it == m_tables.end ())
+	    it = m_tables.insert (std::make_pair (die.cu, build_table (die)))
+	      .first;
+	  m_last_cu = die.cu;
+	  m_last = &it->second;
+	}
+
+      // The DIE starts with ULEB128 code of its abbreviation.
+      auto p = static_cast <unsigned char const *> (die.addr);
+      uint64_t code = 0;
+      for (unsigned shift = 0; ; shift += 7)
+	{
+	  if (shift >= 64)
+	    return true;
+	  code |= uint64_t (*p & 0x7f) << shift;
+	  if ((*p++ & 0x80) == 0)
+	    break;
+	}
+
+      return code >= m_last->size () || (*m_last)[code];
+    }
+  };
+
   // This producer encapsulates the logic for iteration through a
   // range of DIE's, with optional inlining of partial units along the
-  // way.  Cooked producers do inline, raw ones don't.
+  // way.  Cooked producers do inline, raw ones don't.  When there is
+  // M_FILTER, DIE's that it rejects are skipped, though they still
+  // count towards positions of those that are yielded.
+  //
+  // With M_INDEX, the range is walked only MAX_DEPTH levels deep.
+  // Skipped subtrees still count towards positions too, which are
+  // therefore looked up in the index instead.  Imported partial units
+  // are walked whole, the caller needs to make sure there are none.
   template <class It>
   struct die_it_producer
     : public value_producer <value_die>
@@ -347,51 +541,270 @@ namespace
     // Chain of DIE's where partial units were imported.
     std::shared_ptr <value_die> m_import;
 
+    std::unique_ptr <abbrev_filter> m_filter;
+
+    die_index const *m_index;
+    uint64_t m_cupos;
+
     size_t m_i;
     doneness m_doneness;
 
     die_it_producer (std::shared_ptr <dwfl_context> dwctx, Dwarf_Die die,
-		     doneness d)
+		     doneness d,
+		     std::shared_ptr <entry_assertions const> asserts = nullptr,
+		     die_index const *index = nullptr)
       : m_dwctx {dwctx}
+      , m_filter {asserts != nullptr && asserts->constrains_abbrevs ()
+		  ? std::make_unique <abbrev_filter> (asserts, d) : nullptr}
+      , m_index {index}
+      , m_cupos {index != nullptr ? index->position (dwarf_dieoffset (&die))
+		 : 0}
       , m_i {0}
       , m_doneness {d}
     {
-      m_stack.push_back (get_it_range <It> (die, false));
+      size_t max_depth = all_dies_iterator::no_max_depth;
+      if (index != nullptr)
+	{
+	  assert (asserts != nullptr);
+	  max_depth = asserts->m_max_depth;
+	}
+      m_stack.push_back (get_it_range <It> (die, false, max_depth));
     }
 
     std::unique_ptr <value_die>
     next () override
     {
-      do
-	if (m_stack.empty ())
-	  return nullptr;
-      while (drop_finished_imports (m_stack, m_import)
-	     || (m_doneness == doneness::cooked
-		 && import_partial_units (m_stack, m_dwctx, m_import)));
+      while (true)
+	{
+	  do
+	    if (m_stack.empty ())
+	      return nullptr;
+	  while (drop_finished_imports (m_stack, m_import)
+		 || (m_doneness == doneness::cooked
+		     && import_partial_units (m_stack, m_dwctx, m_import)));
 
-      return std::make_unique <value_die>
-	(m_dwctx, m_import, **m_stack.back ().first++, m_i++, m_doneness);
+	  Dwarf_Die die = **m_stack.back ().first++;
+	  if (m_index != nullptr)
+	    m_i = m_index->position (dwarf_dieoffset (&die)) - m_cupos;
+
+	  if (m_filter != nullptr && ! m_filter->accepts (die))
+	    {
+	      m_i++;
+	      continue;
+	    }
+
+	  return std::make_unique <value_die>
+	    (m_dwctx, m_import, die, m_i++, m_doneness);
+	}
     }
   };
 
   std::unique_ptr <value_producer <value_die>>
   make_cu_entry_producer (std::shared_ptr <dwfl_context> dwctx, Dwarf_CU &cu,
-			  doneness d)
+			  doneness d,
+			  std::shared_ptr <entry_assertions const> asserts
+				= nullptr)
   {
+    Dwarf_Die cudie = dwpp_cudie (cu);
+
+    // Only walk as deep as the filters allow.  Cooked walks through
+    // imports put DIE's at depths that the tree doesn't show, leave
+    // those alone.
+    if (asserts != nullptr
+	&& asserts->m_max_depth != all_dies_iterator::no_max_depth
+	&& (d == doneness::raw || ! unit_has_imports (*dwctx, cudie)))
+      return std::make_unique <die_it_producer <all_dies_iterator>>
+	(dwctx, cudie, d, asserts,
+	 &dwctx->get_die_index (dwarf_cu_getdwarf (cudie.cu)));
+
     return std::make_unique <die_it_producer <all_dies_iterator>>
-      (dwctx, dwpp_cudie (cu), d);
+      (dwctx, cudie, d, asserts);
+  }
+
+  // Return tag that predicate builtin NAME asserts, or -1 if it's not
+  // a positive tag assertion.
+  int
+  asserted_tag (char const *name)
+  {
+#define ONE_KNOWN_DW_TAG(NAME, CODE)					\
+    if (strcmp (name, "?TAG_" #NAME) == 0				\
+	|| strcmp (name, "?" #CODE) == 0)				\
+      return CODE;
+    ALL_KNOWN_DW_TAG;
+#undef ONE_KNOWN_DW_TAG
+    return -1;
+  }
+
+  // Figure out which list of die_index, if any, holds all DIE's that
+  // the filters [BEGIN, END) might accept.  Returns an empty function
+  // if there's no such list.
+  die_index_producer::get_list_t
+  index_list_for (tree const *begin, tree const *end)
+  {
+    // An offset singles out at most one DIE per Dwarf.
+    if (auto cst = find_cst_equality (begin, end, {"offset"}))
+      {
+	auto off = std::make_shared <uint64_t> (cst->value ().uval ());
+	return [off] (die_index const &idx)
+	  {
+	    if (idx.position (*off) == die_index::no_position)
+	      return die_index::off_range {nullptr, nullptr};
+	    return die_index::off_range {off.get (), off.get () + 1};
+	  };
+      }
+
+    // An address is covered by a handful of nested DIE's.
+    if (auto cst = find_address_containment (begin, end))
+      {
+	Dwarf_Addr addr = cst->value ().uval ();
+	return [addr] (die_index const &idx)
+	  { return idx.address_offsets (addr); };
+      }
+
+    // Names are much more selective than tags, look for them next.
+    if (auto name = find_str_equality (begin, end, {"name", "@AT_name"}))
+      {
+	std::string n = *name;
+	return [n] (die_index const &idx)
+	  { return idx.name_offsets (n.c_str ()); };
+      }
+
+    if (auto name = find_str_equality
+		(begin, end, {"@AT_linkage_name", "@AT_MIPS_linkage_name"}))
+      {
+	std::string n = *name;
+	return [n] (die_index const &idx)
+	  { return idx.linkage_name_offsets (n.c_str ()); };
+      }
+
+    if (auto b = find_pred_builtin (begin, end, [] (char const *name)
+				    { return asserted_tag (name) >= 0; }))
+      {
+	int tag = asserted_tag (b->name ());
+	return [tag] (die_index const &idx)
+	  { return idx.tag_offsets (tag); };
+      }
+
+    return nullptr;
+  }
+
+  // Return attribute that predicate builtin NAME asserts, or -1 if
+  // it's not a positive attribute assertion.
+  int
+  asserted_attribute (char const *name)
+  {
+#define ONE_KNOWN_DW_AT(NAME, CODE)					\
+    if (strcmp (name, "?AT_" #NAME) == 0				\
+	|| strcmp (name, "?" #CODE) == 0)				\
+      return CODE;
+    ALL_KNOWN_DW_AT;
+#undef ONE_KNOWN_DW_AT
+    return -1;
   }
 
+  // Whether predicate builtin NAME only holds for CU DIE's.
+  bool
+  asserts_root (char const *name)
+  {
+    if (strcmp (name, "?root") == 0)
+      return true;
+
+    switch (asserted_tag (name))
+      {
+      case DW_TAG_compile_unit:
+      case DW_TAG_partial_unit:
+      case DW_TAG_type_unit:
+	return true;
+      default:
+	return false;
+      }
+  }
+
+  // Collect tags and attributes that the filters [BEGIN, END) assert,
+  // and how deep DIE's that they accept may lie.  E.g. after
+  // ?(parent ?root), only children of CU DIE's pass.  Return nullptr
+  // if the filters assert none of that.
+  std::shared_ptr <entry_assertions const>
+  entry_assertions_for (tree const *begin, tree const *end)
+  {
+    auto ret = std::make_shared <entry_assertions> ();
+    for_each_pred_builtin (begin, end, [&ret] (builtin const &b)
+      {
+	int tag = asserted_tag (b.name ());
+	if (tag >= 0)
+	  ret->m_tags.push_back (tag);
+	int atname = asserted_attribute (b.name ());
+	if (atname >= 0)
+	  ret->m_atnames.push_back (atname);
+      });
+
+    int depth = find_pred_after_steps (begin, end, "parent", asserts_root);
+    if (depth >= 0)
+      ret->m_max_depth = depth;
+
+    if (! ret->constrains_abbrevs ()
+	&& ret->m_max_depth == all_dies_iterator::no_max_depth)
+      return nullptr;
+    return ret;
+  }
+
+  // `entry` on a CU reduced to a walk through a die_index list.
+  struct op_entry_cu_indexed
+    : public op_yielding_overload <value_die, value_cu>
+  {
+    die_index_producer::get_list_t m_get;
+    std::shared_ptr <entry_assertions const> m_asserts;
+
+    op_entry_cu_indexed (std::shared_ptr <op> upstream,
+			 die_index_producer::get_list_t get,
+			 std::shared_ptr <entry_assertions const> asserts)
+      : op_yielding_overload {upstream}
+      , m_get {get}
+      , m_asserts {asserts}
+    {}
+
+    std::unique_ptr <value_producer <value_die>>
+    operate (std::unique_ptr <value_cu> a) override
+    {
+      Dwarf_Die cudie = dwpp_cudie (a->get_cu ());
+      if (a->is_cooked () && unit_has_imports (*a->get_dwctx (), cudie))
+	return make_cu_entry_producer (a->get_dwctx (), a->get_cu (),
+				       a->get_doneness (), m_asserts);
+
+      return std::make_unique <die_index_producer>
+	(a->get_dwctx (), m_get, a->get_doneness (), cudie);
+    }
+  };
+
   struct op_entry_cu
     : public op_yielding_overload <value_die, value_cu>
   {
-    using op_yielding_overload::op_yielding_overload;
+    // When not null, DIE's that can't satisfy these are skipped.
+    std::shared_ptr <entry_assertions const> m_asserts;
+
+    explicit op_entry_cu (std::shared_ptr <op> upstream,
+			  std::shared_ptr <entry_assertions const> asserts
+				= nullptr)
+      : op_yielding_overload {upstream}
+      , m_asserts {asserts}
+    {}
+
+    static std::shared_ptr <builtin>
+    reduce (tree const *begin, tree const *end)
+    {
+      auto asserts = entry_assertions_for (begin, end);
+      if (auto get = index_list_for (begin, end))
+	return make_reduced_overload <op_entry_cu_indexed> (get, asserts);
+      if (asserts != nullptr)
+	return make_reduced_overload <op_entry_cu> (asserts);
+      return nullptr;
+    }
 
     std::unique_ptr <value_producer <value_die>>
     operate (std::unique_ptr <value_cu> a) override
     {
       return make_cu_entry_producer (a->get_dwctx (), a->get_cu (),
-				     a->get_doneness ());
+				     a->get_doneness (), m_asserts);
     }
 
     static std::string
@@ -433,6 +846,93 @@ several times, each time in a different context::
     }
   };
 
+  // Yields all DIE's of a Dwarf, like `unit entry` does.  DIE's that
+  // can't satisfy ASSERTS, if given, are skipped.
+  struct dwarf_entry_producer
+    : public value_producer <value_die>
+  {
+    dwarf_unit_producer m_units;
+    std::unique_ptr <value_producer <value_die>> m_entries;
+    std::shared_ptr <entry_assertions const> m_asserts;
+
+    dwarf_entry_producer (std::shared_ptr <dwfl_context> dwctx, doneness d,
+			  std::shared_ptr <entry_assertions const> asserts
+				= nullptr)
+      : m_units {dwctx, d}
+      , m_asserts {asserts}
+    {}
+
+    std::unique_ptr <value_die>
+    next () override
+    {
+      while (true)
+	{
+	  if (m_entries != nullptr)
+	    if (auto v = m_entries->next ())
+	      return v;
+
+	  auto cu = m_units.next ();
+	  if (cu == nullptr)
+	    return nullptr;
+
+	  m_entries = make_cu_entry_producer (cu->get_dwctx (), cu->get_cu (),
+					      cu->get_doneness (), m_asserts);
+	}
+    }
+  };
+
+  // This is what `entry` on a Dwarf reduces to when followed by a
+  // filter that the index can answer.  Instead of visiting each DIE,
+  // it only yields those that the index lists.  Cooked iteration
+  // inlines imported partial units, which the index doesn't model, so
+  // in that case it falls back to visiting everything.
+  struct op_entry_dwarf_indexed
+    : public op_yielding_overload <value_die, value_dwarf>
+  {
+    die_index_producer::get_list_t m_get;
+    std::shared_ptr <entry_assertions const> m_asserts;
+
+    op_entry_dwarf_indexed (std::shared_ptr <op> upstream,
+			    die_index_producer::get_list_t get,
+			    std::shared_ptr <entry_assertions const> asserts)
+      : op_yielding_overload {upstream}
+      , m_get {get}
+      , m_asserts {asserts}
+    {}
+
+    std::unique_ptr <value_producer <value_die>>
+    operate (std::unique_ptr <value_dwarf> a) override
+    {
+      if (a->is_cooked () && dwarf_has_imports (*a->get_dwctx ()))
+	return std::make_unique <dwarf_entry_producer>
+	  (a->get_dwctx (), a->get_doneness (), m_asserts);
+
+      return std::make_unique <die_index_producer>
+	(a->get_dwctx (), m_get, a->get_doneness ());
+    }
+  };
+
+  // `entry` on a Dwarf followed by filters that assert tags or
+  // attributes, which no index answers.
+  struct op_entry_dwarf_filtered
+    : public op_yielding_overload <value_die, value_dwarf>
+  {
+    std::shared_ptr <entry_assertions const> m_asserts;
+
+    op_entry_dwarf_filtered (std::shared_ptr <op> upstream,
+			     std::shared_ptr <entry_assertions const> asserts)
+      : op_yielding_overload {upstream}
+      , m_asserts {asserts}
+    {}
+
+    std::unique_ptr <value_producer <value_die>>
+    operate (std::unique_ptr <value_dwarf> a) override
+    {
+      return std::make_unique <dwarf_entry_producer>
+	(a->get_dwctx (), a->get_doneness (), m_asserts);
+    }
+  };
+
   template <class A, class B>
   struct op_entry_dwarf_base
     : public stub_op
@@ -474,6 +974,17 @@ behaves equivalently to tho following::
 
     static selector get_selector ()
     { return {value_dwarf::vtype}; }
+
+    static std::shared_ptr <builtin>
+    reduce (tree const *begin, tree const *end)
+    {
+      auto asserts = entry_assertions_for (begin, end);
+      if (auto get = index_list_for (begin, end))
+	return make_reduced_overload <op_entry_dwarf_indexed> (get, asserts);
+      if (asserts != nullptr)
+	return make_reduced_overload <op_entry_dwarf_filtered> (asserts);
+      return nullptr;
+    }
   };
 }
 
@@ -488,11 +999,98 @@ namespace
       (dwctx, parent, d);
   }
 
+  struct single_die_producer
+    : public value_producer <value_die>
+  {
+    std::unique_ptr <value_die> m_die;
+
+    explicit single_die_producer (std::unique_ptr <value_die> die)
+      : m_die {std::move (die)}
+    {}
+
+    std::unique_ptr <value_die>
+    next () override
+    {
+      return std::move (m_die);
+    }
+  };
+
+  // Holds for raw DIE's.  Walking raw DIE's up or down the tree never
+  // comes back to where it started.  Cooked DIE's follow imports,
+  // which could in principle loop.
+  struct raw_die_test
+    : public value_test
+  {
+    pred_result
+    result (value &val) override
+    {
+      auto die = value::as <value_die> (&val);
+      return pred_result (die != nullptr && die->is_raw ());
+    }
+  };
+
+  // `child` followed by (offset == OFF).  The child is looked up by
+  // following the sibling chain, which is cheap compared to making a
+  // value out of each child and comparing its offset.  Cooked
+  // children of a DIE that imports partial units come from elsewhere,
+  // in which case this falls back to the full iteration.
+  struct op_child_die_at
+    : public op_yielding_overload <value_die, value_die>
+  {
+    Dwarf_Off m_off;
+
+    op_child_die_at (std::shared_ptr <op> upstream, Dwarf_Off off)
+      : op_yielding_overload {upstream}
+      , m_off {off}
+    {}
+
+    std::unique_ptr <value_producer <value_die>>
+    operate (std::unique_ptr <value_die> a) override
+    {
+      bool cooked = a->is_cooked ();
+      std::unique_ptr <value_die> ret;
+
+      size_t pos = 0;
+      for (child_iterator it {a->get_die ()};
+	   it != child_iterator::end (); ++it, ++pos)
+	{
+	  if (cooked && dwarf_tag (*it) == DW_TAG_imported_unit)
+	    return make_die_child_producer (a->get_dwctx (), a->get_die (),
+					    a->get_doneness ());
+
+	  if (ret == nullptr && dwarf_dieoffset (*it) == m_off)
+	    {
+	      ret = std::make_unique <value_die>
+		(a->get_dwctx (), nullptr, **it, pos, a->get_doneness ());
+	      if (! cooked)
+		break;
+	    }
+	}
+
+      return std::make_unique <single_die_producer> (std::move (ret));
+    }
+  };
+
   struct op_child_die
     : public op_yielding_overload <value_die, value_die>
   {
     using op_yielding_overload::op_yielding_overload;
 
+    static std::shared_ptr <builtin>
+    reduce (tree const *begin, tree const *end)
+    {
+      if (auto cst = find_cst_equality (begin, end, {"offset"}))
+	return make_reduced_overload <op_child_die_at>
+	  ((Dwarf_Off) cst->value ().uval ());
+      return nullptr;
+    }
+
+    static std::unique_ptr <value_test>
+    build_acyclic_test ()
+    {
+      return std::make_unique <raw_die_test> ();
+    }
+
     std::unique_ptr <value_producer <value_die>>
     operate (std::unique_ptr <value_die> a) override
     {
@@ -775,8 +1373,10 @@ namespace
     doneness m_doneness;
     bool m_secondary;
 
-    // Already seen attributes.
-    std::vector <int> m_seen;
+    // Already seen attributes.  Codes of standard attributes fit in
+    // M_SEEN, vendor extensions go to M_SEEN_EXT.
+    std::bitset <256> m_seen;
+    std::vector <int> m_seen_ext;
 
     // We store full DIE's to allow DW_AT_specification's in a
     // separate debug info files.
@@ -802,7 +1402,7 @@ namespace
 	return false;
 
       m_die = m_next.back ();
-      m_it = attr_iterator {&m_die};
+      m_it.reset (&m_die);
       m_next.pop_back ();
       return true;
     }
@@ -810,8 +1410,19 @@ namespace
     bool
     seen (int atname) const
     {
-      return std::find (std::begin (m_seen), std::end (m_seen),
-			atname) != std::end (m_seen);
+      if ((size_t) atname < m_seen.size ())
+	return m_seen.test (atname);
+      return std::find (std::begin (m_seen_ext), std::end (m_seen_ext),
+			atname) != std::end (m_seen_ext);
+    }
+
+    void
+    mark_seen (int atname)
+    {
+      if ((size_t) atname < m_seen.size ())
+	m_seen.set (atname);
+      else
+	m_seen_ext.push_back (atname);
     }
 
     attribute_producer (std::unique_ptr <value_die> value)
@@ -839,7 +1450,8 @@ namespace
 	    else
 	      m_secondary = true;
 
-	  at = **m_it++;
+	  at = **m_it;
+	  ++m_it;
 	  if (integrate
 	      && (at.code == DW_AT_specification
 		  || at.code == DW_AT_abstract_origin))
@@ -858,7 +1470,7 @@ namespace
 	}
       while (integrate && seen (at.code));
 
-      m_seen.push_back (at.code);
+      mark_seen (at.code);
       return std::make_unique <value_attr>
 		(m_dwctx, at, m_die, m_i++, m_doneness);
     }
@@ -1405,6 +2017,12 @@ namespace
       return do_operate (std::move (a));
     }
 
+    static std::unique_ptr <value_test>
+    build_acyclic_test ()
+    {
+      return std::make_unique <raw_die_test> ();
+    }
+
     static std::string
     docstring ()
     {
@@ -2075,6 +2693,100 @@ where all of *B*'s addresses are covered by *A*.
   };
 }
 
+// lookup
+namespace
+{
+  // Yields DIE's that cover an address, except those that have a
+  // covering descendant.  The index lists the covering DIE's in
+  // pre-order, where descendants of a DIE come right after it, so it
+  // is enough to look at each one's successor.
+  struct innermost_die_producer
+    : public value_producer <value_die>
+  {
+    std::shared_ptr <dwfl_context> m_dwctx;
+    die_index_producer m_dies;
+    std::unique_ptr <value_die> m_pending;
+
+    innermost_die_producer (std::shared_ptr <dwfl_context> dwctx,
+			    Dwarf_Addr addr, doneness d)
+      : m_dwctx {dwctx}
+      , m_dies {dwctx, [addr] (die_index const &idx)
+		{ return idx.address_offsets (addr); }, d}
+    {}
+
+    // Whether A is an ancestor of B.
+    bool
+    encloses (value_die &a, value_die &b)
+    {
+      Dwarf *dw = dwarf_cu_getdwarf (a.get_die ().cu);
+      if (dw != dwarf_cu_getdwarf (b.get_die ().cu))
+	return false;
+
+      die_index const &idx = m_dwctx->get_die_index (dw);
+      Dwarf_Off aoff = dwarf_dieoffset (&a.get_die ());
+      Dwarf_Off off = dwarf_dieoffset (&b.get_die ());
+      while (idx.find_parent (off, off))
+	if (off == aoff)
+	  return true;
+      return false;
+    }
+
+    std::unique_ptr <value_die>
+    next () override
+    {
+      while (auto die = m_dies.next ())
+	{
+	  auto prev = std::move (m_pending);
+	  m_pending = std::move (die);
+	  if (prev != nullptr && ! encloses (*prev, *m_pending))
+	    return prev;
+	}
+
+      return std::move (m_pending);
+    }
+  };
+
+  struct op_lookup_dwarf_cst
+    : public op_yielding_overload <value_die, value_dwarf, value_cst>
+  {
+    using op_yielding_overload::op_yielding_overload;
+
+    std::unique_ptr <value_producer <value_die>>
+    operate (std::unique_ptr <value_dwarf> a,
+	     std::unique_ptr <value_cst> b) override
+    {
+      auto av = addressify (b->get_constant ());
+      return std::make_unique <innermost_die_producer>
+	(a->get_dwctx (), av.uval (), a->get_doneness ());
+    }
+
+    static std::string
+    docstring ()
+    {
+      return
+R"docstring(
+
+Takes a Dwarf and an address on TOS, and yields the innermost DIE's
+whose address ranges cover that address.  DIE's that cover it, but
+have a descendant that covers it as well, are not yielded.  This uses
+an address index, and is much faster than visiting each DIE and
+asking for its ``address``::
+
+	$ dwgrep ./tests/testfile_const_type -e '0x80482f0 lookup "%s"'
+	[7d] subprogram
+
+To get all DIE's that cover an address, use the following.  It uses
+the same index::
+
+	entry ?(address ?(0x80482f0 ?contains))
+
+Imported partial units are not looked into, even for cooked Dwarf.
+
+)docstring";
+    }
+  };
+}
+
 // ?overlaps
 namespace
 {
@@ -2283,29 +2995,57 @@ or replaced since the Dwarf was opened.
   {
     using op_overload::op_overload;
 
-    std::unique_ptr <value_str>
-    operate (std::unique_ptr <value_die> a) override
+    static char const *
+    die_name (value_die &a)
     {
-      if (a->is_cooked ())
-	{
-	  // On cooked DIE's, `name` integrates.
-	  const char *name = dwarf_diename (&a->get_die ());
-	  if (name != nullptr)
-	    return std::make_unique <value_str> (name, 0);
-	  else
-	    return nullptr;
-	}
+      if (a.is_cooked ())
+	// On cooked DIE's, `name` integrates.
+	return dwarf_diename (&a.get_die ());
       // Unfortunately there's no non-integrating dwarf_diename
       // counterpart.
-      else if (dwarf_hasattr (&a->get_die (), DW_AT_name))
+      else if (dwarf_hasattr (&a.get_die (), DW_AT_name))
 	{
-	  Dwarf_Attribute attr = dwpp_attr (a->get_die (), DW_AT_name);
-	  return std::make_unique <value_str> (dwpp_formstring (attr), 0);
+	  Dwarf_Attribute attr = dwpp_attr (a.get_die (), DW_AT_name);
+	  return dwpp_formstring (attr);
 	}
       else
 	return nullptr;
     }
 
+    std::unique_ptr <value_str>
+    operate (std::unique_ptr <value_die> a) override
+    {
+      if (char const *name = die_name (*a))
+	return std::make_unique <value_str> (name, a->get_dwctx (), 0);
+      else
+	return nullptr;
+    }
+
+    // (name == "X") is fused to a direct comparison of the name,
+    // without making a value_str out of it.
+    struct name_equality_test
+      : public value_test
+    {
+      std::string m_str;
+
+      explicit name_equality_test (std::string str)
+	: m_str {str}
+      {}
+
+      pred_result
+      result (value &val) override
+      {
+	char const *name = die_name (static_cast <value_die &> (val));
+	return pred_result (name != nullptr && m_str == name);
+      }
+    };
+
+    static std::unique_ptr <value_test>
+    build_str_equality_test (std::string const &str)
+    {
+      return std::make_unique <name_equality_test> (str);
+    }
+
     static std::string
     docstring ()
     {
@@ -3212,6 +3952,14 @@ dwgrep_vocabulary_dw ()
       (std::make_shared <overloaded_pred_builtin> ("!contains", t, false));
   }
 
+  {
+    auto t = std::make_shared <overload_tab> ();
+
+    t->add_op_overload <op_lookup_dwarf_cst> ();
+
+    voc.add (std::make_shared <overloaded_op_builtin> ("lookup", t));
+  }
+
   {
     auto t = std::make_shared <overload_tab> ();
 
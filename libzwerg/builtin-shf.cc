@@ -56,6 +56,18 @@ what sub-expressions are for), and the deep stack manipulation should
 be unnecessary as well.  But they are present for completeness' sake.
 
 )docstring";
+
+  // Shuffling words take IN values of any type and leave OUT of
+  // them on stack.  Which of them go where is up to the planner.
+  builtin_protomap
+  shf_protomap (size_t in, size_t out)
+  {
+    return {
+      builtin_prototype (std::vector <value_type> (in, value::vtype),
+			 yield::once,
+			 std::vector <value_type> (out, value::vtype)),
+    };
+  }
 }
 
 stack::uptr
@@ -75,6 +87,12 @@ op_drop::docstring ()
   return shf_docstring;
 }
 
+builtin_protomap
+op_drop::protomap ()
+{
+  return shf_protomap (1, 0);
+}
+
 
 stack::uptr
 op_swap::next ()
@@ -96,6 +114,12 @@ op_swap::docstring ()
   return shf_docstring;
 }
 
+builtin_protomap
+op_swap::protomap ()
+{
+  return shf_protomap (2, 2);
+}
+
 
 stack::uptr
 op_dup::next ()
@@ -114,6 +138,12 @@ op_dup::docstring ()
   return shf_docstring;
 }
 
+builtin_protomap
+op_dup::protomap ()
+{
+  return shf_protomap (1, 2);
+}
+
 
 stack::uptr
 op_over::next ()
@@ -132,6 +162,12 @@ op_over::docstring ()
   return shf_docstring;
 }
 
+builtin_protomap
+op_over::protomap ()
+{
+  return shf_protomap (2, 3);
+}
+
 
 stack::uptr
 op_rot::next ()
@@ -154,3 +190,9 @@ op_rot::docstring ()
 {
   return shf_docstring;
 }
+
+builtin_protomap
+op_rot::protomap ()
+{
+  return shf_protomap (3, 3);
+}
@@ -60,6 +60,30 @@ builtin::protomap () const
   return {};
 }
 
+std::shared_ptr <builtin>
+builtin::reduce (tree const *begin, tree const *end) const
+{
+  return nullptr;
+}
+
+std::unique_ptr <value_test>
+builtin::build_value_test (value_type vt) const
+{
+  return nullptr;
+}
+
+std::unique_ptr <value_test>
+builtin::build_str_equality_test (value_type vt, std::string const &str) const
+{
+  return nullptr;
+}
+
+std::unique_ptr <value_test>
+builtin::build_acyclic_test () const
+{
+  return nullptr;
+}
+
 std::unique_ptr <pred>
 maybe_invert (std::unique_ptr <pred> pred, bool positive)
 {
@@ -69,6 +93,15 @@ maybe_invert (std::unique_ptr <pred> pred, bool positive)
     return std::make_unique <pred_not> (std::move (pred));
 }
 
+std::unique_ptr <value_test>
+maybe_invert (std::unique_ptr <value_test> test, bool positive)
+{
+  if (positive || test == nullptr)
+    return test;
+  else
+    return std::make_unique <value_test_not> (std::move (test));
+}
+
 vocabulary::vocabulary ()
   : m_builtins {}
 {}
@@ -39,6 +39,8 @@
 
 struct pred;
 struct op;
+struct tree;
+class value_test;
 
 enum class yield
   {
@@ -78,12 +80,45 @@ public:
 
   virtual std::string docstring () const;
   virtual builtin_protomap protomap () const;
+
+  // Strength reduction.  [BEGIN, END) are filters (see is_filter)
+  // that follow this builtin in a concatenation.  A builtin that can
+  // make use of them returns another builtin, whose op yields, in the
+  // same order, only those stacks that the filters might accept.  The
+  // filters themselves are still applied afterwards.  Returns nullptr
+  // if there is nothing to reduce.
+  virtual std::shared_ptr <builtin>
+  reduce (tree const *begin, tree const *end) const;
+
+  // Operator fusion, see fuse_filters.  If this builtin is a
+  // predicate that, on a stack whose TOS is of type VT, only looks at
+  // TOS, return a test that evaluates it directly on that value.
+  // Returns nullptr otherwise.
+  virtual std::unique_ptr <value_test>
+  build_value_test (value_type vt) const;
+
+  // Likewise, but for a builtin that on such a stack yields at most
+  // one string that it derives from TOS.  The test holds if that
+  // string is STR.
+  virtual std::unique_ptr <value_test>
+  build_str_equality_test (value_type vt, std::string const &str) const;
+
+  // Return a test that holds for those TOS values from which repeated
+  // application of this builtin never yields the same stack twice.
+  // Closures over such values need not remember what they have seen,
+  // see op_tr_closure.  Returns nullptr if there are no such values.
+  virtual std::unique_ptr <value_test>
+  build_acyclic_test () const;
 };
 
 // Return either PRED, or PRED_NOT(PRED), depending on POSITIVE.
 std::unique_ptr <pred> maybe_invert (std::unique_ptr <pred> pred,
 				     bool positive);
 
+// Likewise for value tests.
+std::unique_ptr <value_test> maybe_invert (std::unique_ptr <value_test> test,
+					   bool positive);
+
 class pred_builtin
   : public builtin
 {
@@ -172,6 +207,12 @@ add_simple_exec_builtin (vocabulary &voc, char const *name)
     {
       return Op::docstring ();
     }
+
+    builtin_protomap
+    protomap () const override
+    {
+      return Op::protomap ();
+    }
   };
 
   voc.add (std::make_shared <simple_exec_builtin> (name));
@@ -28,92 +28,212 @@
 
 #include <cassert>
 #include <algorithm>
+#include <exception>
 #include <memory>
+#include <thread>
 
+#include "std-memory.hh"
 #include "cache.hh"
 #include "dwpp.hh"
 #include "dwit.hh"
 
-void
-parent_cache::recursively_populate_unit (unit_cache_t &uc, Dwarf_Die die,
-					 Dwarf_Off paroff)
+namespace
 {
-  while (true)
-    {
-      Dwarf_Off off = dwarf_dieoffset (&die);
-      uc.push_back (std::make_pair (off, paroff));
-
+  // Walk units [BEGIN, END) in pre-order.  Append offsets of their
+  // DIE's to OFFS, and for each DIE, index of its parent in OFFS (or
+  // -1 for root DIE's) to PARENTS.  This is done iteratively, deeply
+  // nested DIE trees are not unheard of.
+  void
+  walk_units (Dwarf_Die const *begin, Dwarf_Die const *end,
+	      std::vector <Dwarf_Off> &offs, std::vector <uint64_t> &parents)
+  {
+    // DIE's on the path from the root to the current DIE, with their
+    // indices.
+    std::vector <std::pair <Dwarf_Die, uint64_t>> ancestors;
+    for (auto it = begin; it != end; ++it)
       {
-	Dwarf_Die child;
-	if (dwpp_child (die, child))
-	  recursively_populate_unit (uc, child, off);
+	Dwarf_Die die = *it;
+	while (true)
+	  {
+	    offs.push_back (dwarf_dieoffset (&die));
+	    parents.push_back (ancestors.empty () ? (uint64_t) -1
+			       : ancestors.back ().second);
+
+	    Dwarf_Die child;
+	    if (dwpp_child (die, child))
+	      {
+		ancestors.push_back (std::make_pair (die, offs.size () - 1));
+		die = child;
+		continue;
+	      }
+
+	    while (! ancestors.empty () && ! dwpp_siblingof (die, die))
+	      {
+		die = ancestors.back ().first;
+		ancestors.pop_back ();
+	      }
+
+	    if (ancestors.empty ())
+	      break;
+	  }
       }
+  }
+
+  std::vector <Dwarf_Die>
+  unit_dies (Dwarf *dw)
+  {
+    std::vector <Dwarf_Die> ret;
+    for (auto it = cu_iterator {dw}; it != cu_iterator::end (); ++it)
+      ret.push_back (**it);
+    return ret;
+  }
+}
+
+parent_cache::dwarf_table::dwarf_table (Dwarf *dw, unsigned nthreads)
+{
+  std::vector <Dwarf_Die> cus = unit_dies (dw);
+  std::vector <uint64_t> parents;
+
+  if (nthreads <= 1 || cus.size () <= 1)
+    walk_units (cus.data (), cus.data () + cus.size (), m_offs, parents);
+  else
+    {
+      // Units are independent of each other, so split them into
+      // contiguous runs of about the same size, walk each in a thread
+      // of its own, and then concatenate the results.  A DIE's parent
+      // is in the same unit, so parent indices only need to be
+      // shifted by where the run ends up.
+      nthreads = std::min <size_t> (nthreads, cus.size ());
+      Dwarf_Off total = dwarf_dieoffset (&cus.back ())
+	- dwarf_dieoffset (&cus.front ()) + 1;
+
+      std::vector <size_t> bounds {0};
+      for (size_t i = 1; i < cus.size (); ++i)
+	if ((dwarf_dieoffset (&cus[i]) - dwarf_dieoffset (&cus.front ()))
+	    * nthreads >= total * bounds.size ())
+	  bounds.push_back (i);
+      bounds.push_back (cus.size ());
+
+      size_t nruns = bounds.size () - 1;
+      std::vector <std::vector <Dwarf_Off>> offs (nruns);
+      std::vector <std::vector <uint64_t>> pars (nruns);
+      std::vector <std::exception_ptr> errors (nruns);
+      std::vector <std::thread> threads;
+      for (size_t i = 0; i < nruns; ++i)
+	threads.push_back (std::thread {[&, i] ()
+	    {
+	      try
+		{
+		  walk_units (&cus[bounds[i]], &cus[0] + bounds[i + 1],
+			      offs[i], pars[i]);
+		}
+	      catch (...)
+		{
+		  errors[i] = std::current_exception ();
+		}
+	    }});
+
+      for (auto &thread: threads)
+	thread.join ();
+      for (auto const &error: errors)
+	if (error != nullptr)
+	  std::rethrow_exception (error);
+
+      for (size_t i = 0; i < nruns; ++i)
+	{
+	  uint64_t base = m_offs.size ();
+	  m_offs.insert (m_offs.end (), offs[i].begin (), offs[i].end ());
+	  for (uint64_t p: pars[i])
+	    parents.push_back (p == (uint64_t) -1 ? p : p + base);
+	}
+    }
+
+  // Units come in file order and DIE's are walked in pre-order, so
+  // offsets come out sorted.
+  assert (std::is_sorted (m_offs.begin (), m_offs.end ()));
 
-      switch (dwarf_siblingof (&die, &die))
+  if (m_offs.size () < no_index)
+    {
+      m_parents.reserve (parents.size ());
+      for (uint64_t p: parents)
+	m_parents.push_back (p == (uint64_t) -1 ? no_index : (uint32_t) p);
+    }
+  else
+    m_parents64 = std::move (parents);
+
+  if (! m_offs.empty ())
+    {
+      m_buckets.resize ((m_offs.back () >> bucket_shift) + 1);
+      size_t i = 0;
+      for (size_t b = 0; b < m_buckets.size (); ++b)
 	{
-	case 0:
-	  break;
-	case -1:
-	  throw_libdw ();
-	case 1:
-	  return;
+	  while (i < m_offs.size () && (m_offs[i] >> bucket_shift) < b)
+	    ++i;
+	  m_buckets[b] = i;
 	}
     }
 }
 
-parent_cache::unit_cache_t
-parent_cache::populate_unit (Dwarf_Die die)
+Dwarf_Off
+parent_cache::dwarf_table::find (Dwarf_Off off) const
 {
-  unit_cache_t uc;
-  recursively_populate_unit (uc, die, no_off);
-  return uc;
+  size_t b = off >> bucket_shift;
+  assert (b < m_buckets.size ());
+
+  size_t i = m_buckets[b];
+  while (m_offs[i] < off)
+    ++i;
+  assert (m_offs[i] == off);
+
+  if (! m_parents64.empty ())
+    {
+      uint64_t p = m_parents64[i];
+      return p == (uint64_t) -1 ? no_off : m_offs[p];
+    }
+
+  uint32_t p = m_parents[i];
+  return p == no_index ? no_off : m_offs[p];
 }
 
 Dwarf_Off
 parent_cache::find (Dwarf_Die die)
 {
-  Dwarf_Die cudie;
-  if (dwarf_diecu (&die, &cudie, nullptr, nullptr) == nullptr)
-    throw_libdw ();
-
-  Dwarf_Off cuoff = dwarf_dieoffset (&cudie);
   Dwarf *dw = dwarf_cu_getdwarf (die.cu);
-  auto key = std::make_pair (dw, cuoff);
-
-  auto it = m_cache.find (key);
-  if (it == m_cache.end ())
-    it = m_cache.insert (std::make_pair (key, populate_unit (cudie))).first;
+  return m_tables.get (dw, [] (Dwarf *dw)
+			{
+			  return std::make_unique <dwarf_table> (dw, 1);
+			})
+    .find (dwarf_dieoffset (&die));
+}
 
-  Dwarf_Off dieoff = dwarf_dieoffset (&die);
-  auto jt = std::lower_bound
-    (it->second.begin (), it->second.end (), dieoff,
-     [] (std::pair <Dwarf_Off, Dwarf_Off> const &a, Dwarf_Off b)
-     {
-       return a.first < b;
-     });
-
-  assert (jt != it->second.end ());
-  assert (jt->first == dieoff);
-  return jt->second;
+void
+parent_cache::prebuild (Dwarf *dw, unsigned nthreads)
+{
+  m_tables.get (dw, [nthreads] (Dwarf *dw)
+		{
+		  return std::make_unique <dwarf_table> (dw, nthreads);
+		});
 }
 
 
+root_cache::off_vect const &
+root_cache::populate (Dwarf *dw)
+{
+  return m_roots.get (dw, [] (Dwarf *dw) -> std::unique_ptr <off_vect>
+		      {
+			auto ret = std::make_unique <off_vect> ();
+			for (auto it = cu_iterator { dw };
+			     it != cu_iterator::end (); ++it)
+			  ret->push_back (dwarf_dieoffset (*it));
+			return ret;
+		      });
+}
+
 bool
 root_cache::is_root (Dwarf_Die die)
 {
-  Dwarf *dw = dwarf_cu_getdwarf (die.cu);
-  auto it = m_cache.find (dw);
-  if (it == m_cache.end ())
-    {
-      off_vect v;
-      for (auto jt = cu_iterator { dw }; jt != cu_iterator::end (); ++jt)
-	v.push_back (dwarf_dieoffset (*jt));
-
-      // Populate the cache for this Dwarf.
-      it = m_cache.insert (std::make_pair (dw, std::move (v))).first;
-    }
-
+  off_vect const &roots = populate (dwarf_cu_getdwarf (die.cu));
   Dwarf_Off dieoff = dwarf_dieoffset (&die);
-  auto jt = std::lower_bound (it->second.begin (), it->second.end (), dieoff);
-  return jt != it->second.end () && *jt == dieoff;
+  auto jt = std::lower_bound (roots.begin (), roots.end (), dieoff);
+  return jt != roots.end () && *jt == dieoff;
 }
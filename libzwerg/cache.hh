@@ -29,37 +29,131 @@
 #ifndef _CACHE_H_
 #define _CACHE_H_
 
+#include <atomic>
 #include <map>
 #include <unordered_set>
 #include <memory>
+#include <mutex>
 #include <vector>
+#include <cstdint>
 
 #include <elfutils/libdw.h>
 
-class parent_cache
+// Lazily built per-Dwarf data, safe for concurrent use.  The T for a
+// given Dwarf is built by the first thread that asks for it, other
+// threads asking for the same Dwarf wait for it, and after that it is
+// only ever read.  Building T's of different Dwarf's doesn't
+// serialize, and asking again for the same Dwarf as the last time
+// takes no lock at all.
+template <class T>
+class per_dwarf
 {
-  using unit_cache_t = std::vector <std::pair <Dwarf_Off, Dwarf_Off>>;
-  using cache_t = std::map <std::pair <Dwarf *, Dwarf_Off>, unit_cache_t>;
+  struct entry
+  {
+    Dwarf *m_dw;
+    std::mutex m_mutex;
+    std::unique_ptr <T> m_value;
+    std::atomic <T const *> m_ready;
+
+    explicit entry (Dwarf *dw)
+      : m_dw {dw}
+      , m_ready {nullptr}
+    {}
+  };
+
+  std::mutex m_mutex;
+  std::map <Dwarf *, std::unique_ptr <entry>> m_entries;
+  std::atomic <entry *> m_last;
+
+  entry &
+  find_entry (Dwarf *dw)
+  {
+    entry *e = m_last.load (std::memory_order_acquire);
+    if (e != nullptr && e->m_dw == dw)
+      return *e;
+
+    std::lock_guard <std::mutex> lock {m_mutex};
+    auto &ptr = m_entries[dw];
+    if (ptr == nullptr)
+      ptr.reset (new entry {dw});
+    m_last.store (ptr.get (), std::memory_order_release);
+    return *ptr;
+  }
 
-  cache_t m_cache;
+public:
+  per_dwarf ()
+    : m_last {nullptr}
+  {}
+
+  // Return the T of DW, calling BUILD (DW) to build it if necessary.
+  // BUILD shall return std::unique_ptr <T>.
+  template <class F>
+  T const &
+  get (Dwarf *dw, F build)
+  {
+    entry &e = find_entry (dw);
+    if (T const *ret = e.m_ready.load (std::memory_order_acquire))
+      return *ret;
+
+    std::lock_guard <std::mutex> lock {e.m_mutex};
+    if (e.m_value == nullptr)
+      {
+	e.m_value = build (dw);
+	e.m_ready.store (e.m_value.get (), std::memory_order_release);
+      }
+    return *e.m_value;
+  }
+
+  // Return the T of DW if it has been built already, or nullptr.
+  T const *
+  find (Dwarf *dw)
+  {
+    return find_entry (dw).m_ready.load (std::memory_order_acquire);
+  }
+};
 
-  void recursively_populate_unit (unit_cache_t &uc, Dwarf_Die die,
-				  Dwarf_Off paroff);
-  unit_cache_t populate_unit (Dwarf_Die die);
+class parent_cache
+{
+  // Parent table of all DIE's of one Dwarf.  M_OFFS holds offsets of
+  // the DIE's in sorted order, M_PARENTS (or M_PARENTS64 for Dwarfs
+  // with more than 4G DIE's) the index of each DIE's parent in
+  // M_OFFS, or no_index for root DIE's.  M_BUCKETS maps an offset,
+  // shifted right by bucket_shift, to the index of the first DIE at
+  // or past the start of that bucket, which makes lookups O(1).
+  struct dwarf_table
+  {
+    static unsigned const bucket_shift = 6;
+    static uint32_t const no_index = (uint32_t) -1;
+
+    std::vector <Dwarf_Off> m_offs;
+    std::vector <uint32_t> m_parents;
+    std::vector <uint64_t> m_parents64;
+    std::vector <uint32_t> m_buckets;
+
+    // Build the table, walking units in up to NTHREADS threads.
+    dwarf_table (Dwarf *dw, unsigned nthreads);
+    Dwarf_Off find (Dwarf_Off off) const;
+  };
+
+  per_dwarf <dwarf_table> m_tables;
 
 public:
   static Dwarf_Off const no_off = (Dwarf_Off) -1;
   Dwarf_Off find (Dwarf_Die die);
+
+  // Build the table for DW now, rather than on first lookup, using up
+  // to NTHREADS threads.
+  void prebuild (Dwarf *dw, unsigned nthreads);
 };
 
 class root_cache
 {
   using off_vect = std::vector <Dwarf_Off>;
-  using cache_t = std::map <Dwarf *, off_vect>;
 
-  cache_t m_cache;
+  per_dwarf <off_vect> m_roots;
 
 public:
+  off_vect const &populate (Dwarf *dw);
   bool is_root (Dwarf_Die die);
 };
 
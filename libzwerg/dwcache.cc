@@ -0,0 +1,631 @@
+/*
+   Copyright (C) 2014 Red Hat, Inc.
+   This file is part of dwgrep.
+
+   This file is free software; you can redistribute it and/or modify
+   it under the terms of either
+
+     * the GNU Lesser General Public License as published by the Free
+       Software Foundation; either version 3 of the License, or (at
+       your option) any later version
+
+   or
+
+     * the GNU General Public License as published by the Free
+       Software Foundation; either version 2 of the License, or (at
+       your option) any later version
+
+   or both in parallel, as here.
+
+   dwgrep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received copies of the GNU General Public License and
+   the GNU Lesser General Public License along with this program.  If
+   not, see <http://www.gnu.org/licenses/>.  */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <tuple>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "std-memory.hh"
+#include "dwcache.hh"
+#include "cache.hh"
+#include "dwit.hh"
+#include "dwpp.hh"
+
+namespace
+{
+  // The image starts with a header of hdr_count words.  The magic
+  // doubles as a byte-order mark, files written on a host of the
+  // other endianness are simply rejected and rebuilt.
+  uint64_t const index_magic = 0x3178646972677764ULL;	// "dwgridx1"
+  uint64_t const index_version = 3;
+
+  enum
+    {
+      hdr_magic,
+      hdr_version,
+      hdr_ndies,	// Parent table, (offset, parent offset) pairs.
+      hdr_nroots,	// CU DIE offsets.
+      hdr_ntags,	// (tag, postings start, count) triples.
+      hdr_nnames,	// (strtab offset, length, postings start, count).
+      hdr_nlinkage,	// Likewise, for linkage names.
+      hdr_nsegments,	// (address, postings start, count) triples.
+      hdr_npostings,	// DIE offsets referenced from the above tables.
+      hdr_strtab,	// Size of string table in bytes.
+      hdr_count
+    };
+
+  size_t
+  words_for (size_t bytes)
+  {
+    return (bytes + sizeof (uint64_t) - 1) / sizeof (uint64_t);
+  }
+
+  int
+  compare_name (char const *a, size_t alen, char const *b, size_t blen)
+  {
+    if (int c = memcmp (a, b, std::min (alen, blen)))
+      return c;
+    return alen < blen ? -1 : alen > blen ? 1 : 0;
+  }
+
+  using name_map = std::unordered_map <std::string, std::vector <Dwarf_Off>>;
+
+  // Append to IMG name table entries for NAMES, sorted by name.
+  // Append the names themselves to STRTAB, and the offset lists to
+  // POSTINGS.
+  void
+  emit_names (name_map const &names, std::vector <uint64_t> &img,
+	      std::string &strtab, std::vector <uint64_t> &postings)
+  {
+    std::vector <name_map::const_iterator> sorted;
+    for (auto it = names.begin (); it != names.end (); ++it)
+      sorted.push_back (it);
+    std::sort (sorted.begin (), sorted.end (),
+	       [] (name_map::const_iterator a, name_map::const_iterator b)
+	       {
+		 return a->first < b->first;
+	       });
+
+    for (auto it: sorted)
+      {
+	img.push_back (strtab.size ());
+	img.push_back (it->first.size ());
+	img.push_back (postings.size ());
+	img.push_back (it->second.size ());
+	strtab += it->first;
+	postings.insert (postings.end (),
+			 it->second.begin (), it->second.end ());
+      }
+  }
+
+  bool
+  valid_names (uint64_t const *names, uint64_t n,
+	       uint64_t strtab_size, uint64_t npostings)
+  {
+    for (uint64_t i = 0; i < n; ++i)
+      if (names[4 * i] + names[4 * i + 1] > strtab_size
+	  || names[4 * i + 2] + names[4 * i + 3] > npostings)
+	return false;
+    return true;
+  }
+
+  die_index::off_range
+  find_name (uint64_t const *names, uint64_t n, char const *strtab,
+	     uint64_t const *postings, char const *name)
+  {
+    size_t len = strlen (name);
+    uint64_t lo = 0, hi = n;
+    while (lo < hi)
+      {
+	uint64_t mid = lo + (hi - lo) / 2;
+	if (compare_name (strtab + names[4 * mid],
+			  names[4 * mid + 1], name, len) < 0)
+	  lo = mid + 1;
+	else
+	  hi = mid;
+      }
+
+    if (lo == n
+	|| compare_name (strtab + names[4 * lo],
+			 names[4 * lo + 1], name, len) != 0)
+      return die_index::off_range {nullptr, nullptr};
+
+    uint64_t const *b = postings + names[4 * lo + 2];
+    return die_index::off_range {b, b + names[4 * lo + 3]};
+  }
+
+  struct addr_range
+  {
+    Dwarf_Addr m_low;
+    Dwarf_Addr m_high;
+    Dwarf_Off m_off;
+  };
+
+  // Append to RANGES address ranges that `address` would report for
+  // DIE.  DIE's whose ranges can't be read are left out, just as are
+  // empty ranges, which don't contain any address.
+  void
+  collect_ranges (Dwarf_Die &die, std::vector <addr_range> &ranges)
+  {
+    if (! dwarf_hasattr (&die, DW_AT_low_pc)
+	&& ! dwarf_hasattr (&die, DW_AT_ranges))
+      return;
+
+    Dwarf_Addr base, start, end;
+    for (ptrdiff_t off = 0;
+	 (off = dwarf_ranges (&die, off, &base, &start, &end)) > 0; )
+      if (end > start)
+	ranges.push_back ({start, end, dwarf_dieoffset (&die)});
+  }
+
+  // Cut the address space at each range boundary.  For each of the
+  // resulting segments, append to SEGMENTS its start address and the
+  // list of offsets of DIE's that cover it, which goes to POSTINGS.
+  // Adjacent segments with the same list are merged.  Every address
+  // in a segment is thus covered by the same DIE's, and looking up an
+  // address is a binary search.
+  void
+  emit_segments (std::vector <addr_range> const &ranges,
+		 std::vector <uint64_t> &segments,
+		 std::vector <uint64_t> &postings)
+  {
+    // (address, DIE offset, +1 for range start or -1 for end).
+    std::vector <std::tuple <Dwarf_Addr, Dwarf_Off, int>> events;
+    events.reserve (2 * ranges.size ());
+    for (auto const &r: ranges)
+      {
+	events.push_back (std::make_tuple (r.m_low, r.m_off, 1));
+	events.push_back (std::make_tuple (r.m_high, r.m_off, -1));
+      }
+    std::sort (events.begin (), events.end ());
+
+    // A DIE's own ranges may overlap, so count them.
+    std::map <Dwarf_Off, size_t> active;
+    std::vector <Dwarf_Off> last, cur;
+    for (auto it = events.begin (); it != events.end (); )
+      {
+	Dwarf_Addr addr = std::get <0> (*it);
+	for (; it != events.end () && std::get <0> (*it) == addr; ++it)
+	  if (std::get <2> (*it) > 0)
+	    ++active[std::get <1> (*it)];
+	  else if (--active[std::get <1> (*it)] == 0)
+	    active.erase (std::get <1> (*it));
+
+	cur.clear ();
+	for (auto const &a: active)
+	  cur.push_back (a.first);
+	if (! segments.empty () && cur == last)
+	  continue;
+
+	segments.push_back (addr);
+	segments.push_back (postings.size ());
+	segments.push_back (cur.size ());
+	postings.insert (postings.end (), cur.begin (), cur.end ());
+	last.swap (cur);
+      }
+  }
+
+  char const *
+  linkage_name (Dwarf_Die &die)
+  {
+    Dwarf_Attribute attr;
+    for (int at: {DW_AT_linkage_name, DW_AT_MIPS_linkage_name})
+      if (dwarf_attr_integrate (&die, at, &attr) != nullptr)
+	if (char const *name = dwarf_formstring (&attr))
+	  return name;
+    return nullptr;
+  }
+}
+
+struct die_index::pimpl
+{
+  std::vector <uint64_t> m_owned;
+  void *m_map;
+  size_t m_maplen;
+
+  uint64_t const *m_image;
+  size_t m_nwords;
+
+  uint64_t m_ndies;
+  uint64_t m_nroots;
+  uint64_t m_ntags;
+  uint64_t m_nnames;
+  uint64_t m_nlinkage;
+  uint64_t m_nsegments;
+  uint64_t m_npostings;
+  uint64_t m_strtab_size;
+
+  uint64_t const *m_parents;
+  uint64_t const *m_roots;
+  uint64_t const *m_tags;
+  uint64_t const *m_names;
+  uint64_t const *m_linkage;
+  uint64_t const *m_segments;
+  uint64_t const *m_postings;
+  char const *m_strtab;
+
+  pimpl ()
+    : m_map {nullptr}
+    , m_maplen {0}
+    , m_image {nullptr}
+    , m_nwords {0}
+  {}
+
+  ~pimpl ()
+  {
+    if (m_map != nullptr)
+      munmap (m_map, m_maplen);
+  }
+
+  // Set up section pointers and validate that everything the index
+  // refers to is within the image.
+  bool
+  layout ()
+  {
+    if (m_nwords < hdr_count
+	|| m_image[hdr_magic] != index_magic
+	|| m_image[hdr_version] != index_version)
+      return false;
+
+    m_ndies = m_image[hdr_ndies];
+    m_nroots = m_image[hdr_nroots];
+    m_ntags = m_image[hdr_ntags];
+    m_nnames = m_image[hdr_nnames];
+    m_nlinkage = m_image[hdr_nlinkage];
+    m_nsegments = m_image[hdr_nsegments];
+    m_npostings = m_image[hdr_npostings];
+    m_strtab_size = m_image[hdr_strtab];
+
+    // Guard against overflow in the size computation below.
+    for (uint64_t n: {m_ndies, m_nroots, m_ntags, m_nnames,
+		      m_nlinkage, m_nsegments, m_npostings, m_strtab_size})
+      if (n > m_nwords * sizeof (uint64_t))
+	return false;
+
+    uint64_t const *p = m_image + hdr_count;
+    m_parents = p;	p += 2 * m_ndies;
+    m_roots = p;	p += m_nroots;
+    m_tags = p;		p += 3 * m_ntags;
+    m_names = p;	p += 4 * m_nnames;
+    m_linkage = p;	p += 4 * m_nlinkage;
+    m_segments = p;	p += 3 * m_nsegments;
+    m_postings = p;	p += m_npostings;
+    m_strtab = reinterpret_cast <char const *> (p);
+    p += words_for (m_strtab_size);
+
+    if ((size_t) (p - m_image) != m_nwords)
+      return false;
+
+    for (uint64_t i = 0; i < m_ntags; ++i)
+      if (m_tags[3 * i + 1] + m_tags[3 * i + 2] > m_npostings)
+	return false;
+
+    for (uint64_t i = 0; i < m_nsegments; ++i)
+      if (m_segments[3 * i + 1] + m_segments[3 * i + 2] > m_npostings)
+	return false;
+
+    return valid_names (m_names, m_nnames, m_strtab_size, m_npostings)
+      && valid_names (m_linkage, m_nlinkage, m_strtab_size, m_npostings);
+  }
+};
+
+die_index::die_index (std::unique_ptr <pimpl> p)
+  : m_pimpl {std::move (p)}
+{}
+
+die_index::~die_index ()
+{}
+
+std::unique_ptr <die_index>
+die_index::build (Dwarf *dw)
+{
+  std::vector <std::pair <Dwarf_Off, Dwarf_Off>> parents;
+  std::vector <Dwarf_Off> roots;
+  std::map <int, std::vector <Dwarf_Off>> tags;
+  name_map names;
+  name_map linkage_names;
+  std::vector <addr_range> ranges;
+
+  // Walk the DIE tree of each unit in pre-order.  This is done
+  // iteratively, deeply nested DIE trees are not unheard of.
+  std::vector <Dwarf_Die> ancestors;
+  for (auto it = cu_iterator {dw}; it != cu_iterator::end (); ++it)
+    {
+      Dwarf_Die die = **it;
+      roots.push_back (dwarf_dieoffset (&die));
+
+      while (true)
+	{
+	  Dwarf_Off off = dwarf_dieoffset (&die);
+	  Dwarf_Off paroff = ancestors.empty () ? parent_cache::no_off
+	    : dwarf_dieoffset (&ancestors.back ());
+	  parents.push_back (std::make_pair (off, paroff));
+	  tags[dwarf_tag (&die)].push_back (off);
+	  if (char const *name = dwarf_diename (&die))
+	    names[name].push_back (off);
+	  if (char const *name = linkage_name (die))
+	    linkage_names[name].push_back (off);
+	  collect_ranges (die, ranges);
+
+	  Dwarf_Die child;
+	  if (dwpp_child (die, child))
+	    {
+	      ancestors.push_back (die);
+	      die = child;
+	      continue;
+	    }
+
+	  while (! ancestors.empty () && ! dwpp_siblingof (die, die))
+	    {
+	      die = ancestors.back ();
+	      ancestors.pop_back ();
+	    }
+
+	  if (ancestors.empty ())
+	    break;
+	}
+    }
+
+  // Pre-order walk over units in file order yields sorted offsets,
+  // but don't rely on that.
+  if (! std::is_sorted (parents.begin (), parents.end ()))
+    std::sort (parents.begin (), parents.end ());
+  if (! std::is_sorted (roots.begin (), roots.end ()))
+    std::sort (roots.begin (), roots.end ());
+
+  std::vector <uint64_t> segments;
+  std::vector <uint64_t> seg_postings;
+  emit_segments (ranges, segments, seg_postings);
+
+  size_t npostings = seg_postings.size ();
+  size_t strtab_size = 0;
+  for (auto const &entry: tags)
+    npostings += entry.second.size ();
+  for (name_map const *m: {&names, &linkage_names})
+    for (auto const &entry: *m)
+      {
+	npostings += entry.second.size ();
+	strtab_size += entry.first.size ();
+      }
+
+  auto p = std::make_unique <pimpl> ();
+  std::vector <uint64_t> &img = p->m_owned;
+  img.reserve (hdr_count + 2 * parents.size () + roots.size ()
+	       + 3 * tags.size () + 4 * (names.size () + linkage_names.size ())
+	       + segments.size () + npostings + words_for (strtab_size));
+
+  img.resize (hdr_count);
+  img[hdr_magic] = index_magic;
+  img[hdr_version] = index_version;
+  img[hdr_ndies] = parents.size ();
+  img[hdr_nroots] = roots.size ();
+  img[hdr_ntags] = tags.size ();
+  img[hdr_nnames] = names.size ();
+  img[hdr_nlinkage] = linkage_names.size ();
+  img[hdr_nsegments] = segments.size () / 3;
+  img[hdr_npostings] = npostings;
+  img[hdr_strtab] = strtab_size;
+
+  for (auto const &entry: parents)
+    {
+      img.push_back (entry.first);
+      img.push_back (entry.second);
+    }
+
+  img.insert (img.end (), roots.begin (), roots.end ());
+
+  std::vector <uint64_t> postings;
+  postings.reserve (npostings);
+  for (auto const &entry: tags)
+    {
+      img.push_back (entry.first);
+      img.push_back (postings.size ());
+      img.push_back (entry.second.size ());
+      postings.insert (postings.end (),
+		       entry.second.begin (), entry.second.end ());
+    }
+
+  std::string strtab;
+  strtab.reserve (strtab_size);
+  emit_names (names, img, strtab, postings);
+  emit_names (linkage_names, img, strtab, postings);
+
+  for (size_t i = 0; i < segments.size (); i += 3)
+    {
+      img.push_back (segments[i]);
+      img.push_back (segments[i + 1] + postings.size ());
+      img.push_back (segments[i + 2]);
+    }
+  postings.insert (postings.end (), seg_postings.begin (), seg_postings.end ());
+
+  img.insert (img.end (), postings.begin (), postings.end ());
+
+  size_t strtab_pos = img.size ();
+  img.resize (strtab_pos + words_for (strtab_size));
+  if (strtab_size > 0)
+    memcpy (&img[strtab_pos], strtab.data (), strtab_size);
+
+  p->m_image = img.data ();
+  p->m_nwords = img.size ();
+  bool ok = p->layout ();
+  assert (ok);
+  (void) ok;
+
+  return std::unique_ptr <die_index> (new die_index (std::move (p)));
+}
+
+std::unique_ptr <die_index>
+die_index::load (std::string const &fn)
+{
+  int fd = open (fn.c_str (), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return nullptr;
+
+  struct stat st;
+  if (fstat (fd, &st) != 0
+      || st.st_size < (off_t) (hdr_count * sizeof (uint64_t))
+      || st.st_size % sizeof (uint64_t) != 0)
+    {
+      close (fd);
+      return nullptr;
+    }
+
+  void *map = mmap (nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (map == MAP_FAILED)
+    return nullptr;
+
+  auto p = std::make_unique <pimpl> ();
+  p->m_map = map;
+  p->m_maplen = st.st_size;
+  p->m_image = static_cast <uint64_t const *> (map);
+  p->m_nwords = st.st_size / sizeof (uint64_t);
+  if (! p->layout ())
+    return nullptr;
+
+  return std::unique_ptr <die_index> (new die_index (std::move (p)));
+}
+
+bool
+die_index::save (std::string const &fn) const
+{
+  std::string tmp = fn + ".XXXXXX";
+  int fd = mkstemp (&tmp[0]);
+  if (fd < 0)
+    return false;
+
+  char const *buf = reinterpret_cast <char const *> (m_pimpl->m_image);
+  size_t len = m_pimpl->m_nwords * sizeof (uint64_t);
+  while (len > 0)
+    {
+      ssize_t w = write (fd, buf, len);
+      if (w < 0 && errno == EINTR)
+	continue;
+      if (w <= 0)
+	break;
+      buf += w;
+      len -= w;
+    }
+
+  if (close (fd) != 0 || len > 0
+      || rename (tmp.c_str (), fn.c_str ()) != 0)
+    {
+      unlink (tmp.c_str ());
+      return false;
+    }
+
+  return true;
+}
+
+uint64_t
+die_index::position (Dwarf_Off off) const
+{
+  uint64_t const *parents = m_pimpl->m_parents;
+  uint64_t lo = 0, hi = m_pimpl->m_ndies;
+  while (lo < hi)
+    {
+      uint64_t mid = lo + (hi - lo) / 2;
+      if (parents[2 * mid] < off)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+
+  if (lo == m_pimpl->m_ndies || parents[2 * lo] != off)
+    return no_position;
+  return lo;
+}
+
+bool
+die_index::find_parent (Dwarf_Off off, Dwarf_Off &paroff) const
+{
+  uint64_t pos = position (off);
+  if (pos == no_position)
+    return false;
+
+  paroff = m_pimpl->m_parents[2 * pos + 1];
+  return true;
+}
+
+bool
+die_index::is_root (Dwarf_Off off) const
+{
+  off_range r = roots ();
+  return std::binary_search (r.begin (), r.end (), off);
+}
+
+die_index::off_range
+die_index::roots () const
+{
+  return off_range {m_pimpl->m_roots, m_pimpl->m_roots + m_pimpl->m_nroots};
+}
+
+die_index::off_range
+die_index::tag_offsets (int tag) const
+{
+  uint64_t const *tags = m_pimpl->m_tags;
+  uint64_t lo = 0, hi = m_pimpl->m_ntags;
+  while (lo < hi)
+    {
+      uint64_t mid = lo + (hi - lo) / 2;
+      if (tags[3 * mid] < (uint64_t) tag)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+
+  if (lo == m_pimpl->m_ntags || tags[3 * lo] != (uint64_t) tag)
+    return off_range {nullptr, nullptr};
+
+  uint64_t const *b = m_pimpl->m_postings + tags[3 * lo + 1];
+  return off_range {b, b + tags[3 * lo + 2]};
+}
+
+die_index::off_range
+die_index::name_offsets (char const *name) const
+{
+  return find_name (m_pimpl->m_names, m_pimpl->m_nnames, m_pimpl->m_strtab,
+		    m_pimpl->m_postings, name);
+}
+
+die_index::off_range
+die_index::linkage_name_offsets (char const *name) const
+{
+  return find_name (m_pimpl->m_linkage, m_pimpl->m_nlinkage,
+		    m_pimpl->m_strtab, m_pimpl->m_postings, name);
+}
+
+die_index::off_range
+die_index::address_offsets (Dwarf_Addr addr) const
+{
+  // Find the last segment that starts at or before ADDR.
+  uint64_t const *segments = m_pimpl->m_segments;
+  uint64_t lo = 0, hi = m_pimpl->m_nsegments;
+  while (lo < hi)
+    {
+      uint64_t mid = lo + (hi - lo) / 2;
+      if (segments[3 * mid] <= addr)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+
+  if (lo == 0)
+    return off_range {nullptr, nullptr};
+
+  uint64_t const *b = m_pimpl->m_postings + segments[3 * (lo - 1) + 1];
+  return off_range {b, b + segments[3 * (lo - 1) + 2]};
+}
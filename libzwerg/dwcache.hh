@@ -0,0 +1,112 @@
+/*
+   Copyright (C) 2014 Red Hat, Inc.
+   This file is part of dwgrep.
+
+   This file is free software; you can redistribute it and/or modify
+   it under the terms of either
+
+     * the GNU Lesser General Public License as published by the Free
+       Software Foundation; either version 3 of the License, or (at
+       your option) any later version
+
+   or
+
+     * the GNU General Public License as published by the Free
+       Software Foundation; either version 2 of the License, or (at
+       your option) any later version
+
+   or both in parallel, as here.
+
+   dwgrep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received copies of the GNU General Public License and
+   the GNU Lesser General Public License along with this program.  If
+   not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef _DWCACHE_H_
+#define _DWCACHE_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <elfutils/libdw.h>
+
+// A whole-Dwarf index of DIE offsets.  It holds the parent table
+// (offset of each DIE together with the offset of its parent), the
+// offsets of CU DIE's, lists of DIE offsets bucketed by tag, by
+// DW_AT_name and by linkage name, and an address table that maps
+// addresses to DIE's that cover them.  Names are looked up the way
+// cooked DIE's see them, i.e. with DW_AT_abstract_origin and
+// DW_AT_specification integrated.
+//
+// The index is kept as a single flat image of 64-bit words, so that
+// it can be written to disk as is, and later mmap'd back without any
+// deserialization.  See dwfl_context for where the image files live.
+class die_index
+{
+  class pimpl;
+  std::unique_ptr <pimpl> m_pimpl;
+
+  explicit die_index (std::unique_ptr <pimpl> p);
+
+public:
+  ~die_index ();
+
+  // A sorted range of DIE offsets.
+  class off_range
+  {
+    uint64_t const *m_begin;
+    uint64_t const *m_end;
+
+  public:
+    off_range (uint64_t const *b, uint64_t const *e)
+      : m_begin {b}
+      , m_end {e}
+    {}
+
+    uint64_t const *begin () const { return m_begin; }
+    uint64_t const *end () const { return m_end; }
+    size_t size () const { return m_end - m_begin; }
+    bool empty () const { return m_begin == m_end; }
+  };
+
+  // Walk all units of DW and build the index in memory.
+  static std::unique_ptr <die_index> build (Dwarf *dw);
+
+  // Map in an index file previously written by save.  Returns nullptr
+  // if the file doesn't exist or isn't a valid index.
+  static std::unique_ptr <die_index> load (std::string const &fn);
+
+  // Atomically write the index to FN.  Returns false on failure, in
+  // which case no file is left behind.
+  bool save (std::string const &fn) const;
+
+  // Look up parent offset of the DIE at OFF.  Returns false if OFF is
+  // not a DIE known to the index.  Root DIE's have parent
+  // parent_cache::no_off.
+  bool find_parent (Dwarf_Off off, Dwarf_Off &paroff) const;
+
+  // Return the position of DIE at OFF in the pre-order of all DIE's
+  // of this Dwarf, or no_position if OFF is not a DIE known to the
+  // index.  Subtracting position of the CU DIE gives position of the
+  // DIE within its unit.
+  static uint64_t const no_position = (uint64_t) -1;
+  uint64_t position (Dwarf_Off off) const;
+  bool is_root (Dwarf_Off off) const;
+
+  off_range roots () const;
+  off_range tag_offsets (int tag) const;
+  off_range name_offsets (char const *name) const;
+  off_range linkage_name_offsets (char const *name) const;
+
+  // Offsets of DIE's whose address ranges (as `address` reports them)
+  // cover ADDR.
+  off_range address_offsets (Dwarf_Addr addr) const;
+};
+
+#endif /* _DWCACHE_H_ */
@@ -26,30 +26,294 @@
    the GNU Lesser General Public License along with this program.  If
    not, see <http://www.gnu.org/licenses/>.  */
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <list>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <iomanip>
+#include <cstdlib>
+#include <tuple>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <elfutils/libdwelf.h>
+
 #include "std-memory.hh"
 #include "dwfl_context.hh"
+#include "dwcache.hh"
 #include "cache.hh"
+#include "dwit.hh"
+
+namespace
+{
+  // Directory where DIE indices are persisted, or an empty string if
+  // they are not, and how many bytes of them may be kept there.  See
+  // set_die_index_cache_limit.
+  std::mutex index_cache_mutex;
+  std::string index_cache_dir;
+  uint64_t index_cache_limit = 0;
+
+  // Return directory where DIE indices should be stored, creating it
+  // if necessary, or an empty string if there's no usable one.
+  std::string
+  make_index_cache_dir ()
+  {
+    std::string base;
+    if (char const *xdg = getenv ("XDG_CACHE_HOME"))
+      if (xdg[0] == '/')
+	base = xdg;
+
+    if (base.empty ())
+      {
+	char const *home = getenv ("HOME");
+	if (home == nullptr || home[0] != '/')
+	  return "";
+	base = std::string (home) + "/.cache";
+      }
+
+    std::string dir = base + "/dwgrep";
+    for (auto const &d: {base, dir})
+      if (mkdir (d.c_str (), 0700) != 0 && errno != EEXIST)
+	return "";
+
+    return dir;
+  }
+
+  std::string
+  get_index_cache_dir ()
+  {
+    std::lock_guard <std::mutex> lock {index_cache_mutex};
+    return index_cache_dir;
+  }
+
+  // Remove index files, least recently used first, until those that
+  // remain take at most INDEX_CACHE_LIMIT bytes.  Index files are
+  // touched whenever they are loaded, so their modification time
+  // tells when they were last used.  Called with INDEX_CACHE_MUTEX
+  // held.
+  void
+  trim_index_cache ()
+  {
+    DIR *d = opendir (index_cache_dir.c_str ());
+    if (d == nullptr)
+      return;
+
+    std::vector <std::tuple <time_t, long, uint64_t, std::string>> files;
+    uint64_t total = 0;
+    while (dirent *ent = readdir (d))
+      {
+	size_t len = strlen (ent->d_name);
+	if (len < 4 || strcmp (ent->d_name + len - 4, ".idx") != 0)
+	  continue;
+
+	std::string fn = index_cache_dir + '/' + ent->d_name;
+	struct stat st;
+	if (stat (fn.c_str (), &st) != 0)
+	  continue;
+
+	files.emplace_back (st.st_mtim.tv_sec, st.st_mtim.tv_nsec,
+			    st.st_size, fn);
+	total += st.st_size;
+      }
+    closedir (d);
+
+    std::sort (files.begin (), files.end ());
+    for (auto const &f: files)
+      {
+	if (total <= index_cache_limit)
+	  break;
+	// Another process may have removed the file meanwhile, that's
+	// fine as well.
+	unlink (std::get <3> (f).c_str ());
+	total -= std::get <2> (f);
+      }
+  }
+}
 
 struct dwfl_context::pimpl
 {
+  // Queries over one context may be run from several threads (see
+  // op_parallel and zw_query_execute), so all of the below is safe
+  // for concurrent use.  The caches are populated lazily.
   parent_cache m_parcache;
   root_cache m_rootcache;
 
+  // Whole-Dwarf indices loaded from disk.  A null index means there
+  // is no persistent index for that Dwarf.
+  per_dwarf <std::unique_ptr <die_index>> m_indices;
+
+  // Indices built on demand for Dwarf's that have no persistent one.
+  // When indices are persisted, these are written to disk as well.
+  per_dwarf <die_index> m_built_indices;
+
+  // Dwarf's of the Dwfl.  Libdwfl opens them lazily, which is not
+  // safe to do concurrently, so it's done once, under M_DWARFS_MUTEX.
+  std::mutex m_dwarfs_mutex;
+  std::vector <Dwarf *> m_dwarfs;
+  std::atomic <bool> m_have_dwarfs;
+
+  bool m_have_stat;
+  struct stat m_stat;
+
+  explicit pimpl (std::string const &fn)
+    : m_have_dwarfs {false}
+    , m_have_stat {! fn.empty () && stat (fn.c_str (), &m_stat) == 0}
+  {}
+
+  std::string
+  index_file_name (Dwarf *dw)
+  {
+    if (! m_have_stat)
+      return "";
+
+    std::string dir = get_index_cache_dir ();
+    if (dir.empty ())
+      return "";
+
+    Elf *elf = dwarf_getelf (dw);
+    void const *build_id;
+    ssize_t len;
+    if (elf == nullptr
+	|| (len = dwelf_elf_gnu_build_id (elf, &build_id)) <= 0)
+      return "";
+
+    std::ostringstream ss;
+    ss << dir << '/' << std::hex << std::setfill ('0');
+    for (ssize_t i = 0; i < len; ++i)
+      ss << std::setw (2)
+	 << (unsigned) static_cast <unsigned char const *> (build_id)[i];
+    // Build ID's are not necessarily unique (think stripped copies
+    // or hand-crafted test files), so throw in the identity of FN as
+    // well.
+    ss << std::dec << '-' << m_stat.st_dev << '.' << m_stat.st_ino
+       << '-' << m_stat.st_size << '-' << m_stat.st_mtim.tv_sec
+       << '.' << std::setw (9) << m_stat.st_mtim.tv_nsec << ".idx";
+    return ss.str ();
+  }
+
+  // Return the persistent index for DW, or nullptr if there is none.
+  die_index const *
+  load_index (Dwarf *dw)
+  {
+    return m_indices.get (dw, [this] (Dwarf *dw)
+			  {
+			    std::unique_ptr <die_index> idx;
+			    std::string fn = index_file_name (dw);
+			    if (! fn.empty ())
+			      {
+				idx = die_index::load (fn);
+				// Mark the file as recently used, see
+				// trim_index_cache.
+				if (idx != nullptr)
+				  utimensat (AT_FDCWD, fn.c_str (), nullptr, 0);
+			      }
+			    return std::make_unique
+			      <std::unique_ptr <die_index>> (std::move (idx));
+			  }).get ();
+  }
+
+  // Return the index for DW if there is one at hand, or nullptr.  This
+  // is for lookups of single DIE's, which are not worth building the
+  // whole index for.
+  die_index const *
+  find_index (Dwarf *dw)
+  {
+    if (auto idx = load_index (dw))
+      return idx;
+    return m_built_indices.find (dw);
+  }
+
+  std::unique_ptr <die_index>
+  build_index (Dwarf *dw)
+  {
+    auto idx = die_index::build (dw);
+    std::string fn = index_file_name (dw);
+    // Failing to write the index is not an error, we just won't have
+    // it next time around.
+    if (! fn.empty () && idx->save (fn))
+      {
+	std::lock_guard <std::mutex> lock {index_cache_mutex};
+	trim_index_cache ();
+      }
+    return idx;
+  }
+
+  die_index const &
+  get_die_index (Dwarf *dw)
+  {
+    if (auto idx = load_index (dw))
+      return *idx;
+
+    return m_built_indices.get (dw, [this] (Dwarf *dw)
+				{
+				  return build_index (dw);
+				});
+  }
+
+  std::vector <Dwarf *> const &
+  get_dwarfs (Dwfl *dwfl)
+  {
+    if (! m_have_dwarfs.load (std::memory_order_acquire))
+      {
+	std::lock_guard <std::mutex> lock {m_dwarfs_mutex};
+	if (! m_have_dwarfs.load (std::memory_order_relaxed))
+	  {
+	    std::for_each (dwfl_module_iterator {dwfl},
+			   dwfl_module_iterator::end (),
+			   [&] (std::pair <Dwarf *, Dwarf_Addr> p)
+			   {
+			     m_dwarfs.push_back (p.first);
+			     if (Dwarf *alt = dwarf_getalt (p.first))
+			       m_dwarfs.push_back (alt);
+			   });
+	    m_have_dwarfs.store (true, std::memory_order_release);
+	  }
+      }
+    return m_dwarfs;
+  }
+
+  void
+  prebuild_caches (std::vector <Dwarf *> const &dwarfs, unsigned nthreads)
+  {
+    for (Dwarf *dw: dwarfs)
+      if (find_index (dw) == nullptr)
+	{
+	  m_parcache.prebuild (dw, nthreads);
+	  m_rootcache.populate (dw);
+	}
+  }
+
   Dwarf_Off
   find_parent (Dwarf_Die die)
   {
+    Dwarf_Off paroff;
+    if (auto idx = find_index (dwarf_cu_getdwarf (die.cu)))
+      if (idx->find_parent (dwarf_dieoffset (&die), paroff))
+	return paroff;
+
     return m_parcache.find (die);
   }
 
   bool
   is_root (Dwarf_Die die)
   {
+    if (auto idx = find_index (dwarf_cu_getdwarf (die.cu)))
+      return idx->is_root (dwarf_dieoffset (&die));
+
     return m_rootcache.is_root (die);
   }
 };
 
-dwfl_context::dwfl_context (std::shared_ptr <Dwfl> dwfl)
-  : m_pimpl {std::make_unique <pimpl> ()}
+dwfl_context::dwfl_context (std::shared_ptr <Dwfl> dwfl,
+			    std::string const &fn)
+  : m_pimpl {std::make_unique <pimpl> (fn)}
   , m_dwfl {dwfl}
 {}
 
@@ -67,3 +331,168 @@ dwfl_context::is_root (Dwarf_Die die)
 {
   return m_pimpl->is_root (die);
 }
+
+std::vector <Dwarf *> const &
+dwfl_context::get_dwarfs ()
+{
+  return m_pimpl->get_dwarfs (get_dwfl ());
+}
+
+void
+dwfl_context::prebuild_caches (unsigned nthreads)
+{
+  m_pimpl->prebuild_caches (get_dwarfs (), nthreads);
+}
+
+die_index const &
+dwfl_context::get_die_index (Dwarf *dw)
+{
+  return m_pimpl->get_die_index (dw);
+}
+
+void
+set_die_index_cache_limit (uint64_t max_bytes)
+{
+  std::string dir = max_bytes > 0 ? make_index_cache_dir () : "";
+
+  std::lock_guard <std::mutex> lock {index_cache_mutex};
+  index_cache_dir = dir;
+  index_cache_limit = max_bytes;
+  if (! dir.empty ())
+    trim_index_cache ();
+}
+
+namespace
+{
+  struct context_key
+  {
+    std::string m_fn;
+    dev_t m_dev;
+    ino_t m_ino;
+    time_t m_sec;
+    long m_nsec;
+
+    bool
+    operator< (context_key const &that) const
+    {
+      return std::tie (m_fn, m_dev, m_ino, m_sec, m_nsec)
+	< std::tie (that.m_fn, that.m_dev, that.m_ino,
+		    that.m_sec, that.m_nsec);
+    }
+  };
+
+  // The most recently used contexts are at the front of M_LRU.
+  struct context_cache
+  {
+    struct entry
+    {
+      context_key m_key;
+      std::shared_ptr <dwfl_context> m_dwctx;
+      uint64_t m_size;
+    };
+
+    std::mutex m_mutex;
+    std::list <entry> m_lru;
+    std::map <context_key, std::list <entry>::iterator> m_index;
+    uint64_t m_bytes;
+    size_t m_max_files;
+    uint64_t m_max_bytes;
+
+    context_cache ()
+      : m_bytes {0}
+      , m_max_files {0}
+      , m_max_bytes {0}
+    {}
+
+    // Called with M_MUTEX held.
+    void
+    trim ()
+    {
+      while (! m_lru.empty ()
+	     && (m_lru.size () > m_max_files || m_bytes > m_max_bytes))
+	{
+	  m_bytes -= m_lru.back ().m_size;
+	  m_index.erase (m_lru.back ().m_key);
+	  m_lru.pop_back ();
+	}
+    }
+  };
+
+  context_cache &
+  get_context_cache ()
+  {
+    static context_cache cache;
+    return cache;
+  }
+}
+
+std::shared_ptr <dwfl_context>
+cached_dwfl_context (std::string const &fn,
+		     std::function <std::shared_ptr <dwfl_context> ()> open)
+{
+  context_cache &cache = get_context_cache ();
+  struct stat st;
+  if (stat (fn.c_str (), &st) != 0)
+    return open ();
+
+  context_key key {fn, st.st_dev, st.st_ino,
+		   st.st_mtim.tv_sec, st.st_mtim.tv_nsec};
+  bool enabled;
+  {
+    std::lock_guard <std::mutex> lock {cache.m_mutex};
+    enabled = cache.m_max_files > 0;
+    auto it = cache.m_index.find (key);
+    if (it != cache.m_index.end ())
+      {
+	cache.m_lru.splice (cache.m_lru.begin (), cache.m_lru, it->second);
+	return it->second->m_dwctx;
+      }
+  }
+
+  if (! enabled)
+    return open ();
+
+  // Open the file without holding the lock, that can take a while.
+  // If another thread opens the same file meanwhile, the context that
+  // makes it to the cache first wins.
+  std::shared_ptr <dwfl_context> dwctx = open ();
+  uint64_t size = st.st_size;
+
+  std::lock_guard <std::mutex> lock {cache.m_mutex};
+  auto it = cache.m_index.find (key);
+  if (it != cache.m_index.end ())
+    {
+      cache.m_lru.splice (cache.m_lru.begin (), cache.m_lru, it->second);
+      return it->second->m_dwctx;
+    }
+
+  if (size <= cache.m_max_bytes)
+    {
+      cache.m_lru.push_front ({key, dwctx, size});
+      cache.m_index[key] = cache.m_lru.begin ();
+      cache.m_bytes += size;
+      cache.trim ();
+    }
+
+  return dwctx;
+}
+
+void
+set_dwfl_context_cache_limits (size_t max_files, uint64_t max_bytes)
+{
+  context_cache &cache = get_context_cache ();
+  std::lock_guard <std::mutex> lock {cache.m_mutex};
+  cache.m_max_files = max_files;
+  cache.m_max_bytes = max_bytes;
+  cache.trim ();
+}
+
+void
+clear_dwfl_context_cache ()
+{
+  context_cache &cache = get_context_cache ();
+  std::lock_guard <std::mutex> lock {cache.m_mutex};
+  cache.m_lru.clear ();
+  cache.m_index.clear ();
+  cache.m_bytes = 0;
+}
@@ -29,10 +29,32 @@
 #ifndef _DWFL_CONTEXT_H_
 #define _DWFL_CONTEXT_H_
 
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <string>
+#include <vector>
 #include <elfutils/libdwfl.h>
 
+class die_index;
+
 // This represents a Dwfl handle together with some query caches.
+//
+// When FN, the file that the Dwfl was opened from, is given, and
+// persisting is enabled (see set_die_index_cache_limit), DIE indices
+// of Dwarf's that carry a build ID are persisted under
+// $XDG_CACHE_HOME/dwgrep (~/.cache/dwgrep by default), keyed by the
+// build ID, identity and modification time of FN, and mmap'd back by
+// later contexts instead of being rebuilt.
+//
+// A context may be shared by queries running in several threads.
+// The caches are safe for concurrent use, and libdwfl is only
+// touched once, by the first get_dwarfs call.  Concurrent use of the
+// Dwarf's themselves is up to libdw: reading DIE's and attributes of
+// one Dwarf from several threads needs elfutils 0.178 or later, and
+// libdw's lazily populated per-unit data (line tables, location and
+// range lists, etc.) is only guarded in elfutils configured with
+// --enable-thread-safety.
 class dwfl_context
 {
   class pimpl;
@@ -40,14 +62,53 @@ class dwfl_context
   std::shared_ptr <Dwfl> m_dwfl;
 
 public:
-  explicit dwfl_context (std::shared_ptr <Dwfl> dwfl);
+  explicit dwfl_context (std::shared_ptr <Dwfl> dwfl,
+			 std::string const &fn = "");
   ~dwfl_context ();
 
   Dwfl *get_dwfl ()
   { return &*m_dwfl; }
 
+  // Return Dwarf's of all modules of the Dwfl, each followed by its
+  // alternate Dwarf if it has one.
+  std::vector <Dwarf *> const &get_dwarfs ();
+
   Dwarf_Off find_parent (Dwarf_Die die);
   bool is_root (Dwarf_Die die);
+
+  // Build the DIE parent and root caches of all Dwarf's of this
+  // context up front, instead of lazily on first lookup, using up to
+  // NTHREADS threads per Dwarf.  Dwarf's that have a persistent index
+  // use that instead.
+  void prebuild_caches (unsigned nthreads);
+
+  // Return the whole-Dwarf index of DW, loading or building it if
+  // necessary.  The index is owned by this context.
+  die_index const &get_die_index (Dwarf *dw);
 };
 
+// Persist DIE indices, keeping at most MAX_BYTES of them on disk and
+// evicting the least recently used ones beyond that.  The limit is
+// zero by default, which disables persisting.
+void set_die_index_cache_limit (uint64_t max_bytes);
+
+// Contexts opened from files can be shared through a process-wide LRU
+// cache, keyed by the file name and the identity and modification
+// time of the file.  The cache is bounded by the number of files and
+// by their total size.  Both limits are zero by default, which
+// disables the cache.  Evicting a context from the cache doesn't
+// affect values that still refer to it.
+
+// Return a context for file FN, either a cached one, or one made by
+// calling OPEN.
+std::shared_ptr <dwfl_context>
+cached_dwfl_context (std::string const &fn,
+		     std::function <std::shared_ptr <dwfl_context> ()> open);
+
+// Set limits of the cache, evicting contexts as necessary.
+void set_dwfl_context_cache_limits (size_t max_files, uint64_t max_bytes);
+
+// Evict all contexts from the cache.
+void clear_dwfl_context_cache ();
+
 #endif /* _DWFL_CONTEXT_H_ */
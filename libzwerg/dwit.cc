@@ -250,17 +250,22 @@ child_iterator::operator* ()
 }
 
 
+size_t const all_dies_iterator::no_max_depth;
+
 all_dies_iterator::all_dies_iterator (Dwarf_Off offset)
   : m_cuit (cu_iterator::end ())
+  , m_max_depth (no_max_depth)
 {}
 
 all_dies_iterator::all_dies_iterator (Dwarf *dw)
   : all_dies_iterator (cu_iterator {dw})
 {}
 
-all_dies_iterator::all_dies_iterator (cu_iterator const &cuit)
+all_dies_iterator::all_dies_iterator (cu_iterator const &cuit,
+				      size_t max_depth)
   : m_cuit (cuit)
   , m_die (**m_cuit)
+  , m_max_depth (max_depth)
 {}
 
 all_dies_iterator
@@ -288,7 +293,7 @@ all_dies_iterator
 all_dies_iterator::operator++ ()
 {
   Dwarf_Die child;
-  if (dwpp_child (m_die, child))
+  if (m_stack.size () < m_max_depth && dwpp_child (m_die, child))
     {
       m_stack.push_back (dwarf_dieoffset (&m_die));
       m_die = child;
@@ -122,18 +122,27 @@ public:
 
 // Tree flattening iterator.  It pre-order iterates all DIEs in given
 // dwarf file.
+//
+// The iteration can be limited to DIE's at most MAX_DEPTH levels
+// below their CU DIE.  Deeper subtrees are then not walked at all,
+// dwarf_siblingof jumps over them (using DW_AT_sibling where the
+// producer emitted it).
 class all_dies_iterator
   : public std::iterator<std::input_iterator_tag, Dwarf_Die *>
 {
   cu_iterator m_cuit;
   std::vector<Dwarf_Off> m_stack;
   Dwarf_Die m_die;
+  size_t m_max_depth;
 
   all_dies_iterator (Dwarf_Off offset);
 
 public:
+  static size_t const no_max_depth = (size_t) -1;
+
   explicit all_dies_iterator (Dwarf *dw);
-  explicit all_dies_iterator (cu_iterator const &cuit);
+  explicit all_dies_iterator (cu_iterator const &cuit,
+			      size_t max_depth = no_max_depth);
   all_dies_iterator (all_dies_iterator const &other) = default;
 
   static all_dies_iterator end ();
@@ -151,69 +160,55 @@ public:
   cu_iterator cu () const;
 };
 
+// Iterates over attributes of a DIE.  The attributes are collected
+// by a single dwarf_getattrs walk up front.  (Resuming dwarf_getattrs
+// at an offset makes it skip over the values of all the preceding
+// attributes again, which makes attribute-at-a-time walks quadratic.)
 class attr_iterator
   : public std::iterator<std::input_iterator_tag, Dwarf_Attribute *>
 {
-  Dwarf_Die *m_die;
-  Dwarf_Attribute m_at;
-  ptrdiff_t m_offset;
-
-  struct cb_data
-  {
-    Dwarf_Attribute *at;
-    bool been;
-  };
+  std::vector <Dwarf_Attribute> m_attrs;
+  size_t m_i;
 
   static int
   callback (Dwarf_Attribute *at, void *data)
   {
-    cb_data *d = static_cast<cb_data *> (data);
-    if (d->been)
-      return DWARF_CB_ABORT;
-
-    *d->at = *at;
-    d->been = true;
-
-    // Do a second iteration to find the next offset.
+    static_cast <std::vector <Dwarf_Attribute> *> (data)->push_back (*at);
     return DWARF_CB_OK;
   }
 
-  void
-  move ()
+  size_t
+  remaining () const
   {
-    // If m_offset is already 1, we are done iterating.
-    if (m_offset == 1)
-      {
-	*this = end ();
-	return;
-      }
-
-    cb_data data = {&m_at, false};
-    m_offset = dwarf_getattrs (m_die, &callback, &data, m_offset);
-    if (m_offset == -1)
-      throw_libdw ();
+    return m_attrs.size () - m_i;
   }
 
-  attr_iterator (ptrdiff_t offset)
-    : m_die (nullptr)
-    , m_at ({0})
-    , m_offset (offset)
+  attr_iterator ()
+    : m_i (0)
   {}
 
 public:
   attr_iterator (Dwarf_Die *die)
-    : m_die (die)
-    , m_at ({0})
-    , m_offset (0)
+    : m_i (0)
+  {
+    reset (die);
+  }
+
+  // Start iterating over attributes of DIE.  Unlike assigning a new
+  // iterator, this reuses storage of this one.
+  void
+  reset (Dwarf_Die *die)
   {
-    move ();
+    m_attrs.clear ();
+    m_i = 0;
+    if (dwarf_getattrs (die, &callback, &m_attrs, 0) == -1)
+      throw_libdw ();
   }
 
   bool
   operator== (attr_iterator const &other) const
   {
-    return m_offset == other.m_offset
-      && m_at.code == other.m_at.code;
+    return remaining () == other.remaining ();
   }
 
   bool
@@ -226,7 +221,7 @@ public:
   operator++ ()
   {
     assert (*this != end ());
-    move ();
+    ++m_i;
     return *this;
   }
 
@@ -241,13 +236,13 @@ public:
   Dwarf_Attribute *
   operator* ()
   {
-    return &m_at;
+    return &m_attrs[m_i];
   }
 
   static attr_iterator
   end ()
   {
-    return attr_iterator ((ptrdiff_t)1);
+    return attr_iterator ();
   }
 };
 
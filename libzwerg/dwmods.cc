@@ -29,21 +29,13 @@
 #include "dwmods.hh"
 
 #include <algorithm>
+#include <dwarf.h>
 #include "dwit.hh"
 
 std::vector <Dwarf *>
 all_dwarfs (dwfl_context &dwctx)
 {
-  std::vector <Dwarf *> ret;
-  std::for_each (dwfl_module_iterator {dwctx.get_dwfl ()},
-		 dwfl_module_iterator::end (),
-		 [&] (std::pair <Dwarf *, Dwarf_Addr> p)
-		 {
-		   ret.push_back (p.first);
-		   if (Dwarf *alt = dwarf_getalt (p.first))
-		     ret.push_back (alt);
-		 });
-  return ret;
+  return dwctx.get_dwarfs ();
 }
 
 bool
@@ -58,3 +50,159 @@ maybe_next_dwarf (cu_iterator &cuit,
       cuit = cu_iterator {*it++};
   return true;
 }
+
+namespace
+{
+  bool
+  next_acceptable_unit (doneness d, cu_iterator &it)
+  {
+    if (d == doneness::raw)
+      return true;
+
+    for (; it != cu_iterator::end (); ++it)
+      // In cooked mode, we reject partial units.
+      // XXX Should we reject type units as well?
+      if (dwarf_tag (*it) != DW_TAG_partial_unit)
+	return true;
+
+    return false;
+  }
+}
+
+dwarf_unit_producer::dwarf_unit_producer (std::shared_ptr <dwfl_context> dwctx,
+					  doneness d)
+  : m_dwctx {dwctx}
+  , m_dwarfs {all_dwarfs (*dwctx)}
+  , m_it {m_dwarfs.begin ()}
+  , m_cuit {cu_iterator::end ()}
+  , m_i {0}
+  , m_doneness {d}
+{}
+
+std::unique_ptr <value_cu>
+dwarf_unit_producer::next ()
+{
+  do
+    if (! maybe_next_dwarf (m_cuit, m_it, m_dwarfs.end ()))
+      return nullptr;
+  while (! next_acceptable_unit (m_doneness, m_cuit));
+
+  Dwarf_CU &cu = *(*m_cuit)->cu;
+  Dwarf_Off off = m_cuit.offset ();
+  m_cuit++;
+
+  return std::make_unique <value_cu> (m_dwctx, cu, off, m_i++, m_doneness);
+}
+
+die_index_producer::die_index_producer (std::shared_ptr <dwfl_context> dwctx,
+					get_list_t get, doneness d)
+  : m_dwctx {dwctx}
+  , m_get {get}
+  , m_dwarfs {all_dwarfs (*dwctx)}
+  , m_it {m_dwarfs.begin ()}
+  , m_dw {nullptr}
+  , m_idx {nullptr}
+  , m_off {nullptr}
+  , m_end {nullptr}
+  , m_doneness {d}
+  , m_cuoff {(Dwarf_Off) -1}
+  , m_cupos {0}
+  , m_cu_ok {false}
+  , m_single_unit {false}
+  , m_lo {0}
+{}
+
+die_index_producer::die_index_producer (std::shared_ptr <dwfl_context> dwctx,
+					get_list_t get, doneness d,
+					Dwarf_Die cudie)
+  : die_index_producer {dwctx, get, d}
+{
+  m_dwarfs = {dwarf_cu_getdwarf (cudie.cu)};
+  m_it = m_dwarfs.begin ();
+  m_single_unit = true;
+  m_lo = dwarf_dieoffset (&cudie);
+}
+
+namespace
+{
+  // Narrow R down to offsets of DIE's in the unit whose CU DIE is at
+  // CUOFF.
+  die_index::off_range
+  unit_range (die_index const &idx, die_index::off_range r, Dwarf_Off cuoff)
+  {
+    auto roots = idx.roots ();
+    auto it = std::upper_bound (roots.begin (), roots.end (), cuoff);
+    auto b = std::lower_bound (r.begin (), r.end (), cuoff);
+    auto e = it == roots.end () ? r.end ()
+      : std::lower_bound (b, r.end (), *it);
+    return die_index::off_range {b, e};
+  }
+}
+
+std::unique_ptr <value_die>
+die_index_producer::next ()
+{
+  while (true)
+    {
+      if (m_off == m_end)
+	{
+	  if (m_it == m_dwarfs.end ())
+	    return nullptr;
+
+	  m_dw = *m_it++;
+	  m_idx = &m_dwctx->get_die_index (m_dw);
+	  auto r = m_get (*m_idx);
+	  if (m_single_unit)
+	    r = unit_range (*m_idx, r, m_lo);
+	  m_off = r.begin ();
+	  m_end = r.end ();
+	  m_cuoff = (Dwarf_Off) -1;
+	  continue;
+	}
+
+      Dwarf_Off off = *m_off++;
+
+      // Unit that OFF belongs to is the last one that starts before
+      // it.
+      auto roots = m_idx->roots ();
+      auto it = std::upper_bound (roots.begin (), roots.end (), off);
+      assert (it != roots.begin ());
+      Dwarf_Off cuoff = *--it;
+
+      if (cuoff != m_cuoff)
+	{
+	  m_cuoff = cuoff;
+	  m_cupos = m_idx->position (cuoff);
+	  Dwarf_Die cudie = dwpp_offdie (m_dw, cuoff);
+	  m_cu_ok = m_doneness == doneness::raw || m_single_unit
+	    || dwarf_tag (&cudie) != DW_TAG_partial_unit;
+	}
+
+      if (! m_cu_ok)
+	continue;
+
+      return std::make_unique <value_die>
+	(m_dwctx, nullptr, dwpp_offdie (m_dw, off),
+	 m_idx->position (off) - m_cupos, m_doneness);
+    }
+}
+
+bool
+dwarf_has_imports (dwfl_context &dwctx)
+{
+  for (Dwarf *dw: all_dwarfs (dwctx))
+    {
+      die_index const &idx = dwctx.get_die_index (dw);
+      if (! idx.tag_offsets (DW_TAG_imported_unit).empty ())
+	return true;
+    }
+  return false;
+}
+
+bool
+unit_has_imports (dwfl_context &dwctx, Dwarf_Die cudie)
+{
+  die_index const &idx = dwctx.get_die_index (dwarf_cu_getdwarf (cudie.cu));
+  return ! unit_range (idx, idx.tag_offsets (DW_TAG_imported_unit),
+		       dwarf_dieoffset (&cudie)).empty ();
+}
@@ -30,8 +30,12 @@
 #define DWMODS_H
 
 #include <vector>
+#include <functional>
+#include "dwcache.hh"
 #include "dwfl_context.hh"
 #include "dwit.hh"
+#include "op.hh"
+#include "value-dw.hh"
 
 std::vector <Dwarf *> all_dwarfs (dwfl_context &dwctx);
 
@@ -39,4 +43,70 @@ bool maybe_next_dwarf (cu_iterator &cuit,
 		       std::vector <Dwarf *>::iterator &it,
 		       std::vector <Dwarf *>::iterator const end);
 
+// Yields units of all Dwarfs in DWCTX, in the order that `unit`
+// presents them.  In cooked mode, partial units are skipped.
+struct dwarf_unit_producer
+  : public value_producer <value_cu>
+{
+  std::shared_ptr <dwfl_context> m_dwctx;
+  std::vector <Dwarf *> m_dwarfs;
+  std::vector <Dwarf *>::iterator m_it;
+  cu_iterator m_cuit;
+  size_t m_i;
+  doneness m_doneness;
+
+  dwarf_unit_producer (std::shared_ptr <dwfl_context> dwctx, doneness d);
+
+  std::unique_ptr <value_cu> next () override;
+};
+
+// Yields DIE's of all Dwarfs in DWCTX that are listed in a per-Dwarf
+// index (see die_index), which GET picks.  DIE's come in the order,
+// and with the positions, that `entry` would give them.  In cooked
+// mode, DIE's of partial units are skipped.  Note that imported
+// partial units are not inlined, see dwarf_has_imports.
+//
+// The second constructor limits the producer to the unit whose CU DIE
+// is CUDIE, partial or not.
+struct die_index_producer
+  : public value_producer <value_die>
+{
+  using get_list_t = std::function <die_index::off_range
+				    (die_index const &)>;
+
+  std::shared_ptr <dwfl_context> m_dwctx;
+  get_list_t m_get;
+  std::vector <Dwarf *> m_dwarfs;
+  std::vector <Dwarf *>::iterator m_it;
+  Dwarf *m_dw;
+  die_index const *m_idx;
+  uint64_t const *m_off;
+  uint64_t const *m_end;
+  doneness m_doneness;
+
+  // Unit of the most recently yielded DIE.
+  Dwarf_Off m_cuoff;
+  uint64_t m_cupos;
+  bool m_cu_ok;
+
+  bool m_single_unit;
+  Dwarf_Off m_lo;
+
+  die_index_producer (std::shared_ptr <dwfl_context> dwctx,
+		      get_list_t get, doneness d);
+
+  die_index_producer (std::shared_ptr <dwfl_context> dwctx,
+		      get_list_t get, doneness d, Dwarf_Die cudie);
+
+  std::unique_ptr <value_die> next () override;
+};
+
+// Whether any of the Dwarfs in DWCTX uses DW_TAG_imported_unit.
+// Cooked DIE iteration inlines the imported units, which
+// die_index_producer doesn't.
+bool dwarf_has_imports (dwfl_context &dwctx);
+
+// Whether the unit whose CU DIE is CUDIE uses DW_TAG_imported_unit.
+bool unit_has_imports (dwfl_context &dwctx, Dwarf_Die cudie);
+
 #endif /* DWMODS_H */
@@ -67,6 +67,42 @@ extern "C" {
 
   char const *zw_value_dwarf_name (zw_value const *dw, size_t *out_length);
 
+  /**
+   * Build the DIE parent caches of DW up front, using up to NTHREADS
+   * threads, instead of lazily as queries need them.  Subsequent
+   * queries, including parallel ones, share the built caches.
+   */
+  bool zw_value_dwarf_prebuild (zw_value const *dw, unsigned nthreads,
+				zw_error **out_err);
+
+
+  /**
+   * Files opened by zw_value_init_dwarf, zw_value_init_dwarf_raw and
+   * the word `dwopen' can be shared through a process-wide cache,
+   * so that opening the same file again is cheap.  A cached file is
+   * reused as long as its device, inode and modification time stay
+   * the same.  Least recently used files are evicted when there are
+   * more than MAX_FILES of them, or their total size exceeds
+   * MAX_BYTES.  Both limits are zero by default, which disables the
+   * cache.  Dwarf values that refer to an evicted file stay valid.
+   */
+  void zw_dwarf_cache_set_limits (size_t max_files, uint64_t max_bytes);
+
+  /**
+   * Evict all files from the Dwarf cache.
+   */
+  void zw_dwarf_cache_clear (void);
+
+  /**
+   * Dwarf files that carry a build ID can have their DIE index, which
+   * speeds up lookups by name, tag or address, saved under
+   * $XDG_CACHE_HOME/dwgrep and loaded back the next time the same
+   * file is opened.  At most MAX_BYTES of indices are kept, least
+   * recently used ones are removed first.  The limit is zero by
+   * default, which disables saving indices.
+   */
+  void zw_dwarf_index_cache_set_limit (uint64_t max_bytes);
+
 
   /**
    * DIE.
@@ -29,13 +29,16 @@
 
 #include <cstring>
 #include <iostream>
+#include <sstream>
 #include <string>
 
 #include "builtin-dw.hh"
 #include "builtin.hh"
 #include "init.hh"
 #include "op.hh"
+#include "parallel.hh"
 #include "parser.hh"
+#include "planner.hh"
 #include "stack.hh"
 #include "tree.hh"
 #include "value-dw.hh"
@@ -231,6 +234,7 @@ zw_query_parse_len (zw_vocabulary const *voc,
   return capture_errors ([&] () {
       tree t = parse_query (*voc->m_voc, {query, query_len});
       t.simplify ();
+      peg_overloads (t);
       return new zw_query { t };
     }, nullptr, out_err);
 }
@@ -264,6 +268,50 @@ zw_value_init_dwarf_raw (char const *filename, size_t pos, zw_error **out_err)
   return init_dwarf (filename, doneness::raw, pos, out_err);
 }
 
+bool
+zw_value_dwarf_prebuild (zw_value const *dw, unsigned nthreads,
+			 zw_error **out_err)
+{
+  return capture_errors ([&] () {
+      auto dwv = value::as <value_dwarf> (dw->m_value.get ());
+      if (dwv == nullptr)
+	throw std::runtime_error ("Not a Dwarf value.");
+      dwv->get_dwctx ()->prebuild_caches (nthreads);
+      return true;
+    }, false, out_err);
+}
+
+void
+zw_dwarf_cache_set_limits (size_t max_files, uint64_t max_bytes)
+{
+  set_dwfl_context_cache_limits (max_files, max_bytes);
+}
+
+void
+zw_dwarf_cache_clear (void)
+{
+  clear_dwfl_context_cache ();
+}
+
+void
+zw_dwarf_index_cache_set_limit (uint64_t max_bytes)
+{
+  set_die_index_cache_limit (max_bytes);
+}
+
+char *
+zw_value_show (zw_value const *val, zw_error **out_err)
+{
+  return capture_errors ([&] () {
+      std::ostringstream ss;
+      ss << *val->m_value;
+      char *ret = strdup (ss.str ().c_str ());
+      if (ret == nullptr)
+	throw std::bad_alloc ();
+      return ret;
+    }, nullptr, out_err);
+}
+
 void
 zw_value_destroy (zw_value *value)
 {
@@ -279,8 +327,26 @@ zw_query_execute (zw_query const *query, zw_stack const *input_stack,
       auto stk = std::make_unique <stack> ();
       for (auto const &emt: input_stack->m_values)
 	stk->push (emt->m_value->clone ());
+      tree t = query->m_query;
+      peg_overloads (t, *stk);
+      if (verify_stack_effects (t, *stk))
+	stk->uncheck ();
       auto upstream = std::make_shared <op_origin> (std::move (stk));
-      return new zw_result { query->m_query.build_exec (upstream) };
+      return new zw_result { t.build_exec (upstream) };
+    }, nullptr, out_err);
+}
+
+zw_result *
+zw_query_execute_parallel (zw_query const *query, zw_stack const *input_stack,
+			   unsigned nthreads, bool ordered, zw_error **out_err)
+{
+  return capture_errors ([&] () {
+      auto stk = std::make_unique <stack> ();
+      for (auto const &emt: input_stack->m_values)
+	stk->push (emt->m_value->clone ());
+      return new zw_result { build_exec_parallel (query->m_query,
+						  std::move (stk),
+						  nthreads, ordered) };
     }, nullptr, out_err);
 }
 
@@ -288,7 +354,7 @@ bool
 zw_result_next (zw_result *result, zw_stack **out_stack, zw_error **out_err)
 {
   return capture_errors ([&] () {
-      std::unique_ptr <stack> ret = result->m_op->next ();
+      std::unique_ptr <stack> ret = result->m_reader.next (*result->m_op);
       if (ret == nullptr)
 	{
 	  *out_stack = nullptr;
@@ -309,6 +375,12 @@ zw_result_next (zw_result *result, zw_stack **out_stack, zw_error **out_err)
     }, false, out_err);
 }
 
+void
+zw_result_set_limit (zw_result *result, uint64_t limit)
+{
+  result->m_reader.set_limit (limit);
+}
+
 void
 zw_result_destroy (zw_result *result)
 {
@@ -89,13 +89,38 @@ extern "C" {
   void zw_query_destroy (zw_query *query);
 
 
+  // Start executing QUERY over INPUT_STACK.  Results are computed
+  // lazily by zw_result_next.
+  //
+  // Several threads may execute queries over one INPUT_STACK, and
+  // step their results, at the same time, as long as nobody modifies
+  // the stack meanwhile.  Values are copied into each execution, but
+  // copies of a Dwarf value share the opened file and its caches.
+  // See zw_value_dwarf_prebuild for populating the caches up front.
   zw_result *zw_query_execute (zw_query const *query,
 			       zw_stack const *input_stack,
 			       zw_error **out_err);
 
+  // Like zw_query_execute, but a query that starts with `entry' or
+  // `unit' applied to a Dwarf is partitioned per unit, and units are
+  // processed by NTHREADS worker threads (0 means one per hardware
+  // thread).  If ORDERED, the results come in the same order as with
+  // zw_query_execute, otherwise in the order that units are finished.
+  // Other queries are executed serially.
+  zw_result *zw_query_execute_parallel (zw_query const *query,
+					zw_stack const *input_stack,
+					unsigned nthreads, bool ordered,
+					zw_error **out_err);
+
   bool zw_result_next (zw_result *result,
 		       zw_stack **out_stack, zw_error **out_err);
 
+  // Make RESULT yield at most LIMIT more stacks, after which
+  // zw_result_next reports that there are no more.  Results are
+  // otherwise computed ahead in small batches; with a limit, the
+  // query is not evaluated past what's asked for.
+  void zw_result_set_limit (zw_result *result, uint64_t limit);
+
   void zw_result_destroy (zw_result *result);
 
 
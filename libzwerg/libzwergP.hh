@@ -31,6 +31,7 @@
 #include <string>
 #include <memory>
 
+#include "op.hh"
 #include "tree.hh"
 
 struct vocabulary;
@@ -53,6 +54,7 @@ struct zw_query
 struct zw_result
 {
   std::shared_ptr <op> m_op;
+  batch_reader m_reader;
 };
 
 struct zw_value
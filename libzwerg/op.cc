@@ -29,7 +29,6 @@
 #include <iostream>
 #include <sstream>
 #include <memory>
-#include <set>
 #include <algorithm>
 
 #include "op.hh"
@@ -77,6 +76,79 @@ namespace
   }
 }
 
+bool
+op::fill_batch (stack_batch &out, size_t n)
+{
+  for (size_t i = 0; i < n; ++i)
+    if (auto stk = next ())
+      out.push_back (std::move (stk));
+    else
+      return false;
+  return true;
+}
+
+bool
+op::next_batch (stack_batch &out, size_t n)
+{
+  if (m_deferred != nullptr)
+    {
+      std::exception_ptr exc = nullptr;
+      std::swap (exc, m_deferred);
+      std::rethrow_exception (exc);
+    }
+
+  size_t size = out.size ();
+  try
+    {
+      return fill_batch (out, n);
+    }
+  catch (...)
+    {
+      if (out.size () == size)
+	throw;
+      m_deferred = std::current_exception ();
+      return true;
+    }
+}
+
+stack::uptr
+batch_reader::next (op &upstream)
+{
+  if (m_left == 0)
+    return nullptr;
+
+  if (m_pos == m_batch.size ())
+    {
+      m_batch.clear ();
+      m_pos = 0;
+      size_t n = std::min ((uint64_t) op::batch_size, m_left);
+      while (m_batch.empty () && m_more)
+	m_more = upstream.next_batch (m_batch, n);
+      if (m_batch.empty ())
+	return nullptr;
+    }
+
+  if (m_left != UINT64_MAX)
+    --m_left;
+  return std::move (m_batch[m_pos++]);
+}
+
+void
+batch_reader::reset ()
+{
+  m_batch.clear ();
+  m_pos = 0;
+  m_more = true;
+  m_left = m_limit;
+}
+
+void
+batch_reader::set_limit (uint64_t limit)
+{
+  m_limit = limit;
+  m_left = limit;
+}
+
 stack::uptr
 op_origin::next ()
 {
@@ -103,7 +175,7 @@ op_origin::set_next (stack::uptr s)
 }
 
 void
-op_origin::reset ()
+op_origin::do_reset ()
 {
   m_stk = nullptr;
   m_reset = true;
@@ -132,6 +204,17 @@ op_assert::next ()
   return nullptr;
 }
 
+bool
+op_assert::fill_batch (stack_batch &out, size_t n)
+{
+  m_batch.clear ();
+  bool more = m_upstream->next_batch (m_batch, n);
+  for (auto &stk: m_batch)
+    if (m_pred->result (*stk) == pred_result::yes)
+      out.push_back (std::move (stk));
+  return more;
+}
+
 std::string
 op_assert::name () const
 {
@@ -139,6 +222,51 @@ op_assert::name () const
 }
 
 
+pred_result
+op_fused_filter::result (stack &stk)
+{
+  if (stk.size () > 0 && stk.top ().get_type () == m_vt)
+    return m_test->result (stk.get_mutable (0));
+
+  for (auto const &p: m_preds)
+    {
+      pred_result r = p->result (stk);
+      if (r != pred_result::yes)
+	return r;
+    }
+  return pred_result::yes;
+}
+
+stack::uptr
+op_fused_filter::next ()
+{
+  while (auto stk = m_upstream->next ())
+    if (result (*stk) == pred_result::yes)
+      return stk;
+  return nullptr;
+}
+
+bool
+op_fused_filter::fill_batch (stack_batch &out, size_t n)
+{
+  m_batch.clear ();
+  bool more = m_upstream->next_batch (m_batch, n);
+  for (auto &stk: m_batch)
+    if (result (*stk) == pred_result::yes)
+      out.push_back (std::move (stk));
+  return more;
+}
+
+std::string
+op_fused_filter::name () const
+{
+  std::string ret = "fused";
+  for (auto const &p: m_preds)
+    ret += "<" + p->name () + ">";
+  return ret;
+}
+
+
 void
 stringer_origin::set_next (stack::uptr s)
 {
@@ -223,6 +351,7 @@ struct op_format::pimpl
   std::shared_ptr <op> m_upstream;
   std::shared_ptr <stringer_origin> m_origin;
   std::shared_ptr <stringer> m_stringer;
+  batch_reader m_reader;
   size_t m_pos;
 
   pimpl (std::shared_ptr <op> upstream,
@@ -264,10 +393,35 @@ struct op_format::pimpl
       }
   }
 
+  bool
+  fill_batch (stack_batch &out, size_t n)
+  {
+    for (size_t i = 0; i < n; )
+      {
+	auto stk = m_stringer->next ();
+	if (stk.first != nullptr)
+	  {
+	    stk.first->push (std::make_unique <value_str>
+			     (std::move (stk.second), m_pos++));
+	    out.push_back (std::move (stk.first));
+	    ++i;
+	  }
+	else if (auto stk = m_reader.next (*m_upstream))
+	  {
+	    reset_me ();
+	    m_origin->set_next (std::move (stk));
+	  }
+	else
+	  return false;
+      }
+    return true;
+  }
+
   void
   reset ()
   {
     reset_me ();
+    m_reader.reset ();
     m_upstream->reset ();
   }
 };
@@ -287,8 +441,14 @@ op_format::next ()
   return m_pimpl->next ();
 }
 
+bool
+op_format::fill_batch (stack_batch &out, size_t n)
+{
+  return m_pimpl->fill_batch (out, n);
+}
+
 void
-op_format::reset ()
+op_format::do_reset ()
 {
   m_pimpl->reset ();
 }
@@ -311,6 +471,16 @@ op_const::next ()
   return nullptr;
 }
 
+bool
+op_const::fill_batch (stack_batch &out, size_t n)
+{
+  size_t size = out.size ();
+  bool more = m_upstream->next_batch (out, n);
+  for (size_t i = size; i < out.size (); ++i)
+    out[i]->push (m_value->clone ());
+  return more;
+}
+
 std::string
 op_const::name () const
 {
@@ -345,7 +515,7 @@ op_tine::next ()
 }
 
 void
-op_tine::reset ()
+op_tine::do_reset ()
 {
   for (auto &stk: *m_file)
     stk = nullptr;
@@ -377,7 +547,7 @@ op_merge::next ()
 }
 
 void
-op_merge::reset ()
+op_merge::do_reset ()
 {
   *m_done = false;
   m_it = m_ops.begin ();
@@ -401,7 +571,7 @@ op_or::reset_me ()
 }
 
 void
-op_or::reset ()
+op_or::do_reset ()
 {
   reset_me ();
   m_upstream->reset ();
@@ -461,8 +631,11 @@ op_capture::next ()
       m_origin->set_next (std::make_unique <stack> (*stk));
 
       value_seq::seq_t vv;
-      while (auto stk2 = m_op->next ())
-	vv.push_back (stk2->pop ());
+      while (vv.size () < m_limit)
+	if (auto stk2 = m_op->next ())
+	  vv.push_back (stk2->pop ());
+	else
+	  break;
 
       stk->push (std::make_unique <value_seq> (std::move (vv), 0));
       return stk;
@@ -472,7 +645,7 @@ op_capture::next ()
 }
 
 void
-op_capture::reset ()
+op_capture::do_reset ()
 {
   m_op->reset ();
   m_upstream->reset ();
@@ -487,13 +660,77 @@ op_capture::name () const
 
 namespace
 {
-  struct deref_less
+  // A set of stacks, hashed by stack::hash, with open addressing and
+  // linear probing.
+  class stack_set
   {
-    template <class T>
+    struct slot
+    {
+      size_t m_hash;
+      std::shared_ptr <stack> m_stk;
+    };
+
+    std::vector <slot> m_slots;
+    size_t m_size;
+
+    // Tables up to this size are kept around when cleared, so that
+    // closures over small relations don't allocate over and over.
+    static size_t const keep_size = 256;
+
+    void
+    grow ()
+    {
+      std::vector <slot> old (m_slots.empty () ? 16 : 2 * m_slots.size ());
+      old.swap (m_slots);
+      for (auto &s: old)
+	if (s.m_stk != nullptr)
+	  place (std::move (s));
+    }
+
+    void
+    place (slot s)
+    {
+      size_t mask = m_slots.size () - 1;
+      size_t i = s.m_hash & mask;
+      while (m_slots[i].m_stk != nullptr)
+	i = (i + 1) & mask;
+      m_slots[i] = std::move (s);
+    }
+
+  public:
+    stack_set ()
+      : m_size {0}
+    {}
+
+    // Add STK unless an equal stack is in the set already.  Return
+    // whether it was added.
     bool
-    operator() (T const &a, T const &b)
+    insert (std::shared_ptr <stack> stk)
+    {
+      if (2 * (m_size + 1) > m_slots.size ())
+	grow ();
+
+      size_t hash = stk->hash ();
+      size_t mask = m_slots.size () - 1;
+      for (size_t i = hash & mask; m_slots[i].m_stk != nullptr;
+	   i = (i + 1) & mask)
+	if (m_slots[i].m_hash == hash && *m_slots[i].m_stk == *stk)
+	  return false;
+
+      place ({hash, std::move (stk)});
+      ++m_size;
+      return true;
+    }
+
+    void
+    clear ()
     {
-      return *a < *b;
+      if (m_slots.size () > keep_size)
+	std::vector <slot> ().swap (m_slots);
+      else if (m_size > 0)
+	for (auto &s: m_slots)
+	  s.m_stk = nullptr;
+      m_size = 0;
     }
   };
 }
@@ -503,16 +740,24 @@ struct op_tr_closure::pimpl
   std::shared_ptr <op> m_upstream;
   std::shared_ptr <op_origin> m_origin;
   std::shared_ptr <op> m_op;
+  std::unique_ptr <value_test> m_acyclic;
 
-  std::set <std::shared_ptr <stack>, deref_less> m_seen;
+  stack_set m_seen;
   std::vector <std::shared_ptr <stack> > m_stks;
 
+  // Whether the closure currently being computed needs to weed out
+  // stacks that it has seen already.
+  bool m_dedup;
+
   pimpl (std::shared_ptr <op> upstream,
 	 std::shared_ptr <op_origin> origin,
-	 std::shared_ptr <op> op)
+	 std::shared_ptr <op> op,
+	 std::unique_ptr <value_test> acyclic)
     : m_upstream {upstream}
     , m_origin {origin}
     , m_op {op}
+    , m_acyclic {std::move (acyclic)}
+    , m_dedup {true}
   {}
 
   void
@@ -522,6 +767,13 @@ struct op_tr_closure::pimpl
     m_seen.clear ();
   }
 
+  bool
+  is_acyclic (stack &stk)
+  {
+    return m_acyclic != nullptr && stk.size () > 0
+      && m_acyclic->result (stk.get_mutable (0)) == pred_result::yes;
+  }
+
   void
   reset ()
   {
@@ -539,8 +791,10 @@ struct op_tr_closure::pimpl
 	    reset_me ();
 	    if (std::shared_ptr <stack> stk = m_upstream->next ())
 	      {
+		m_dedup = ! is_acyclic (*stk);
 		m_stks.push_back (stk);
-		m_seen.insert (stk);
+		if (m_dedup)
+		  m_seen.insert (stk);
 	      }
 	    else
 	      return nullptr;
@@ -553,11 +807,8 @@ struct op_tr_closure::pimpl
 	m_origin->set_next (std::make_unique <stack> (*stk));
 
 	while (std::shared_ptr <stack> stk2 = m_op->next ())
-	  if (m_seen.find (stk2) == m_seen.end ())
-	    {
-	      m_stks.push_back (stk2);
-	      m_seen.insert (stk2);
-	    }
+	  if (! m_dedup || m_seen.insert (stk2))
+	    m_stks.push_back (stk2);
 
 	return std::make_unique <stack> (*stk);
       }
@@ -573,8 +824,10 @@ struct op_tr_closure::pimpl
 
 op_tr_closure::op_tr_closure (std::shared_ptr <op> upstream,
 			      std::shared_ptr <op_origin> origin,
-			      std::shared_ptr <op> op)
-  : m_pimpl {std::make_unique <pimpl> (upstream, origin, op)}
+			      std::shared_ptr <op> op,
+			      std::unique_ptr <value_test> acyclic)
+  : m_pimpl {std::make_unique <pimpl> (upstream, origin, op,
+				       std::move (acyclic))}
 {}
 
 op_tr_closure::~op_tr_closure ()
@@ -587,7 +840,7 @@ op_tr_closure::next ()
 }
 
 void
-op_tr_closure::reset ()
+op_tr_closure::do_reset ()
 {
   m_pimpl->reset ();
 }
@@ -680,7 +933,7 @@ op_subx::next ()
 }
 
 void
-op_subx::reset ()
+op_subx::do_reset ()
 {
   m_pimpl->reset ();
 }
@@ -709,7 +962,7 @@ op_f_debug::name () const
 }
 
 void
-op_f_debug::reset ()
+op_f_debug::do_reset ()
 {
   m_upstream->reset ();
 }
@@ -794,7 +1047,7 @@ op_scope::next ()
 }
 
 void
-op_scope::reset ()
+op_scope::do_reset ()
 {
   return m_pimpl->reset ();
 }
@@ -808,7 +1061,7 @@ op_scope::name () const
 
 
 void
-op_bind::reset ()
+op_bind::do_reset ()
 {
   m_upstream->reset ();
 }
@@ -818,8 +1071,8 @@ op_bind::next ()
 {
   if (auto stk = m_upstream->next ())
     {
-      auto frame = stk->nth_frame (m_depth);
-      frame->bind_value (m_index, stk->pop ());
+      auto val = stk->pop ();
+      stk->bind_value (m_depth, m_index, std::move (val));
       return stk;
     }
   return nullptr;
@@ -836,12 +1089,21 @@ op_bind::name () const
 struct op_read::pimpl
 {
   std::shared_ptr <op> m_upstream;
+
+  // Function references are executed through this apply, which is
+  // kept around so that it can reuse the op graphs that it builds.
+  std::shared_ptr <op_origin> m_origin;
   std::shared_ptr <op> m_apply;
+  bool m_applying;
+
   size_t m_depth;
   var_id m_index;
 
   pimpl (std::shared_ptr <op> upstream, size_t depth, var_id index)
     : m_upstream {upstream}
+    , m_origin {std::make_shared <op_origin> (nullptr)}
+    , m_apply {std::make_shared <op_apply> (m_origin)}
+    , m_applying {false}
     , m_depth {depth}
     , m_index {index}
   {}
@@ -849,7 +1111,7 @@ struct op_read::pimpl
   void
   reset_me ()
   {
-    m_apply = nullptr;
+    m_applying = false;
   }
 
   stack::uptr
@@ -857,7 +1119,7 @@ struct op_read::pimpl
   {
     while (true)
       {
-	if (m_apply == nullptr)
+	if (! m_applying)
 	  {
 	    if (auto stk = m_upstream->next ())
 	      {
@@ -875,14 +1137,14 @@ struct op_read::pimpl
 		// reference.  We need to execute it and fetch all the
 		// values.
 
-		auto origin = std::make_shared <op_origin> (std::move (stk));
-		m_apply = std::make_shared <op_apply> (origin);
+		m_apply->reset ();
+		m_origin->set_next (std::move (stk));
+		m_applying = true;
 	      }
 	    else
 	      return nullptr;
 	  }
 
-	assert (m_apply != nullptr);
 	if (auto stk = m_apply->next ())
 	  return stk;
 
@@ -906,7 +1168,7 @@ op_read::~op_read ()
 {}
 
 void
-op_read::reset ()
+op_read::do_reset ()
 {
   m_pimpl->reset ();
 }
@@ -926,7 +1188,7 @@ op_read::name () const
 
 
 void
-op_lex_closure::reset ()
+op_lex_closure::do_reset ()
 {
   m_upstream->reset ();
 }
@@ -1051,7 +1313,7 @@ op_ifelse::~op_ifelse ()
 {}
 
 void
-op_ifelse::reset ()
+op_ifelse::do_reset ()
 {
   m_pimpl->reset ();
 }
@@ -1169,3 +1431,22 @@ pred_subx_compare::reset ()
   m_op2->reset ();
   m_pred->reset ();
 }
+
+
+pred_result
+value_test_not::result (value &val)
+{
+  return ! m_a->result (val);
+}
+
+pred_result
+value_test_and::result (value &val)
+{
+  return m_a->result (val) && m_b->result (val);
+}
+
+pred_result
+value_test_or::result (value &val)
+{
+  return m_a->result (val) || m_b->result (val);
+}
@@ -31,23 +31,88 @@
 
 #include <memory>
 #include <cassert>
+#include <cstdint>
+#include <exception>
+#include <vector>
 
 #include "stack.hh"
 #include "pred_result.hh"
 #include "tree.hh"
 
+using stack_batch = std::vector <stack::uptr>;
+
 // Subclasses of class op represent computations.  An op node is
 // typically constructed such that it directly feeds from another op
 // node, called upstream (see tree::build_exec).
+//
+// Besides the one-at-a-time next, ops can be asked for stacks in
+// batches.  Ops that sit on hot paths implement fill_batch natively,
+// and pass batches along from their upstream, which saves a virtual
+// call per stack and op.  For the rest, fill_batch calls next.  A
+// consumer of an op calls either next, or next_batch, but doesn't
+// mix the two between resets.
 class op
 {
+  std::exception_ptr m_deferred;
+
+protected:
+  // Append to OUT about N stacks, those that next would produce.
+  // Return false if there are no more stacks after those.
+  virtual bool fill_batch (stack_batch &out, size_t n);
+
+  // Bring the op back to its initial state, see reset.
+  virtual void do_reset () = 0;
+
 public:
+  static size_t const batch_size = 64;
+
   virtual ~op () {}
 
   // Produce next value.
   virtual stack::uptr next () = 0;
-  virtual void reset () = 0;
   virtual std::string name () const = 0;
+
+  // Reset the op.  Ops are often reset before they are exhausted, so
+  // an exception that next_batch holds back is dropped as well, lest
+  // it surfaces for unrelated input.
+  void
+  reset ()
+  {
+    m_deferred = nullptr;
+    do_reset ();
+  }
+
+  // Append next batch of stacks to OUT (see fill_batch).  Return
+  // false if the op is exhausted and shouldn't be asked again.  If
+  // producing a stack throws after some stacks were already produced,
+  // those are returned first, and the exception is rethrown by the
+  // following call.
+  bool next_batch (stack_batch &out, size_t n = batch_size);
+};
+
+// Helper for ops that take stacks from upstream one at a time, but
+// want to fetch them in batches.  A reader may be limited to a given
+// number of stacks, after which it stops asking upstream.  Batches are
+// then sized so that not much more than that is computed.
+class batch_reader
+{
+  stack_batch m_batch;
+  size_t m_pos;
+  bool m_more;
+  uint64_t m_limit;
+  uint64_t m_left;
+
+public:
+  batch_reader ()
+    : m_pos {0}
+    , m_more {true}
+    , m_limit {UINT64_MAX}
+    , m_left {UINT64_MAX}
+  {}
+
+  stack::uptr next (op &upstream);
+  void reset ();
+  void set_limit (uint64_t limit);
 };
 
 template <class RT>
@@ -100,7 +165,7 @@ public:
     : m_upstream {upstream}
   {}
 
-  void reset () override
+  void do_reset () override
   { m_upstream->reset (); }
 };
 
@@ -114,6 +179,16 @@ public:
   virtual void reset () = 0;
 };
 
+// Class value_test is for predicates that only look at TOS.  Fused
+// filters (see op_fused_filter) evaluate these directly on the value,
+// without going through a stack.
+class value_test
+{
+public:
+  virtual ~value_test () {}
+  virtual pred_result result (value &val) = 0;
+};
+
 // Origin is upstream-less node that is placed at the beginning of the
 // chain of computations.  It's provided a stack from the outside by
 // way of set_next.  Its only action is to send this stack down from
@@ -143,7 +218,7 @@ public:
 
   stack::uptr next () override;
   std::string name () const override;
-  void reset () override;
+  void do_reset () override;
 };
 
 struct stub_op
@@ -176,7 +251,7 @@ public:
   stack::uptr next () override;
   std::string name () const override;
 
-  void reset () override
+  void do_reset () override
   { m_upstream->reset (); }
 };
 
@@ -185,6 +260,10 @@ class op_assert
 {
   std::shared_ptr <op> m_upstream;
   std::unique_ptr <pred> m_pred;
+  stack_batch m_batch;
+
+protected:
+  bool fill_batch (stack_batch &out, size_t n) override;
 
 public:
   op_assert (std::shared_ptr <op> upstream, std::unique_ptr <pred> p)
@@ -195,7 +274,43 @@ public:
   stack::uptr next () override;
   std::string name () const override;
 
-  void reset () override
+  void do_reset () override
+  { m_upstream->reset (); }
+};
+
+// A run of filters fused into a single op (see fuse_filters).  If
+// TOS is of the type that the fused test was built for, the test is
+// evaluated directly on TOS.  Other stacks are handed to the
+// predicates of the individual filters, in order, like a chain of
+// op_assert's would.
+class op_fused_filter
+  : public op
+{
+  std::shared_ptr <op> m_upstream;
+  value_type m_vt;
+  std::unique_ptr <value_test> m_test;
+  std::vector <std::unique_ptr <pred>> m_preds;
+  stack_batch m_batch;
+
+  pred_result result (stack &stk);
+
+protected:
+  bool fill_batch (stack_batch &out, size_t n) override;
+
+public:
+  op_fused_filter (std::shared_ptr <op> upstream, value_type vt,
+		   std::unique_ptr <value_test> test,
+		   std::vector <std::unique_ptr <pred>> preds)
+    : m_upstream {upstream}
+    , m_vt {vt}
+    , m_test {std::move (test)}
+    , m_preds {std::move (preds)}
+  {}
+
+  stack::uptr next () override;
+  std::string name () const override;
+
+  void do_reset () override
   { m_upstream->reset (); }
 };
 
@@ -285,6 +400,9 @@ class op_format
   class pimpl;
   std::unique_ptr <pimpl> m_pimpl;
 
+protected:
+  bool fill_batch (stack_batch &out, size_t n) override;
+
 public:
   op_format (std::shared_ptr <op> upstream,
 	     std::shared_ptr <stringer_origin> origin,
@@ -294,7 +412,7 @@ public:
 
   stack::uptr next () override;
   std::string name () const override;
-  void reset () override;
+  void do_reset () override;
 };
 
 class op_const
@@ -303,6 +421,9 @@ class op_const
   std::shared_ptr <op> m_upstream;
   std::unique_ptr <value> m_value;
 
+protected:
+  bool fill_batch (stack_batch &out, size_t n) override;
+
 public:
   op_const (std::shared_ptr <op> upstream, std::unique_ptr <value> &&value)
     : m_upstream {upstream}
@@ -312,7 +433,7 @@ public:
   stack::uptr next () override;
   std::string name () const override;
 
-  void reset () override
+  void do_reset () override
   { m_upstream->reset (); }
 };
 
@@ -358,7 +479,7 @@ public:
 
   stack::uptr next () override;
   std::string name () const override;
-  void reset () override;
+  void do_reset () override;
 };
 
 class op_merge
@@ -383,7 +504,7 @@ public:
 
   stack::uptr next () override;
   std::string name () const override;
-  void reset () override;
+  void do_reset () override;
 };
 
 class op_or
@@ -411,32 +532,42 @@ public:
     m_branch_it = m_branches.end ();
   }
 
-  void reset () override;
+  void do_reset () override;
   stack::uptr next () override;
   std::string name () const override;
 };
 
+// Collects what OP yields into a sequence.  When only a prefix of
+// the sequence will ever be looked at, LIMIT tells how long it is, and
+// OP is not asked for more than that.
 class op_capture
   : public op
 {
   std::shared_ptr <op> m_upstream;
   std::shared_ptr <op_origin> m_origin;
   std::shared_ptr <op> m_op;
+  size_t m_limit;
 
 public:
   op_capture (std::shared_ptr <op> upstream,
 	      std::shared_ptr <op_origin> origin,
-	      std::shared_ptr <op> op)
+	      std::shared_ptr <op> op,
+	      size_t limit = SIZE_MAX)
     : m_upstream {upstream}
     , m_origin {origin}
     , m_op {op}
+    , m_limit {limit}
   {}
 
-  void reset () override;
+  void do_reset () override;
   stack::uptr next () override;
   std::string name () const override;
 };
 
+// Transitive closure.  Stacks that OP yields are fed back to it
+// until no new ones come up.  For stacks whose TOS ACYCLIC (which may
+// be nullptr) holds, OP is known never to come back to a stack that
+// it has yielded before, and the closure doesn't keep track of them.
 class op_tr_closure
   : public op
 {
@@ -446,13 +577,14 @@ class op_tr_closure
 public:
   op_tr_closure (std::shared_ptr <op> upstream,
 		 std::shared_ptr <op_origin> origin,
-		 std::shared_ptr <op> op);
+		 std::shared_ptr <op> op,
+		 std::unique_ptr <value_test> acyclic = nullptr);
 
   ~op_tr_closure ();
 
   stack::uptr next () override;
   std::string name () const override;
-  void reset () override;
+  void do_reset () override;
 };
 
 class op_subx
@@ -471,7 +603,7 @@ public:
 
   stack::uptr next () override;
   std::string name () const override;
-  void reset () override;
+  void do_reset () override;
 };
 
 class op_f_debug
@@ -486,7 +618,7 @@ public:
 
   stack::uptr next () override;
   std::string name () const override;
-  void reset () override;
+  void do_reset () override;
 };
 
 class op_scope
@@ -503,7 +635,7 @@ public:
   ~op_scope ();
 
   stack::uptr next () override;
-  void reset () override;
+  void do_reset () override;
   std::string name () const override;
 };
 
@@ -522,7 +654,7 @@ public:
   {}
 
   stack::uptr next () override;
-  void reset () override;
+  void do_reset () override;
   std::string name () const override;
 };
 
@@ -537,7 +669,7 @@ public:
   ~op_read ();
 
   stack::uptr next () override;
-  void reset () override;
+  void do_reset () override;
   std::string name () const override;
 };
 
@@ -546,15 +678,15 @@ class op_lex_closure
   : public op
 {
   std::shared_ptr <op> m_upstream;
-  tree m_t;
+  std::shared_ptr <tree const> m_t;
 
 public:
   op_lex_closure (std::shared_ptr <op> upstream, tree t)
     : m_upstream {upstream}
-    , m_t {t}
+    , m_t {std::make_shared <tree> (std::move (t))}
   {}
 
-  void reset () override;
+  void do_reset () override;
   stack::uptr next () override;
   std::string name () const override;
 };
@@ -576,7 +708,7 @@ public:
 
   ~op_ifelse ();
 
-  void reset () override;
+  void do_reset () override;
   stack::uptr next () override;
   std::string name () const override;
 };
@@ -685,4 +817,49 @@ public:
   void reset () override;
 };
 
+class value_test_not
+  : public value_test
+{
+  std::unique_ptr <value_test> m_a;
+
+public:
+  explicit value_test_not (std::unique_ptr <value_test> a)
+    : m_a {std::move (a)}
+  {}
+
+  pred_result result (value &val) override;
+};
+
+class value_test_and
+  : public value_test
+{
+  std::unique_ptr <value_test> m_a;
+  std::unique_ptr <value_test> m_b;
+
+public:
+  value_test_and (std::unique_ptr <value_test> a,
+		  std::unique_ptr <value_test> b)
+    : m_a {std::move (a)}
+    , m_b {std::move (b)}
+  {}
+
+  pred_result result (value &val) override;
+};
+
+class value_test_or
+  : public value_test
+{
+  std::unique_ptr <value_test> m_a;
+  std::unique_ptr <value_test> m_b;
+
+public:
+  value_test_or (std::unique_ptr <value_test> a,
+		 std::unique_ptr <value_test> b)
+    : m_a {std::move (a)}
+    , m_b {std::move (b)}
+  {}
+
+  pred_result result (value &val) override;
+};
+
 #endif /* _OP_H_ */
@@ -151,6 +151,7 @@ struct overload_op::pimpl
   std::shared_ptr <op> m_upstream;
   overload_instance m_ovl_inst;
   std::shared_ptr <op> m_op;
+  batch_reader m_reader;
 
   void
   reset_me ()
@@ -158,6 +159,20 @@ struct overload_op::pimpl
     m_op = nullptr;
   }
 
+  void
+  dispatch (op &self, stack::uptr stk)
+  {
+    auto ovl = m_ovl_inst.find_exec (*stk);
+    if (std::get <0> (ovl) == nullptr)
+      m_ovl_inst.show_error (self.name (), selector {*stk});
+    else
+      {
+	m_op = std::get <1> (ovl);
+	m_op->reset ();
+	std::get <0> (ovl)->set_next (std::move (stk));
+      }
+  }
+
   pimpl (std::shared_ptr <op> upstream, overload_instance ovl_inst)
     : m_upstream {upstream}
     , m_ovl_inst {ovl_inst}
@@ -172,17 +187,7 @@ struct overload_op::pimpl
 	while (m_op == nullptr)
 	  {
 	    if (auto stk = m_upstream->next ())
-	      {
-		auto ovl = m_ovl_inst.find_exec (*stk);
-		if (std::get <0> (ovl) == nullptr)
-		  m_ovl_inst.show_error (self.name (), selector {*stk});
-		else
-		  {
-		    m_op = std::get <1> (ovl);
-		    m_op->reset ();
-		    std::get <0> (ovl)->set_next (std::move (stk));
-		  }
-	      }
+	      dispatch (self, std::move (stk));
 	    else
 	      return nullptr;
 	  }
@@ -194,10 +199,36 @@ struct overload_op::pimpl
       }
   }
 
+  // The selected overload only ever sees one stack at a time, so
+  // batching happens on the upstream side: inputs are drawn from a
+  // batch, and the overload's outputs are collected into OUT.
+  bool
+  fill_batch (op &self, stack_batch &out, size_t n)
+  {
+    for (size_t i = 0; i < n; )
+      if (m_op == nullptr)
+	{
+	  if (auto stk = m_reader.next (*m_upstream))
+	    dispatch (self, std::move (stk));
+	  else
+	    return false;
+	}
+      else if (auto stk = m_op->next ())
+	{
+	  out.push_back (std::move (stk));
+	  ++i;
+	}
+      else
+	reset_me ();
+
+    return true;
+  }
+
   void
   reset ()
   {
     reset_me ();
+    m_reader.reset ();
     m_upstream->reset ();
   }
 };
@@ -216,8 +247,14 @@ overload_op::next ()
   return m_pimpl->next (*this);
 }
 
+bool
+overload_op::fill_batch (stack_batch &out, size_t n)
+{
+  return m_pimpl->fill_batch (*this, out, n);
+}
+
 void
-overload_op::reset ()
+overload_op::do_reset ()
 {
   return m_pimpl->reset ();
 }
@@ -276,6 +313,102 @@ overloaded_builtin::docstring () const
   return format_entry_map (doc_deduplicate (entries), '.');
 }
 
+std::shared_ptr <builtin>
+overloaded_builtin::find_overload (value_type vt) const
+{
+  for (auto const &ovl: m_ovl_tab->get_overloads ())
+    {
+      auto types = std::get <0> (ovl).get_types ();
+      if (types.empty ())
+	return std::get <1> (ovl);
+      if (! (types.back () == vt))
+	continue;
+      if (types.size () == 1)
+	return std::get <1> (ovl);
+
+      // Whether this one matches depends on what's below TOS.
+      return nullptr;
+    }
+
+  return nullptr;
+}
+
+namespace
+{
+  // An overloaded builtin pegged to one of its overloads.
+  struct pegged_builtin
+    : public builtin
+  {
+    std::shared_ptr <builtin> m_overload;
+    char const *m_name;
+    bool m_positive;
+
+    pegged_builtin (std::shared_ptr <builtin> overload, char const *name,
+		    bool positive)
+      : m_overload {overload}
+      , m_name {name}
+      , m_positive {positive}
+    {}
+
+    std::unique_ptr <pred>
+    build_pred () const override
+    {
+      if (auto pred = m_overload->build_pred ())
+	return maybe_invert (std::move (pred), m_positive);
+      return nullptr;
+    }
+
+    std::shared_ptr <op>
+    build_exec (std::shared_ptr <op> upstream) const override
+    {
+      return m_overload->build_exec (upstream);
+    }
+
+    char const *
+    name () const override
+    {
+      return m_name;
+    }
+
+    std::string
+    docstring () const override
+    {
+      return m_overload->docstring ();
+    }
+
+    builtin_protomap
+    protomap () const override
+    {
+      return m_overload->protomap ();
+    }
+
+    std::shared_ptr <builtin>
+    reduce (tree const *begin, tree const *end) const override
+    {
+      return m_overload->reduce (begin, end);
+    }
+
+    std::unique_ptr <value_test>
+    build_value_test (value_type vt) const override
+    {
+      return maybe_invert (m_overload->build_value_test (vt), m_positive);
+    }
+
+    std::unique_ptr <value_test>
+    build_str_equality_test (value_type vt, std::string const &str)
+      const override
+    {
+      return m_overload->build_str_equality_test (vt, str);
+    }
+
+    std::unique_ptr <value_test>
+    build_acyclic_test () const override
+    {
+      return m_overload->build_acyclic_test ();
+    }
+  };
+}
+
 std::shared_ptr <op>
 overloaded_op_builtin::build_exec (std::shared_ptr <op> upstream) const
 {
@@ -283,12 +416,88 @@ overloaded_op_builtin::build_exec (std::shared_ptr <op> upstream) const
     (upstream, get_overload_tab ()->instantiate (), name ());
 }
 
+std::shared_ptr <builtin>
+overloaded_op_builtin::reduce (tree const *begin, tree const *end) const
+{
+  auto tab = std::make_shared <overload_tab> ();
+  bool reduced = false;
+  for (auto const &ovl: get_overload_tab ()->get_overloads ())
+    if (auto b = std::get <1> (ovl)->reduce (begin, end))
+      {
+	tab->add_overload (std::get <0> (ovl), b);
+	reduced = true;
+      }
+    else
+      tab->add_overload (std::get <0> (ovl), std::get <1> (ovl));
+
+  if (! reduced)
+    return nullptr;
+
+  return std::make_shared <overloaded_op_builtin> (name (), tab);
+}
+
 std::shared_ptr <overloaded_builtin>
 overloaded_op_builtin::create_merged (std::shared_ptr <overload_tab> tab) const
 {
   return std::make_shared <overloaded_op_builtin> (name (), tab);
 }
 
+std::shared_ptr <builtin>
+overloaded_op_builtin::peg (std::shared_ptr <builtin> overload) const
+{
+  return std::make_shared <pegged_builtin> (overload, name (), true);
+}
+
+std::unique_ptr <value_test>
+overloaded_op_builtin::build_str_equality_test (value_type vt,
+						std::string const &str) const
+{
+  if (auto b = find_overload (vt))
+    return b->build_str_equality_test (vt, str);
+  return nullptr;
+}
+
+namespace
+{
+  struct acyclic_dispatch_test
+    : public value_test
+  {
+    std::vector <std::pair <value_type, std::unique_ptr <value_test>>> m_tests;
+
+    pred_result
+    result (value &val) override
+    {
+      for (auto &t: m_tests)
+	if (t.first == val.get_type ())
+	  return t.second->result (val);
+      return pred_result::no;
+    }
+  };
+}
+
+std::unique_ptr <value_test>
+overloaded_op_builtin::build_acyclic_test () const
+{
+  auto ret = std::make_unique <acyclic_dispatch_test> ();
+  for (auto const &ovl: get_overload_tab ()->get_overloads ())
+    {
+      // Only consider overloads that values of that type surely
+      // dispatch to.
+      auto types = std::get <0> (ovl).get_types ();
+      if (types.size () != 1
+	  || find_overload (types.back ()) != std::get <1> (ovl))
+	continue;
+
+      if (auto test = std::get <1> (ovl)->build_acyclic_test ())
+	ret->m_tests.push_back (std::make_pair (types.back (),
+						std::move (test)));
+    }
+
+  if (ret->m_tests.empty ())
+    return nullptr;
+  return std::move (ret);
+}
+
 namespace
 {
   struct named_overload_pred
@@ -323,3 +532,17 @@ overloaded_pred_builtin::create_merged
 {
   return std::make_shared <overloaded_pred_builtin> (name (), tab, m_positive);
 }
+
+std::shared_ptr <builtin>
+overloaded_pred_builtin::peg (std::shared_ptr <builtin> overload) const
+{
+  return std::make_shared <pegged_builtin> (overload, name (), m_positive);
+}
+
+std::unique_ptr <value_test>
+overloaded_pred_builtin::build_value_test (value_type vt) const
+{
+  if (auto b = find_overload (vt))
+    return maybe_invert (b->build_value_test (vt), m_positive);
+  return nullptr;
+}
@@ -31,6 +31,7 @@
 
 #include <vector>
 #include <tuple>
+#include <functional>
 #include "std-memory.hh"
 #include "std-utility.hh"
 #include <iostream>
@@ -113,12 +114,15 @@ class overload_op
   class pimpl;
   std::unique_ptr <pimpl> m_pimpl;
 
+protected:
+  bool fill_batch (stack_batch &out, size_t n) override final;
+
 public:
   overload_op (std::shared_ptr <op> upstream, overload_instance ovl_inst);
   ~overload_op ();
 
   stack::uptr next () override final;
-  void reset () override final;
+  void do_reset () override final;
 };
 
 class overload_pred
@@ -165,6 +169,19 @@ public:
 
   virtual std::shared_ptr <overloaded_builtin>
   create_merged (std::shared_ptr <overload_tab> tab) const = 0;
+
+  // Return a builtin that does what this one does for values that
+  // OVERLOAD, one of the overloads from the table, handles.  It
+  // keeps the name of this builtin.  This is used for pegging
+  // overloads when types of values are known statically, see
+  // peg_overloads.
+  virtual std::shared_ptr <builtin>
+  peg (std::shared_ptr <builtin> overload) const = 0;
+
+  // Return the overload that would be picked for a stack whose TOS
+  // is of type VT, or nullptr if that depends on values deeper in the
+  // stack, or if there's no such overload.
+  std::shared_ptr <builtin> find_overload (value_type vt) const;
 };
 
 // Base class for overloaded operation builtins.
@@ -176,8 +193,25 @@ struct overloaded_op_builtin
   std::shared_ptr <op> build_exec (std::shared_ptr <op> upstream)
     const override final;
 
+  // Reduces those overloads that can be reduced.  Dispatch is still
+  // done at run time, so values that the reduced overloads don't
+  // handle get the regular treatment.
+  std::shared_ptr <builtin> reduce (tree const *begin, tree const *end)
+    const override final;
+
   std::shared_ptr <overloaded_builtin>
   create_merged (std::shared_ptr <overload_tab> tab) const override final;
+
+  std::shared_ptr <builtin>
+  peg (std::shared_ptr <builtin> overload) const override final;
+
+  std::unique_ptr <value_test>
+  build_str_equality_test (value_type vt, std::string const &str)
+    const override final;
+
+  // Holds for values that dispatch to an overload whose own acyclic
+  // test holds for them.
+  std::unique_ptr <value_test> build_acyclic_test () const override final;
 };
 
 // Base class for overloaded predicate builtins.
@@ -196,6 +230,12 @@ struct overloaded_pred_builtin
 
   std::shared_ptr <overloaded_builtin>
   create_merged (std::shared_ptr <overload_tab> tab) const override final;
+
+  std::shared_ptr <builtin>
+  peg (std::shared_ptr <builtin> overload) const override final;
+
+  std::unique_ptr <value_test>
+  build_value_test (value_type vt) const override final;
 };
 
 
@@ -216,6 +256,107 @@ struct overload_op_builder_impl
   }
 };
 
+// Overloads can expose reduction points (see builtin::reduce) by
+// providing a static member function like this:
+//
+//   static std::shared_ptr <builtin> reduce (tree const *begin,
+//					      tree const *end);
+//
+// The builtin that it returns would typically be created by
+// make_reduced_overload below.
+
+template <class Op>
+auto
+overload_reduce (tree const *begin, tree const *end, int)
+  -> decltype (Op::reduce (begin, end))
+{
+  return Op::reduce (begin, end);
+}
+
+template <class Op>
+std::shared_ptr <builtin>
+overload_reduce (tree const *begin, tree const *end, long)
+{
+  return nullptr;
+}
+
+// Likewise, overloads can take part in fusion of comparisons (see
+// builtin::build_str_equality_test) by providing this:
+//
+//   static std::unique_ptr <value_test>
+//	build_str_equality_test (std::string const &str);
+
+template <class Op>
+auto
+overload_str_equality_test (std::string const &str, int)
+  -> decltype (Op::build_str_equality_test (str))
+{
+  return Op::build_str_equality_test (str);
+}
+
+template <class Op>
+std::unique_ptr <value_test>
+overload_str_equality_test (std::string const &str, long)
+{
+  return nullptr;
+}
+
+// And overloads that are known not to loop when closed over (see
+// builtin::build_acyclic_test) provide this:
+//
+//   static std::unique_ptr <value_test> build_acyclic_test ();
+
+template <class Op>
+auto
+overload_acyclic_test (int)
+  -> decltype (Op::build_acyclic_test ())
+{
+  return Op::build_acyclic_test ();
+}
+
+template <class Op>
+std::unique_ptr <value_test>
+overload_acyclic_test (long)
+{
+  return nullptr;
+}
+
+struct reduced_overload_builtin
+  : public builtin
+{
+  std::function <std::shared_ptr <op> (std::shared_ptr <op>)> m_build;
+
+  explicit reduced_overload_builtin
+	(std::function <std::shared_ptr <op> (std::shared_ptr <op>)> build)
+    : m_build {build}
+  {}
+
+  std::shared_ptr <op>
+  build_exec (std::shared_ptr <op> upstream) const override final
+  {
+    return m_build (upstream);
+  }
+
+  char const *
+  name () const override final
+  {
+    return "overload";
+  }
+};
+
+// Create a builtin whose build_exec constructs Op with the given
+// arguments.
+template <class Op, class... Args>
+std::shared_ptr <builtin>
+make_reduced_overload (Args... args)
+{
+  return std::make_shared <reduced_overload_builtin>
+    ([args...] (std::shared_ptr <op> upstream) -> std::shared_ptr <op>
+     {
+       return std::make_shared <Op> (upstream, args...);
+     });
+}
+
 template <class Op, class... Args>
 void
 overload_tab::add_op_overload (Args &&... args)
@@ -253,6 +394,27 @@ overload_tab::add_op_overload (Args &&... args)
     {
       return Op::protomap ();
     }
+
+    std::shared_ptr <builtin>
+    reduce (tree const *begin, tree const *end) const override
+    {
+      return overload_reduce <Op> (begin, end, 0);
+    }
+
+    std::unique_ptr <value_test>
+    build_str_equality_test (value_type vt, std::string const &str)
+      const override
+    {
+      if (Op::get_selector () != selector {vt})
+	return nullptr;
+      return overload_str_equality_test <Op> (str, 0);
+    }
+
+    std::unique_ptr <value_test>
+    build_acyclic_test () const override
+    {
+      return overload_acyclic_test <Op> (0);
+    }
   };
 
   add_overload (Op::get_selector (),
@@ -315,6 +477,14 @@ overload_tab::add_pred_overload (Args &&... args)
     {
       return Pred::protomap ();
     }
+
+    std::unique_ptr <value_test>
+    build_value_test (value_type vt) const override
+    {
+      auto p = build_pred ();
+      Pred *pp = static_cast <Pred *> (p.get ());
+      return make_pred_overload_test (vt, pp, std::move (p));
+    }
   };
 
   add_overload (Pred::get_selector (),
@@ -397,6 +567,25 @@ struct op_overload
     return operate (std::move (std::get <I> (args))...);
   }
 
+  stack_batch m_batch;
+
+protected:
+  bool
+  fill_batch (stack_batch &out, size_t n) override final
+  {
+    m_batch.clear ();
+    bool more = this->m_upstream->next_batch (m_batch, n);
+    for (auto &stk: m_batch)
+      if (auto nv = call_operate
+		(std::index_sequence_for <VT...> {},
+		 op_overload_impl <VT...>::template collect <0, VT...> (*stk)))
+	{
+	  stk->push (std::move (nv));
+	  out.push_back (std::move (stk));
+	}
+    return more;
+  }
+
 public:
   op_overload (std::shared_ptr <op> upstream)
     : stub_op {upstream}
@@ -441,6 +630,25 @@ struct op_once_overload
     return operate (std::move (std::get <I> (args))...);
   }
 
+  stack_batch m_batch;
+
+protected:
+  bool
+  fill_batch (stack_batch &out, size_t n) override final
+  {
+    m_batch.clear ();
+    bool more = this->m_upstream->next_batch (m_batch, n);
+    for (auto &stk: m_batch)
+      {
+	auto ret = call_operate
+		(std::index_sequence_for <VT...> {},
+		 op_overload_impl <VT...>::template collect <0, VT...> (*stk));
+	stk->push (std::make_unique <RT> (std::move (ret)));
+	out.push_back (std::move (stk));
+      }
+    return more;
+  }
+
 public:
   op_once_overload (std::shared_ptr <op> upstream)
     : stub_op {upstream}
@@ -487,6 +695,7 @@ class op_yielding_overload
 
   stack::uptr m_stk;
   std::unique_ptr <value_producer <RT>> m_prod;
+  batch_reader m_reader;
 
   void
   reset_me ()
@@ -495,6 +704,35 @@ class op_yielding_overload
     m_stk = nullptr;
   }
 
+protected:
+  bool
+  fill_batch (stack_batch &out, size_t n) override final
+  {
+    for (size_t i = 0; i < n; )
+      if (m_prod == nullptr)
+	{
+	  auto stk = m_reader.next (*this->m_upstream);
+	  if (stk == nullptr)
+	    return false;
+
+	  m_prod = call_operate
+	    (std::index_sequence_for <VT...> {},
+	     op_overload_impl <VT...>::template collect <0, VT...> (*stk));
+	  m_stk = std::move (stk);
+	}
+      else if (auto v = m_prod->next ())
+	{
+	  auto ret = std::make_unique <stack> (*m_stk);
+	  ret->push (std::move (v));
+	  out.push_back (std::move (ret));
+	  ++i;
+	}
+      else
+	reset_me ();
+
+    return true;
+  }
+
 public:
   op_yielding_overload (std::shared_ptr <op> upstream)
     : stub_op {upstream}
@@ -528,10 +766,11 @@ public:
   }
 
   void
-  reset () override
+  do_reset () override
   {
     reset_me ();
-    stub_op::reset ();
+    m_reader.reset ();
+    stub_op::do_reset ();
   }
 
   virtual std::unique_ptr <value_producer <RT>>
@@ -605,4 +844,47 @@ public:
   { return ""; }
 };
 
+// A predicate overload on a single value, used as a value_test (see
+// builtin::build_value_test).
+template <class VT>
+class pred_overload_test
+  : public value_test
+{
+  std::unique_ptr <pred> m_owner;
+  pred_overload <VT> *m_pred;
+
+public:
+  pred_overload_test (std::unique_ptr <pred> owner, pred_overload <VT> *p)
+    : m_owner {std::move (owner)}
+    , m_pred {p}
+  {}
+
+  pred_result
+  result (value &val) override
+  {
+    assert (val.is <VT> ());
+    return m_pred->result (static_cast <VT &> (val));
+  }
+};
+
+// Make a value_test out of P, which OWNER holds, if P is a predicate
+// on a single value of type VT.  Otherwise return nullptr.
+template <class VT>
+std::unique_ptr <value_test>
+make_pred_overload_test (value_type vt, pred_overload <VT> *p,
+			 std::unique_ptr <pred> owner)
+{
+  if (! (VT::vtype == vt))
+    return nullptr;
+  return std::make_unique <pred_overload_test <VT>> (std::move (owner), p);
+}
+
+template <class... VT>
+std::unique_ptr <value_test>
+make_pred_overload_test (value_type vt, pred_overload <VT...> *p,
+			 std::unique_ptr <pred> owner)
+{
+  return nullptr;
+}
+
 #endif /* _OVERLOAD_H_ */
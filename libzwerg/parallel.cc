@@ -0,0 +1,352 @@
+/*
+   Copyright (C) 2014 Red Hat, Inc.
+   This file is part of dwgrep.
+
+   This file is free software; you can redistribute it and/or modify
+   it under the terms of either
+
+     * the GNU Lesser General Public License as published by the Free
+       Software Foundation; either version 3 of the License, or (at
+       your option) any later version
+
+   or
+
+     * the GNU General Public License as published by the Free
+       Software Foundation; either version 2 of the License, or (at
+       your option) any later version
+
+   or both in parallel, as here.
+
+   dwgrep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received copies of the GNU General Public License and
+   the GNU Lesser General Public License along with this program.  If
+   not, see <http://www.gnu.org/licenses/>.  */
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+#include "dwmods.hh"
+#include "parallel.hh"
+#include "planner.hh"
+#include "value-dw.hh"
+
+struct op_parallel::pimpl
+{
+  // Results of evaluating the query over one seed.
+  struct chunk
+  {
+    std::vector <stack::uptr> m_results;
+    std::exception_ptr m_exc;
+    bool m_done;
+
+    chunk ()
+      : m_done {false}
+    {}
+  };
+
+  tree m_tree;
+  std::vector <stack::uptr> m_seeds;
+  unsigned m_nthreads;
+  bool m_ordered;
+
+  std::vector <std::thread> m_workers;
+  std::mutex m_mutex;
+  std::condition_variable m_cv_done;
+  std::condition_variable m_cv_space;
+  std::atomic <bool> m_cancel;
+
+  // All of the following is guarded by m_mutex.
+  std::vector <chunk> m_chunks;
+  std::deque <size_t> m_finished;
+  size_t m_claimed;
+  size_t m_consumed;
+
+  // Chunk whose results are currently being yielded, and the
+  // position therein.  Only touched by the consumer.
+  size_t m_cur;
+  size_t m_pos;
+  bool m_active;
+  bool m_started;
+
+  pimpl (tree const &t, std::vector <stack::uptr> seeds,
+	 unsigned nthreads, bool ordered)
+    : m_tree {t}
+    , m_seeds {std::move (seeds)}
+    , m_nthreads {nthreads}
+    , m_ordered {ordered}
+    , m_cancel {false}
+  {
+    if (m_nthreads == 0)
+      m_nthreads = std::max (std::thread::hardware_concurrency (), 1u);
+    reset_me ();
+  }
+
+  ~pimpl ()
+  {
+    stop ();
+  }
+
+  void
+  reset_me ()
+  {
+    m_chunks.clear ();
+    m_chunks.resize (m_seeds.size ());
+    m_finished.clear ();
+    m_claimed = 0;
+    m_consumed = 0;
+    m_cur = 0;
+    m_pos = 0;
+    m_active = false;
+    m_started = false;
+  }
+
+  // Number of seeds that can be evaluated ahead of the consumer.
+  size_t
+  window () const
+  {
+    return 4 * m_nthreads;
+  }
+
+  void
+  work ()
+  {
+    while (true)
+      {
+	size_t i;
+	{
+	  std::unique_lock <std::mutex> lock {m_mutex};
+	  m_cv_space.wait (lock, [this] () {
+	      return m_cancel || m_claimed >= m_seeds.size ()
+		|| m_claimed < m_consumed + window ();
+	    });
+	  if (m_cancel || m_claimed >= m_seeds.size ())
+	    return;
+	  i = m_claimed++;
+	}
+
+	chunk c;
+	try
+	  {
+	    auto origin = std::make_shared <op_origin>
+	      (std::make_unique <stack> (*m_seeds[i]));
+	    auto op = m_tree.build_exec (origin);
+	    while (! m_cancel && op->next_batch (c.m_results))
+	      ;
+	  }
+	catch (...)
+	  {
+	    c.m_exc = std::current_exception ();
+	  }
+
+	{
+	  std::lock_guard <std::mutex> lock {m_mutex};
+	  m_chunks[i] = std::move (c);
+	  m_chunks[i].m_done = true;
+	  m_finished.push_back (i);
+	}
+	m_cv_done.notify_all ();
+      }
+  }
+
+  void
+  start ()
+  {
+    m_cancel = false;
+    unsigned n = std::min <size_t> (m_nthreads, m_seeds.size ());
+    for (unsigned i = 0; i < n; ++i)
+      m_workers.push_back (std::thread {[this] () { work (); }});
+    m_started = true;
+  }
+
+  void
+  stop ()
+  {
+    {
+      std::lock_guard <std::mutex> lock {m_mutex};
+      m_cancel = true;
+    }
+    m_cv_space.notify_all ();
+    for (auto &w: m_workers)
+      w.join ();
+    m_workers.clear ();
+  }
+
+  // Pick the chunk to yield results from next and wait until it's
+  // done.  Returns false if there are no more chunks.
+  bool
+  next_chunk ()
+  {
+    std::unique_lock <std::mutex> lock {m_mutex};
+    if (m_active)
+      {
+	m_chunks[m_cur] = chunk {};
+	++m_consumed;
+	m_active = false;
+	m_cv_space.notify_all ();
+      }
+
+    if (m_consumed >= m_seeds.size ())
+      return false;
+
+    if (m_ordered)
+      {
+	m_cur = m_consumed;
+	m_cv_done.wait (lock, [this] () { return m_chunks[m_cur].m_done; });
+      }
+    else
+      {
+	m_cv_done.wait (lock, [this] () { return ! m_finished.empty (); });
+	m_cur = m_finished.front ();
+	m_finished.pop_front ();
+      }
+
+    m_pos = 0;
+    m_active = true;
+    return true;
+  }
+
+  stack::uptr
+  next ()
+  {
+    if (! m_started)
+      start ();
+
+    while (true)
+      {
+	if (m_active)
+	  {
+	    chunk &c = m_chunks[m_cur];
+	    if (m_pos < c.m_results.size ())
+	      return std::move (c.m_results[m_pos++]);
+
+	    // Like in serial evaluation, an error comes after whatever
+	    // the unit produced before it.
+	    if (c.m_exc != nullptr)
+	      {
+		auto exc = c.m_exc;
+		c.m_exc = nullptr;
+		std::rethrow_exception (exc);
+	      }
+	  }
+
+	if (! next_chunk ())
+	  return nullptr;
+      }
+  }
+
+  void
+  reset ()
+  {
+    stop ();
+    reset_me ();
+  }
+};
+
+op_parallel::op_parallel (tree const &t, std::vector <stack::uptr> seeds,
+			  unsigned nthreads, bool ordered)
+  : m_pimpl {std::make_unique <pimpl> (t, std::move (seeds),
+				       nthreads, ordered)}
+{}
+
+op_parallel::~op_parallel ()
+{}
+
+stack::uptr
+op_parallel::next ()
+{
+  return m_pimpl->next ();
+}
+
+std::string
+op_parallel::name () const
+{
+  return "parallel";
+}
+
+void
+op_parallel::do_reset ()
+{
+  m_pimpl->reset ();
+}
+
+
+namespace
+{
+  // Find the word that QUERY starts with, if any.
+  tree *
+  find_head (tree &query)
+  {
+    switch (query.tt ())
+      {
+      case tree_type::SCOPE:
+      case tree_type::CAT:
+	return find_head (query.child (0));
+
+      case tree_type::F_BUILTIN:
+	return &query;
+
+      default:
+	return nullptr;
+      }
+  }
+}
+
+std::shared_ptr <op>
+build_exec_parallel (tree const &query, stack::uptr input,
+		     unsigned nthreads, bool ordered)
+{
+  tree t = query;
+  tree *head = find_head (t);
+  value_dwarf *dw = input->size () > 0 ? input->top_as <value_dwarf> ()
+					: nullptr;
+
+  if (head == nullptr || dw == nullptr
+      || (head->m_builtin->name () != "entry"
+	  && head->m_builtin->name () != "unit"))
+    {
+      peg_overloads (t, *input);
+      if (verify_stack_effects (t, *input))
+	input->uncheck ();
+      return t.build_exec (std::make_shared <op_origin> (std::move (input)));
+    }
+
+  // `entry' on a Dwarf is `unit entry', and `entry' on a unit yields
+  // exactly the DIE's that it would yield for that unit as part of
+  // the whole Dwarf.  So for `entry', the query is kept as is, and
+  // it's just applied to individual units.  For `unit', the head word
+  // is dropped and the rest of the query applied to the units.
+  if (head->m_builtin->name () == "unit")
+    *head = tree {tree_type::NOP};
+
+  // Enumerating the units up front also makes libdw read in all CU
+  // headers before workers start looking at them.
+  std::vector <stack::uptr> seeds;
+  dwarf_unit_producer prod {dw->get_dwctx (), dw->get_doneness ()};
+  input->pop ();
+  while (auto cu = prod.next ())
+    {
+      auto stk = std::make_unique <stack> (*input);
+      stk->push (std::move (cu));
+      seeds.push_back (std::move (stk));
+    }
+
+  // All seeds have the same profile.
+  if (! seeds.empty ())
+    {
+      peg_overloads (t, *seeds.front ());
+      if (verify_stack_effects (t, *seeds.front ()))
+	for (auto &seed: seeds)
+	  seed->uncheck ();
+    }
+
+  return std::make_shared <op_parallel> (t, std::move (seeds),
+					 nthreads, ordered);
+}
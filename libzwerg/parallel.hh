@@ -0,0 +1,78 @@
+/*
+   Copyright (C) 2014 Red Hat, Inc.
+   This file is part of dwgrep.
+
+   This file is free software; you can redistribute it and/or modify
+   it under the terms of either
+
+     * the GNU Lesser General Public License as published by the Free
+       Software Foundation; either version 3 of the License, or (at
+       your option) any later version
+
+   or
+
+     * the GNU General Public License as published by the Free
+       Software Foundation; either version 2 of the License, or (at
+       your option) any later version
+
+   or both in parallel, as here.
+
+   dwgrep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received copies of the GNU General Public License and
+   the GNU Lesser General Public License along with this program.  If
+   not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+#include <memory>
+#include <vector>
+
+#include "op.hh"
+#include "tree.hh"
+
+// Op_parallel evaluates tree T once for each of the seed stacks, each
+// evaluation on its own op graph built through tree::build_exec.  The
+// evaluations are distributed among NTHREADS worker threads.
+//
+// In ordered mode, the results are yielded in the order of seeds, and
+// for each seed in the order that the serial evaluation would produce
+// them.  Results of several seeds ahead may be buffered, but not
+// arbitrarily many.  In unordered mode, results are yielded in the
+// order in which evaluations finish, and only the order within one
+// seed's results is preserved.
+//
+// Exceptions thrown by a worker are rethrown from next () at the
+// point where the corresponding seed's results would be yielded.
+class op_parallel
+  : public op
+{
+  class pimpl;
+  std::unique_ptr <pimpl> m_pimpl;
+
+public:
+  op_parallel (tree const &t, std::vector <stack::uptr> seeds,
+	       unsigned nthreads, bool ordered);
+  ~op_parallel ();
+
+  stack::uptr next () override;
+  std::string name () const override;
+  void do_reset () override;
+};
+
+// Build QUERY for execution over INPUT.  If QUERY starts with `entry'
+// or `unit', and the Dwarf that these would be applied to is on top of
+// INPUT, the query is partitioned per unit and evaluated in parallel
+// by op_parallel.  Otherwise this just builds a serial op graph the
+// way tree::build_exec would.
+//
+// A NTHREADS of 0 means use as many threads as there are hardware
+// threads.
+std::shared_ptr <op> build_exec_parallel (tree const &query, stack::uptr input,
+					  unsigned nthreads, bool ordered);
+
+#endif /* _PARALLEL_H_ */
@@ -0,0 +1,1124 @@
+/*
+   Copyright (C) 2014 Red Hat, Inc.
+   This file is part of dwgrep.
+
+   This file is free software; you can redistribute it and/or modify
+   it under the terms of either
+
+     * the GNU Lesser General Public License as published by the Free
+       Software Foundation; either version 3 of the License, or (at
+       your option) any later version
+
+   or
+
+     * the GNU General Public License as published by the Free
+       Software Foundation; either version 2 of the License, or (at
+       your option) any later version
+
+   or both in parallel, as here.
+
+   dwgrep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received copies of the GNU General Public License and
+   the GNU Lesser General Public License along with this program.  If
+   not, see <http://www.gnu.org/licenses/>.  */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include "op.hh"
+#include "overload.hh"
+#include "planner.hh"
+#include "scope.hh"
+#include "value-closure.hh"
+#include "value-cst.hh"
+#include "value-seq.hh"
+#include "value-str.hh"
+
+bool
+is_filter (tree const &t)
+{
+  switch (t.tt ())
+    {
+    case tree_type::ASSERT:
+      return true;
+
+    case tree_type::F_BUILTIN:
+      return t.m_builtin->build_pred () != nullptr;
+
+    default:
+      return false;
+    }
+}
+
+namespace
+{
+  bool
+  is_builtin (tree const &t, std::initializer_list <char const *> names)
+  {
+    if (t.tt () != tree_type::F_BUILTIN)
+      return false;
+
+    for (char const *name: names)
+      if (strcmp (t.m_builtin->name (), name) == 0)
+	return true;
+
+    return false;
+  }
+
+  std::string const *
+  as_str_literal (tree const &t)
+  {
+    // Before simplification, string literals are still wrapped in
+    // FORMAT.
+    if (t.tt () == tree_type::FORMAT && t.m_children.size () == 1)
+      return as_str_literal (t.child (0));
+    if (t.tt () == tree_type::STR)
+      return &t.str ();
+    return nullptr;
+  }
+
+  constant const *
+  as_index_literal (tree const &t)
+  {
+    if (t.tt () != tree_type::CONST)
+      return nullptr;
+
+    constant const &cst = t.cst ();
+    if (cst.dom () == nullptr || ! cst.dom ()->safe_arith ()
+	|| cst.value () < 0)
+      return nullptr;
+
+    return &cst;
+  }
+
+  // Call CB on each condition that predicate tree P implies, until CB
+  // returns non-null.
+  template <class T, class F>
+  T const *
+  for_each_conjunct (tree const &p, F cb);
+
+  template <class T, class F>
+  T const *
+  for_each_filter_conjunct (tree const &t, F cb)
+  {
+    switch (t.tt ())
+      {
+      case tree_type::ASSERT:
+	return for_each_conjunct <T> (t.child (0), cb);
+
+      case tree_type::CAT:
+	for (auto const &ch: t.m_children)
+	  if (is_filter (ch))
+	    {
+	      if (T const *ret = for_each_filter_conjunct <T> (ch, cb))
+		return ret;
+	    }
+	  else
+	    // ?(X) with X that changes the stack.  Whatever comes
+	    // after this doesn't talk about the value of interest
+	    // anymore.
+	    return nullptr;
+	return nullptr;
+
+      default:
+	return cb (t);
+      }
+  }
+
+  template <class T, class F>
+  T const *
+  for_each_conjunct (tree const &p, F cb)
+  {
+    switch (p.tt ())
+      {
+      case tree_type::PRED_AND:
+	for (auto const &ch: p.m_children)
+	  if (T const *ret = for_each_conjunct <T> (ch, cb))
+	    return ret;
+	return nullptr;
+
+      case tree_type::PRED_SUBX_ANY:
+	// ?(X) may be a condition of its own, or a run of filters.
+	if (T const *ret = cb (p))
+	  return ret;
+	return for_each_filter_conjunct <T> (p.child (0), cb);
+
+      default:
+	return cb (p);
+      }
+  }
+
+  // Strip from T scopes that don't bind anything.
+  tree const &
+  unscope (tree const &t)
+  {
+    if (t.tt () == tree_type::SCOPE && t.scp ()->num_names () == 0)
+      return unscope (t.child (0));
+    return t;
+  }
+
+  // Match [BEGIN, END) against `N ?contains` or `?(N ?contains)`.
+  // Return N.
+  constant const *
+  as_contained_literal (tree const *begin, tree const *end)
+  {
+    if (end - begin == 2 && is_builtin (begin[1], {"?contains"}))
+      return as_index_literal (begin[0]);
+
+    if (end - begin == 1 && begin->tt () == tree_type::ASSERT
+	&& begin->child (0).tt () == tree_type::PRED_SUBX_ANY)
+      {
+	tree const &t = unscope (begin->child (0).child (0));
+	if (t.tt () == tree_type::CAT)
+	  return as_contained_literal (t.m_children.data (),
+				       t.m_children.data ()
+				       + t.m_children.size ());
+      }
+
+    return nullptr;
+  }
+}
+
+std::string const *
+find_str_equality (tree const *begin, tree const *end,
+		   std::initializer_list <char const *> words)
+{
+  auto cb = [&words] (tree const &p) -> std::string const *
+    {
+      if (p.tt () != tree_type::PRED_SUBX_CMP
+	  || ! is_builtin (p.child (2), {"?eq"}))
+	return nullptr;
+
+      for (int i = 0; i < 2; ++i)
+	if (is_builtin (p.child (i), words))
+	  return as_str_literal (p.child (1 - i));
+
+      return nullptr;
+    };
+
+  for (tree const *it = begin; it != end; ++it)
+    if (auto ret = for_each_filter_conjunct <std::string> (*it, cb))
+      return ret;
+
+  return nullptr;
+}
+
+constant const *
+find_cst_equality (tree const *begin, tree const *end,
+		   std::initializer_list <char const *> words)
+{
+  auto cb = [&words] (tree const &p) -> constant const *
+    {
+      if (p.tt () != tree_type::PRED_SUBX_CMP
+	  || ! is_builtin (p.child (2), {"?eq"}))
+	return nullptr;
+
+      for (int i = 0; i < 2; ++i)
+	if (is_builtin (p.child (i), words))
+	  return as_index_literal (p.child (1 - i));
+
+      return nullptr;
+    };
+
+  for (tree const *it = begin; it != end; ++it)
+    if (auto ret = for_each_filter_conjunct <constant> (*it, cb))
+      return ret;
+
+  return nullptr;
+}
+
+bool
+find_cst_upper_bound (tree const *begin, tree const *end,
+		      std::initializer_list <char const *> words,
+		      uint64_t *bound)
+{
+  bool found = false;
+  auto cb = [&] (tree const &p) -> constant const *
+    {
+      if (p.tt () != tree_type::PRED_SUBX_CMP)
+	return nullptr;
+
+      for (int i = 0; i < 2; ++i)
+	if (is_builtin (p.child (i), words))
+	  {
+	    constant const *cst = as_index_literal (p.child (1 - i));
+	    if (cst == nullptr || cst->value () >= mpz_class {UINT64_MAX})
+	      return nullptr;
+
+	    // (WORD < N) and (N > WORD) bound WORD by N, non-strict
+	    // comparisons and equality by N + 1.
+	    char const *strict = i == 0 ? "?lt" : "?gt";
+	    char const *loose = i == 0 ? "!gt" : "!lt";
+	    uint64_t m = cst->value ().uval ();
+	    if (is_builtin (p.child (2), {"?eq", loose}))
+	      ++m;
+	    else if (! is_builtin (p.child (2), {strict}))
+	      return nullptr;
+
+	    if (! found || m < *bound)
+	      *bound = m;
+	    found = true;
+	  }
+
+      return nullptr;
+    };
+
+  for (tree const *it = begin; it != end; ++it)
+    for_each_filter_conjunct <constant> (*it, cb);
+
+  return found;
+}
+
+constant const *
+find_address_containment (tree const *begin, tree const *end)
+{
+  auto cb = [] (tree const &p) -> constant const *
+    {
+      if (p.tt () != tree_type::PRED_SUBX_ANY)
+	return nullptr;
+
+      tree const &t = unscope (p.child (0));
+      if (t.tt () != tree_type::CAT || t.m_children.size () < 2
+	  || ! is_builtin (t.child (0), {"address"}))
+	return nullptr;
+
+      return as_contained_literal (t.m_children.data () + 1,
+				   t.m_children.data () + t.m_children.size ());
+    };
+
+  for (tree const *it = begin; it != end; ++it)
+    if (auto ret = for_each_filter_conjunct <constant> (*it, cb))
+      return ret;
+
+  return nullptr;
+}
+
+builtin const *
+find_pred_builtin (tree const *begin, tree const *end,
+		   std::function <bool (char const *)> match)
+{
+  auto cb = [&match] (tree const &p) -> builtin const *
+    {
+      if (p.tt () == tree_type::F_BUILTIN && match (p.m_builtin->name ()))
+	return &*p.m_builtin;
+      return nullptr;
+    };
+
+  for (tree const *it = begin; it != end; ++it)
+    if (auto ret = for_each_filter_conjunct <builtin> (*it, cb))
+      return ret;
+
+  return nullptr;
+}
+
+void
+for_each_pred_builtin (tree const *begin, tree const *end,
+		       std::function <void (builtin const &)> cb)
+{
+  auto cb2 = [&cb] (tree const &p) -> builtin const *
+    {
+      if (p.tt () == tree_type::F_BUILTIN)
+	cb (*p.m_builtin);
+      return nullptr;
+    };
+
+  for (tree const *it = begin; it != end; ++it)
+    for_each_filter_conjunct <builtin> (*it, cb2);
+}
+
+int
+find_pred_after_steps (tree const *begin, tree const *end,
+		       char const *step,
+		       std::function <bool (char const *)> match)
+{
+  int ret = -1;
+  auto found = [&ret] (int n)
+    {
+      if (ret < 0 || n < ret)
+	ret = n;
+    };
+
+  auto cb = [&] (tree const &p) -> tree const *
+    {
+      if (p.tt () == tree_type::F_BUILTIN && match (p.m_builtin->name ()))
+	found (0);
+
+      else if (p.tt () == tree_type::PRED_SUBX_ANY)
+	{
+	  tree const &t = unscope (p.child (0));
+	  if (t.tt () != tree_type::CAT || t.m_children.size () < 2)
+	    return nullptr;
+
+	  size_t n = t.m_children.size () - 1;
+	  for (size_t i = 0; i < n; ++i)
+	    if (! is_builtin (t.child (i), {step}))
+	      return nullptr;
+
+	  tree const &last = t.child (n);
+	  if (last.tt () == tree_type::F_BUILTIN
+	      && last.m_builtin->build_pred () != nullptr
+	      && match (last.m_builtin->name ()))
+	    found (n);
+	}
+
+      return nullptr;
+    };
+
+  for (tree const *it = begin; it != end; ++it)
+    for_each_filter_conjunct <tree> (*it, cb);
+
+  return ret;
+}
+
+namespace
+{
+  // A run of fused filters.  Like a chain of op_assert's, this
+  // stops at the first one that doesn't hold.
+  class value_test_seq
+    : public value_test
+  {
+    std::vector <std::unique_ptr <value_test>> m_tests;
+
+  public:
+    void
+    add (std::unique_ptr <value_test> test)
+    {
+      m_tests.push_back (std::move (test));
+    }
+
+    pred_result
+    result (value &val) override
+    {
+      for (auto const &test: m_tests)
+	{
+	  pred_result r = test->result (val);
+	  if (r != pred_result::yes)
+	    return r;
+	}
+      return pred_result::yes;
+    }
+  };
+
+  std::unique_ptr <value_test> fuse_filter (tree const &t, value_type vt);
+
+  std::unique_ptr <value_test>
+  fuse_pred (tree const &p, value_type vt)
+  {
+    switch (p.tt ())
+      {
+      case tree_type::PRED_NOT:
+	if (auto a = fuse_pred (p.child (0), vt))
+	  return std::make_unique <value_test_not> (std::move (a));
+	return nullptr;
+
+      case tree_type::PRED_AND:
+      case tree_type::PRED_OR:
+	{
+	  auto a = fuse_pred (p.child (0), vt);
+	  auto b = fuse_pred (p.child (1), vt);
+	  if (a == nullptr || b == nullptr)
+	    return nullptr;
+	  if (p.tt () == tree_type::PRED_AND)
+	    return std::make_unique <value_test_and> (std::move (a),
+						      std::move (b));
+	  return std::make_unique <value_test_or> (std::move (a),
+						   std::move (b));
+	}
+
+      case tree_type::PRED_SUBX_ANY:
+	return fuse_filter (p.child (0), vt);
+
+      case tree_type::PRED_SUBX_CMP:
+	if (! is_builtin (p.child (2), {"?eq"}))
+	  return nullptr;
+
+	for (int i = 0; i < 2; ++i)
+	  if (p.child (i).tt () == tree_type::F_BUILTIN)
+	    if (auto str = as_str_literal (p.child (1 - i)))
+	      return p.child (i).m_builtin->build_str_equality_test (vt, *str);
+
+	return nullptr;
+
+      case tree_type::F_BUILTIN:
+	return p.m_builtin->build_value_test (vt);
+
+      default:
+	return nullptr;
+      }
+  }
+
+  std::unique_ptr <value_test>
+  fuse_filter (tree const &t, value_type vt)
+  {
+    switch (t.tt ())
+      {
+      case tree_type::ASSERT:
+	return fuse_pred (t.child (0), vt);
+
+      case tree_type::F_BUILTIN:
+	return t.m_builtin->build_value_test (vt);
+
+      case tree_type::SCOPE:
+	// ?(X) wraps X in a scope, which only matters if X binds
+	// variables.
+	if (t.scp ()->num_names () != 0)
+	  return nullptr;
+	return fuse_filter (t.child (0), vt);
+
+      case tree_type::CAT:
+	{
+	  if (t.m_children.empty ())
+	    return nullptr;
+
+	  auto ret = std::make_unique <value_test_seq> ();
+	  for (auto const &ch: t.m_children)
+	    if (auto test = fuse_filter (ch, vt))
+	      ret->add (std::move (test));
+	    else
+	      return nullptr;
+	  return std::move (ret);
+	}
+
+      default:
+	return nullptr;
+      }
+  }
+}
+
+std::unique_ptr <value_test>
+fuse_filters (tree const *begin, tree const *end, value_type vt,
+	      tree const **fused_end)
+{
+  auto ret = std::make_unique <value_test_seq> ();
+  tree const *it = begin;
+  for (; it != end; ++it)
+    if (auto test = fuse_filter (*it, vt))
+      ret->add (std::move (test));
+    else
+      break;
+
+  if (it == begin)
+    return nullptr;
+
+  *fused_end = it;
+  return std::move (ret);
+}
+
+namespace
+{
+  // What is statically known about a stack: types of the values near
+  // TOS, back () being TOS.  Values deeper than that, as well as
+  // those whose type is value::vtype, are of unknown type.
+  using stack_profile = std::vector <value_type>;
+
+  stack_profile
+  push (stack_profile prof, value_type vt)
+  {
+    prof.push_back (vt);
+    return prof;
+  }
+
+  stack_profile
+  pop (stack_profile prof, size_t n)
+  {
+    prof.erase (prof.end () - std::min (n, prof.size ()), prof.end ());
+    return prof;
+  }
+
+  // What's known about a stack that is either A or B.
+  stack_profile
+  join (stack_profile const &a, stack_profile const &b)
+  {
+    size_t n = std::min (a.size (), b.size ());
+    stack_profile ret;
+    for (size_t i = 0; i < n; ++i)
+      {
+	value_type vta = a[a.size () - n + i];
+	value_type vtb = b[b.size () - n + i];
+	ret.push_back (vta == vtb ? vta : value::vtype);
+      }
+    return ret;
+  }
+
+  enum class sel_match
+    {
+      no,
+      maybe,
+      yes,
+    };
+
+  sel_match
+  match_selector (selector const &sel, stack_profile const &prof)
+  {
+    auto types = sel.get_types ();
+    sel_match ret = sel_match::yes;
+    for (size_t i = 0; i < types.size (); ++i)
+      {
+	size_t depth = types.size () - 1 - i;
+	if (depth >= prof.size ()
+	    || prof[prof.size () - 1 - depth] == value::vtype)
+	  ret = sel_match::maybe;
+	else if (prof[prof.size () - 1 - depth] != types[i])
+	  return sel_match::no;
+      }
+    return ret;
+  }
+
+  // Stack shuffling words work with values of any type, which
+  // protomaps can't express.  For each, the number of values that it
+  // takes, and which of those (0 being the deepest one) it leaves on
+  // stack in what order.
+  struct shuffler
+  {
+    char const *name;
+    size_t in;
+    std::vector <size_t> out;
+  };
+
+  std::vector <shuffler> const shufflers = {
+    {"drop", 1, {}},
+    {"dup", 1, {0, 0}},
+    {"swap", 2, {1, 0}},
+    {"over", 2, {0, 1, 0}},
+    {"rot", 3, {1, 2, 0}},
+  };
+
+  // What's known about the stack after builtin B runs on a stack
+  // described by PROF.
+  stack_profile
+  apply_builtin (builtin const &b, stack_profile const &prof)
+  {
+    if (b.build_pred () != nullptr)
+      return prof;
+
+    for (auto const &shf: shufflers)
+      if (strcmp (b.name (), shf.name) == 0)
+	{
+	  stack_profile in;
+	  for (size_t i = 0; i < shf.in; ++i)
+	    in.push_back (i + prof.size () < shf.in ? value::vtype
+			  : prof[prof.size () - shf.in + i]);
+
+	  stack_profile ret = pop (prof, shf.in);
+	  for (size_t i: shf.out)
+	    ret.push_back (in[i]);
+	  return ret;
+	}
+
+    auto pm = b.protomap ();
+    if (pm.size () != 1)
+      return {};
+
+    auto const &proto = pm.front ();
+    stack_profile ret = pop (prof, std::get <0> (proto).size ());
+    for (auto vt: std::get <2> (proto))
+      ret.push_back (vt);
+    return ret;
+  }
+
+  // Peg builtin in T if it's overloaded and the types allow.  Return
+  // what's known about the stack after T runs.
+  stack_profile
+  peg_builtin (tree &t, stack_profile const &prof)
+  {
+    auto ob = std::dynamic_pointer_cast <overloaded_builtin const>
+      (t.m_builtin);
+    if (ob == nullptr)
+      return apply_builtin (*t.m_builtin, prof);
+
+    // Overloads are tried in order, and the first one that matches is
+    // picked.  Those that may match contribute to what's known about
+    // the result.  Stacks that no overload matches are dropped.
+    std::vector <stack_profile> outs;
+    bool only_candidate = true;
+    for (auto const &ovl: ob->get_overload_tab ()->get_overloads ())
+      {
+	sel_match m = match_selector (std::get <0> (ovl), prof);
+	if (m == sel_match::no)
+	  continue;
+
+	outs.push_back (apply_builtin (*std::get <1> (ovl), prof));
+	if (m == sel_match::yes)
+	  {
+	    if (only_candidate)
+	      t.m_builtin = ob->peg (std::get <1> (ovl));
+	    break;
+	  }
+	only_candidate = false;
+      }
+
+    if (outs.empty ())
+      return {};
+
+    stack_profile ret = outs.front ();
+    for (auto const &out: outs)
+      ret = join (ret, out);
+    return ret;
+  }
+
+  stack_profile peg (tree &t, stack_profile const &prof);
+
+  void
+  peg_pred (tree &t, stack_profile const &prof)
+  {
+    switch (t.tt ())
+      {
+      case tree_type::PRED_AND:
+      case tree_type::PRED_OR:
+      case tree_type::PRED_NOT:
+	for (auto &ch: t.m_children)
+	  peg_pred (ch, prof);
+	return;
+
+      case tree_type::PRED_SUBX_ANY:
+	peg (t.child (0), prof);
+	return;
+
+      case tree_type::PRED_SUBX_CMP:
+	{
+	  // The predicate sees the stack that the first expression
+	  // yields, with TOS of what the second one yields on top.
+	  stack_profile a = peg (t.child (0), prof);
+	  stack_profile b = peg (t.child (1), prof);
+	  peg_pred (t.child (2), push (a, b.empty () ? value::vtype
+					   : b.back ()));
+	  return;
+	}
+
+      case tree_type::F_BUILTIN:
+	peg_builtin (t, prof);
+	return;
+
+      default:
+	return;
+      }
+  }
+
+  stack_profile
+  peg (tree &t, stack_profile const &prof)
+  {
+    switch (t.tt ())
+      {
+      case tree_type::CAT:
+	{
+	  stack_profile ret = prof;
+	  for (auto &ch: t.m_children)
+	    ret = peg (ch, ret);
+	  return ret;
+	}
+
+      case tree_type::ALT:
+      case tree_type::OR:
+	{
+	  stack_profile ret = peg (t.child (0), prof);
+	  for (size_t i = 1; i < t.m_children.size (); ++i)
+	    ret = join (ret, peg (t.child (i), prof));
+	  return ret;
+	}
+
+      case tree_type::CAPTURE:
+	peg (t.child (0), prof);
+	return push (prof, value_seq::vtype);
+
+      case tree_type::EMPTY_LIST:
+	return push (prof, value_seq::vtype);
+
+      case tree_type::SUBX_EVAL:
+	{
+	  size_t keep = t.cst ().value ().uval ();
+	  stack_profile sub = peg (t.child (0), prof);
+	  stack_profile ret = prof;
+	  for (size_t i = 0; i < keep; ++i)
+	    ret.push_back (i + sub.size () < keep ? value::vtype
+			   : sub[sub.size () - keep + i]);
+	  return ret;
+	}
+
+      case tree_type::IFELSE:
+	peg (t.child (0), prof);
+	return join (peg (t.child (1), prof), peg (t.child (2), prof));
+
+      case tree_type::SCOPE:
+	return peg (t.child (0), prof);
+
+      case tree_type::BLOCK:
+	// The closure can be applied to any stack.
+	peg (t.child (0), {});
+	return push (prof, value_closure::vtype);
+
+      case tree_type::BIND:
+	return pop (prof, 1);
+
+      case tree_type::READ:
+	return push (prof, value::vtype);
+
+      case tree_type::CLOSE_STAR:
+	{
+	  // Each iteration gets a stack that the previous one
+	  // produced.  Find what holds for all of them by iterating
+	  // on a scratch copy until nothing changes anymore.  join
+	  // only ever forgets things, so this terminates.
+	  stack_profile ret = prof;
+	  while (true)
+	    {
+	      tree scratch = t.child (0);
+	      stack_profile next = join (ret, peg (scratch, ret));
+	      if (next == ret)
+		break;
+	      ret = next;
+	    }
+
+	  peg (t.child (0), ret);
+	  return ret;
+	}
+
+      case tree_type::NOP:
+      case tree_type::F_DEBUG:
+	return prof;
+
+      case tree_type::ASSERT:
+	peg_pred (t.child (0), prof);
+	return prof;
+
+      case tree_type::CONST:
+	return push (prof, value_cst::vtype);
+
+      case tree_type::STR:
+	return push (prof, value_str::vtype);
+
+      case tree_type::FORMAT:
+	for (auto &ch: t.m_children)
+	  if (ch.tt () != tree_type::STR)
+	    peg (ch, prof);
+	return push (prof, value_str::vtype);
+
+      case tree_type::F_BUILTIN:
+	return peg_builtin (t, prof);
+
+      case tree_type::PRED_AND:
+      case tree_type::PRED_OR:
+      case tree_type::PRED_NOT:
+      case tree_type::PRED_SUBX_ANY:
+      case tree_type::PRED_SUBX_CMP:
+	assert (! "Should never get here.");
+	abort ();
+      }
+
+    abort ();
+  }
+}
+
+void
+peg_overloads (tree &t)
+{
+  peg (t, {});
+}
+
+void
+peg_overloads (tree &t, stack const &input)
+{
+  stack_profile prof;
+  for (size_t i = input.size (); i-- > 0; )
+    prof.push_back (input.get (i).get_type ());
+  peg (t, prof);
+}
+
+namespace
+{
+  size_t const unbounded = SIZE_MAX;
+
+  // Bounds on the number of values on stack.
+  struct stack_depth
+  {
+    size_t lo;
+    size_t hi;
+  };
+
+  stack_depth
+  join (stack_depth a, stack_depth b)
+  {
+    return {std::min (a.lo, b.lo), std::max (a.hi, b.hi)};
+  }
+
+  stack_depth
+  unknown_depth ()
+  {
+    return {0, unbounded};
+  }
+
+  bool
+  has_block (tree const &t)
+  {
+    if (t.tt () == tree_type::BLOCK)
+      return true;
+    for (auto const &ch: t.m_children)
+      if (has_block (ch))
+	return true;
+    return false;
+  }
+
+  class stack_effect_verifier
+  {
+    // Whether there may be closures around.  Reading a variable that
+    // holds a closure applies it, and what that does to stack is not
+    // known.
+    bool m_closures;
+
+    // Whether it's been proven so far that the program doesn't need
+    // a checked stack.
+    bool m_unchecked;
+
+    stack_depth
+    give (stack_depth d, size_t n)
+    {
+      return {d.lo + n,
+	      d.hi == unbounded ? d.hi : d.hi + n};
+    }
+
+    stack_depth
+    take (stack_depth d, size_t n)
+    {
+      // A path where this would certainly underrun may yet never be
+      // taken, e.g. when an assertion before it filters out all
+      // stacks.  Leave the error to the run-time check.
+      if (d.hi < n)
+	{
+	  m_unchecked = false;
+	  return {0, 0};
+	}
+      if (d.lo < n)
+	m_unchecked = false;
+      return {d.lo < n ? 0 : d.lo - n,
+	      d.hi == unbounded ? d.hi : d.hi - n};
+    }
+
+    stack_depth
+    apply_prototype (builtin_prototype const &proto, stack_depth d)
+    {
+      stack_depth ret = take (d, std::get <0> (proto).size ());
+
+      // Predicates leave stack as it was.
+      if (std::get <1> (proto) == yield::pred)
+	return d;
+      return give (ret, std::get <2> (proto).size ());
+    }
+
+    stack_depth
+    apply_builtin (tree const &t, stack_depth d)
+    {
+      auto ob = std::dynamic_pointer_cast <overloaded_builtin const>
+	(t.m_builtin);
+      if (ob == nullptr)
+	{
+	  auto pm = t.m_builtin->protomap ();
+	  if (pm.size () != 1)
+	    {
+	      m_unchecked = false;
+	      return unknown_depth ();
+	    }
+	  return apply_prototype (pm.front (), d);
+	}
+
+      // Overloads that the stack is too shallow for are never
+      // picked, so dynamic dispatch itself doesn't underrun.  But it
+      // needs stack profiles.
+      m_unchecked = false;
+      bool any = false;
+      stack_depth ret = unknown_depth ();
+      for (auto const &ovl: ob->get_overload_tab ()->get_overloads ())
+	{
+	  auto pm = std::get <1> (ovl)->protomap ();
+	  if (pm.size () != 1)
+	    return unknown_depth ();
+
+	  size_t in = std::get <0> (pm.front ()).size ();
+	  if (d.hi < in)
+	    continue;
+
+	  stack_depth out = {std::max (d.lo, in), d.hi};
+	  if (std::get <1> (pm.front ()) != yield::pred)
+	    out = give ({out.lo - in, out.hi == unbounded ? out.hi
+			 : out.hi - in},
+			std::get <2> (pm.front ()).size ());
+	  ret = any ? join (ret, out) : out;
+	  any = true;
+	}
+
+      // If no overload fits, nothing gets past this builtin.
+      return any ? ret : unknown_depth ();
+    }
+
+    void
+    verify_pred (tree const &t, stack_depth d)
+    {
+      switch (t.tt ())
+	{
+	case tree_type::PRED_AND:
+	case tree_type::PRED_OR:
+	case tree_type::PRED_NOT:
+	  for (auto const &ch: t.m_children)
+	    verify_pred (ch, d);
+	  return;
+
+	case tree_type::PRED_SUBX_ANY:
+	  verify (t.child (0), d);
+	  return;
+
+	case tree_type::PRED_SUBX_CMP:
+	  {
+	    stack_depth a = verify (t.child (0), d);
+	    stack_depth b = verify (t.child (1), d);
+	    take (b, 1);
+	    verify_pred (t.child (2), give (a, 1));
+	    return;
+	  }
+
+	case tree_type::F_BUILTIN:
+	  apply_builtin (t, d);
+	  return;
+
+	default:
+	  return;
+	}
+    }
+
+  public:
+    explicit stack_effect_verifier (bool closures)
+      : m_closures {closures}
+      , m_unchecked {true}
+    {}
+
+    bool
+    unchecked () const
+    {
+      return m_unchecked;
+    }
+
+    stack_depth
+    verify (tree const &t, stack_depth d)
+    {
+      switch (t.tt ())
+	{
+	case tree_type::CAT:
+	  for (auto const &ch: t.m_children)
+	    d = verify (ch, d);
+	  return d;
+
+	case tree_type::ALT:
+	case tree_type::OR:
+	  {
+	    stack_depth ret = verify (t.child (0), d);
+	    for (size_t i = 1; i < t.m_children.size (); ++i)
+	      ret = join (ret, verify (t.child (i), d));
+	    return ret;
+	  }
+
+	case tree_type::CAPTURE:
+	  take (verify (t.child (0), d), 1);
+	  return give (d, 1);
+
+	case tree_type::SUBX_EVAL:
+	  {
+	    size_t keep = t.cst ().value ().uval ();
+	    take (verify (t.child (0), d), keep);
+	    return give (d, keep);
+	  }
+
+	case tree_type::IFELSE:
+	  verify (t.child (0), d);
+	  return join (verify (t.child (1), d), verify (t.child (2), d));
+
+	case tree_type::SCOPE:
+	  return verify (t.child (0), d);
+
+	case tree_type::BLOCK:
+	  // The body is verified when, and if, it's applied.  Programs
+	  // that apply closures are never proven safe, so there's
+	  // nothing to do here.
+	  return give (d, 1);
+
+	case tree_type::BIND:
+	  return take (d, 1);
+
+	case tree_type::READ:
+	  if (m_closures)
+	    {
+	      m_unchecked = false;
+	      return unknown_depth ();
+	    }
+	  return give (d, 1);
+
+	case tree_type::CLOSE_STAR:
+	  {
+	    // Like in peg, iterate until the bounds stabilize.  The
+	    // lower bound can only decrease, so that's bounded.  If
+	    // the upper one keeps growing, it's unbounded.
+	    stack_depth ret = d;
+	    while (true)
+	      {
+		stack_depth next = join (ret, verify (t.child (0), ret));
+		if (next.hi > ret.hi)
+		  next.hi = unbounded;
+		if (next.lo == ret.lo && next.hi == ret.hi)
+		  return ret;
+		ret = next;
+	      }
+	  }
+
+	case tree_type::NOP:
+	case tree_type::F_DEBUG:
+	  return d;
+
+	case tree_type::ASSERT:
+	  verify_pred (t.child (0), d);
+	  return d;
+
+	case tree_type::CONST:
+	case tree_type::STR:
+	case tree_type::EMPTY_LIST:
+	  return give (d, 1);
+
+	case tree_type::FORMAT:
+	  for (auto const &ch: t.m_children)
+	    if (ch.tt () != tree_type::STR)
+	      d = take (verify (ch, d), 1);
+	  return give (d, 1);
+
+	case tree_type::F_BUILTIN:
+	  return apply_builtin (t, d);
+
+	case tree_type::PRED_AND:
+	case tree_type::PRED_OR:
+	case tree_type::PRED_NOT:
+	case tree_type::PRED_SUBX_ANY:
+	case tree_type::PRED_SUBX_CMP:
+	  assert (! "Should never get here.");
+	  abort ();
+	}
+
+      abort ();
+    }
+  };
+}
+
+bool
+verify_stack_effects (tree const &t, stack const &input)
+{
+  bool closures = has_block (t);
+  for (size_t i = 0; i < input.size (); ++i)
+    {
+      value_type vt = input.get (i).get_type ();
+      if (vt == value_closure::vtype || vt == value_seq::vtype)
+	closures = true;
+    }
+
+  stack_effect_verifier v {closures};
+  v.verify (t, {input.size (), input.size ()});
+  return v.unchecked ();
+}
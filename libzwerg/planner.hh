@@ -0,0 +1,136 @@
+/*
+   Copyright (C) 2014 Red Hat, Inc.
+   This file is part of dwgrep.
+
+   This file is free software; you can redistribute it and/or modify
+   it under the terms of either
+
+     * the GNU Lesser General Public License as published by the Free
+       Software Foundation; either version 3 of the License, or (at
+       your option) any later version
+
+   or
+
+     * the GNU General Public License as published by the Free
+       Software Foundation; either version 2 of the License, or (at
+       your option) any later version
+
+   or both in parallel, as here.
+
+   dwgrep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received copies of the GNU General Public License and
+   the GNU Lesser General Public License along with this program.  If
+   not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef _PLANNER_H_
+#define _PLANNER_H_
+
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <string>
+
+#include "tree.hh"
+
+class value_test;
+
+// Support for strength reduction of queries, see builtin::reduce.
+//
+// A filter is an assertion or a predicate builtin.  Filters don't
+// change the stack, so when a run of them follows a builtin, all that
+// they assert holds for stacks that the builtin yields.  The
+// functions below help builtins pick out the parts that they can make
+// use of.
+
+// Return true if T is a filter.
+bool is_filter (tree const &t);
+
+// Look among FILTERS for an assertion of the form (WORD == "literal")
+// or ("literal" == WORD), where WORD is a builtin whose name is one
+// of WORDS.  Return the literal, or nullptr if there's no such
+// assertion.
+std::string const *find_str_equality (tree const *begin, tree const *end,
+				      std::initializer_list <char const *> words);
+
+// Like find_str_equality, but look for (WORD == N), where N is a
+// non-negative integer literal in one of the plain numeric domains
+// (e.g. 0x14, but not DW_TAG_member).  Return the literal, or nullptr
+// if there's no such assertion.
+constant const *find_cst_equality (tree const *begin, tree const *end,
+				   std::initializer_list <char const *> words);
+
+// Like find_cst_equality, but look for any assertion that bounds
+// WORD from above: (WORD == N), (WORD < N), (WORD <= N), or the same
+// with sides swapped.  Return true and set *BOUND to the least M such
+// that WORD < M holds for all values that pass, or return false if
+// there's no such assertion.
+bool find_cst_upper_bound (tree const *begin, tree const *end,
+			   std::initializer_list <char const *> words,
+			   uint64_t *bound);
+
+// Look among FILTERS for an assertion of the form
+// ?(address ?(N ?contains)) or ?(address N ?contains), where N is an
+// integer literal as with find_cst_equality.  Return the literal, or
+// nullptr if there's no such assertion.
+constant const *find_address_containment (tree const *begin,
+					  tree const *end);
+
+// Look among FILTERS for a predicate builtin (such as ?TAG_member)
+// whose name MATCH accepts.  Return the builtin, or nullptr if there
+// is no such filter.
+builtin const *find_pred_builtin (tree const *begin, tree const *end,
+				  std::function <bool (char const *)> match);
+
+// Call CB for each predicate builtin (such as ?TAG_member) that is
+// asserted among FILTERS.
+void for_each_pred_builtin (tree const *begin, tree const *end,
+			    std::function <void (builtin const &)> cb);
+
+// Look among FILTERS for an assertion of the form ?(STEP STEP ... P),
+// i.e. N applications of builtin STEP (such as parent) followed by a
+// predicate builtin P whose name MATCH accepts.  A bare P counts as
+// N == 0.  Return the smallest such N, or -1 if there's no such
+// assertion.
+int find_pred_after_steps (tree const *begin, tree const *end,
+			   char const *step,
+			   std::function <bool (char const *)> match);
+
+// Operator fusion.  [BEGIN, END) are filters that follow a builtin
+// which leaves a value of type VT on TOS.  Fuse a leading run of
+// them into a single test that evaluates what they would, directly
+// on that value (see op_fused_filter).  Filters are fused if they
+// consist of predicate builtins and comparisons of a builtin with a
+// string literal, whose overloads for VT support that (see
+// builtin::build_value_test).  Set *FUSED_END to the end of the run.
+// Return nullptr if not even the first filter can be fused.
+std::unique_ptr <value_test> fuse_filters (tree const *begin,
+					   tree const *end, value_type vt,
+					   tree const **fused_end);
+
+// Overload pegging.  Walk the tree and infer, using protomaps of the
+// builtins involved, types of values on stack at each point of the
+// program.  Where that makes it certain which overload of an
+// overloaded builtin would be picked at run time, replace the
+// builtin with one that's pegged to that overload.  Where the types
+// are not known, dispatch is left to run time.
+void peg_overloads (tree &t);
+
+// Likewise, but with the knowledge that the program will run on
+// INPUT.
+void peg_overloads (tree &t, stack const &input);
+
+// Static stack effect analysis.  Walk the tree and bound the number
+// of values on stack at each point of the program, when run on
+// INPUT.  Return true if no word can underrun the stack, and no
+// overloads are left to dispatch at run time (see peg_overloads).
+// Such programs can run on an unchecked stack.  Underruns, even
+// certain ones, are otherwise left for the stack to report at run
+// time, as the word in question may never be reached.
+bool verify_stack_effects (tree const &t, stack const &input);
+
+#endif /* _PLANNER_H_ */
@@ -0,0 +1,187 @@
+/*
+   Copyright (C) 2014 Red Hat, Inc.
+   This file is part of dwgrep.
+
+   This file is free software; you can redistribute it and/or modify
+   it under the terms of either
+
+     * the GNU Lesser General Public License as published by the Free
+       Software Foundation; either version 3 of the License, or (at
+       your option) any later version
+
+   or
+
+     * the GNU General Public License as published by the Free
+       Software Foundation; either version 2 of the License, or (at
+       your option) any later version
+
+   or both in parallel, as here.
+
+   dwgrep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received copies of the GNU General Public License and
+   the GNU Lesser General Public License along with this program.  If
+   not, see <http://www.gnu.org/licenses/>.  */
+
+#include <mutex>
+
+#include "pool.hh"
+
+namespace
+{
+  size_t const granule = 16;
+  size_t const max_pooled = 256;
+  size_t const num_classes = max_pooled / granule;
+
+  // How many blocks are moved at a time between a thread's list and
+  // the shared one, and how long the thread's list can grow.
+  size_t const batch = 64;
+  size_t const max_cached = 4 * batch;
+
+  struct block
+  {
+    block *m_next;
+  };
+
+  struct shared_pool
+  {
+    std::mutex m_mutex;
+    block *m_free[num_classes];
+  };
+
+  // The shared pool is never destroyed, so that blocks can be freed
+  // during static destruction.
+  shared_pool &
+  get_shared_pool ()
+  {
+    static shared_pool *pool = new shared_pool {};
+    return *pool;
+  }
+
+  // Per-thread free lists.  These are plain data, and stay usable
+  // even while the thread's other objects are being destroyed.
+  thread_local block *t_free[num_classes];
+  thread_local size_t t_count[num_classes];
+  thread_local bool t_exiting;
+
+  size_t
+  size_class (size_t size)
+  {
+    return size == 0 ? 0 : (size - 1) / granule;
+  }
+
+  // Move N blocks from the front of thread's list of class C to the
+  // shared pool.
+  void
+  give_back (size_t c, size_t n)
+  {
+    if (n == 0)
+      return;
+
+    block *first = t_free[c];
+    block *last = first;
+    for (size_t i = 1; i < n; ++i)
+      last = last->m_next;
+
+    t_free[c] = last->m_next;
+    t_count[c] -= n;
+
+    shared_pool &pool = get_shared_pool ();
+    std::lock_guard <std::mutex> lock {pool.m_mutex};
+    last->m_next = pool.m_free[c];
+    pool.m_free[c] = first;
+  }
+
+  // When a thread exits, its cached blocks go to the shared pool.
+  struct thread_flusher
+  {
+    ~thread_flusher ()
+    {
+      for (size_t c = 0; c < num_classes; ++c)
+	give_back (c, t_count[c]);
+      t_exiting = true;
+    }
+  };
+
+  thread_local thread_flusher t_flusher;
+
+  void *
+  refill (size_t c)
+  {
+    // Make sure the flusher is constructed, and so gets to run.
+    (void) &t_flusher;
+
+    size_t block_size = (c + 1) * granule;
+    {
+      shared_pool &pool = get_shared_pool ();
+      std::lock_guard <std::mutex> lock {pool.m_mutex};
+      for (size_t i = 0; i < batch && pool.m_free[c] != nullptr; ++i)
+	{
+	  block *b = pool.m_free[c];
+	  pool.m_free[c] = b->m_next;
+	  b->m_next = t_free[c];
+	  t_free[c] = b;
+	  ++t_count[c];
+	}
+    }
+
+    if (t_free[c] == nullptr)
+      {
+	char *chunk = static_cast <char *>
+	  (::operator new (batch * block_size));
+	for (size_t i = 0; i < batch; ++i)
+	  {
+	    block *b = reinterpret_cast <block *> (chunk + i * block_size);
+	    b->m_next = t_free[c];
+	    t_free[c] = b;
+	  }
+	t_count[c] += batch;
+      }
+
+    block *b = t_free[c];
+    t_free[c] = b->m_next;
+    --t_count[c];
+    return b;
+  }
+}
+
+void *
+pool_allocate (size_t size)
+{
+  if (size > max_pooled)
+    return ::operator new (size);
+
+  size_t c = size_class (size);
+  if (block *b = t_free[c])
+    {
+      t_free[c] = b->m_next;
+      --t_count[c];
+      return b;
+    }
+
+  return refill (c);
+}
+
+void
+pool_deallocate (void *ptr, size_t size)
+{
+  if (size > max_pooled)
+    {
+      ::operator delete (ptr);
+      return;
+    }
+
+  size_t c = size_class (size);
+  block *b = static_cast <block *> (ptr);
+  b->m_next = t_free[c];
+  t_free[c] = b;
+  ++t_count[c];
+
+  if (t_exiting)
+    give_back (c, t_count[c]);
+  else if (t_count[c] > max_cached)
+    give_back (c, batch);
+}
@@ -0,0 +1,88 @@
+/*
+   Copyright (C) 2014 Red Hat, Inc.
+   This file is part of dwgrep.
+
+   This file is free software; you can redistribute it and/or modify
+   it under the terms of either
+
+     * the GNU Lesser General Public License as published by the Free
+       Software Foundation; either version 3 of the License, or (at
+       your option) any later version
+
+   or
+
+     * the GNU General Public License as published by the Free
+       Software Foundation; either version 2 of the License, or (at
+       your option) any later version
+
+   or both in parallel, as here.
+
+   dwgrep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received copies of the GNU General Public License and
+   the GNU Lesser General Public License along with this program.  If
+   not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include <cstddef>
+#include <new>
+
+// Allocation of small objects from pools of fixed-size blocks.
+//
+// While a query runs, values and stack nodes are created and
+// destroyed at a high rate, in a handful of sizes.  Blocks of each
+// size are recycled through a per-thread free list, which only needs
+// to go to a shared list (under a lock) when it runs empty or grows
+// too long.  New blocks are carved out of larger chunks, which are
+// never given back.  Requests for larger objects are passed on to
+// the global operator new.
+
+void *pool_allocate (size_t size);
+void pool_deallocate (void *ptr, size_t size);
+
+// An allocator that draws from the pools, for use with containers
+// and std::allocate_shared.
+template <class T>
+struct pool_allocator
+{
+  typedef T value_type;
+
+  pool_allocator () = default;
+
+  template <class U>
+  pool_allocator (pool_allocator <U> const &)
+  {}
+
+  T *
+  allocate (size_t n)
+  {
+    return static_cast <T *> (pool_allocate (n * sizeof (T)));
+  }
+
+  void
+  deallocate (T *ptr, size_t n)
+  {
+    pool_deallocate (ptr, n * sizeof (T));
+  }
+};
+
+template <class T, class U>
+bool
+operator== (pool_allocator <T> const &, pool_allocator <U> const &)
+{
+  return true;
+}
+
+template <class T, class U>
+bool
+operator!= (pool_allocator <T> const &, pool_allocator <U> const &)
+{
+  return false;
+}
+
+#endif /* _POOL_H_ */
@@ -56,90 +56,176 @@ std::shared_ptr <frame>
 frame::clone () const
 {
   auto ret = std::make_shared <frame> (m_parent, 0);
-  for (auto const &val: m_values)
-    ret->m_values.push_back (val != nullptr ? val->clone () : nullptr);
+  ret->m_values = m_values;
   return ret;
 }
 
 stack::stack (stack const &that)
-  : m_frame {that.m_frame != nullptr ? that.m_frame->clone () : nullptr}
+  : m_top {that.m_top}
+  , m_size {that.m_size}
+  , m_frame {that.m_frame}
   , m_profile {that.m_profile}
+  , m_frame_shared {that.m_frame != nullptr}
+  , m_checked {that.m_checked}
+{}
+
+stack::~stack ()
 {
-  for (auto const &v: that.m_values)
-    m_values.push_back (v->clone ());
+  // Unlink nodes that only this stack refers to one by one, so that
+  // destroying a deep stack doesn't recurse through all of it.
+  while (m_top != nullptr && m_top.use_count () == 1)
+    m_top = std::move (m_top->m_below);
 }
 
-namespace
+value &
+stack::get_mutable (unsigned depth)
 {
-  int
-  compare_stack (std::vector <std::unique_ptr <value> > const &a,
-	       std::vector <std::unique_ptr <value> > const &b)
-  {
-    if (a.size () < b.size ())
-      return -1;
-    else if (a.size () > b.size ())
-      return 1;
-
-    // The stack that has nullptr where the other has non-nullptr is
-    // smaller.
+  need (depth + 1);
+
+  // Once a node is copied, the node below it gains a referent, and
+  // is copied as well.  Everything down to DEPTH ends up private.
+  // Hashes of the nodes on the way cover the value that's about to
+  // change, so forget them.
+  std::shared_ptr <node> *np = &m_top;
+  for (unsigned i = 0; ; ++i)
     {
-      auto it = a.begin ();
-      auto jt = b.begin ();
-      for (; it != a.end (); ++it, ++jt)
-	if (*it == nullptr && *jt != nullptr)
-	  return -1;
-	else if (*it != nullptr && *jt == nullptr)
-	  return 1;
+      std::shared_ptr <node> &n = *np;
+      if (n.use_count () > 1)
+	n = std::allocate_shared <node> (pool_allocator <node> (),
+					 n->m_below, n->m_value->clone ());
+      else
+	n->m_hash.store (0, std::memory_order_relaxed);
+      if (i == depth)
+	return *n->m_value;
+      np = &n->m_below;
     }
+}
 
-    // The stack with "smaller" types is smaller.
+void
+stack::bind_value (size_t depth, var_id index, std::unique_ptr <value> val)
+{
+  if (depth == 0 && m_frame_shared)
     {
-      auto it = a.begin ();
-      auto jt = b.begin ();
-      for (; it != a.end (); ++it, ++jt)
-	if (*it != nullptr && *jt != nullptr)
-	  {
-	    if ((*it)->get_type () < (*jt)->get_type ())
-	      return -1;
-	    else if ((*jt)->get_type () < (*it)->get_type ())
-	      return 1;
-	  }
+      m_frame = m_frame->clone ();
+      m_frame_shared = false;
     }
+  nth_frame (depth)->bind_value (index, std::move (val));
+}
 
-    // We have the same number of slots with values of the same type.
-    // Now compare the values directly.
+namespace
+{
+  // Compare values in the two lists of stack nodes, from the bottom
+  // up, using CMP.  Return the first non-zero result, or zero.  Both
+  // lists have the same length.  Parts that the two lists share
+  // compare equal.
+  template <class Node, class F>
+  int
+  compare_nodes (Node const *a, Node const *b, F cmp)
+  {
+    if (a == b)
+      return 0;
+    if (int ret = compare_nodes (a->m_below.get (), b->m_below.get (), cmp))
+      return ret;
+    return cmp (a->m_value.get (), b->m_value.get ());
+  }
+}
+
+int
+stack::compare (stack const &a, stack const &b)
+{
+  if (a.m_size < b.m_size)
+    return -1;
+  else if (a.m_size > b.m_size)
+    return 1;
+
+  // The stack that has nullptr where the other has non-nullptr is
+  // smaller.
+  if (int ret = compare_nodes
+      (a.m_top.get (), b.m_top.get (),
+       [] (value const *va, value const *vb)
+       {
+	 if (va == nullptr && vb != nullptr)
+	   return -1;
+	 else if (va != nullptr && vb == nullptr)
+	   return 1;
+	 return 0;
+       }))
+    return ret;
+
+  // The stack with "smaller" types is smaller.
+  if (int ret = compare_nodes
+      (a.m_top.get (), b.m_top.get (),
+       [] (value const *va, value const *vb)
+       {
+	 if (va != nullptr && vb != nullptr)
+	   {
+	     if (va->get_type () < vb->get_type ())
+	       return -1;
+	     else if (vb->get_type () < va->get_type ())
+	       return 1;
+	   }
+	 return 0;
+       }))
+    return ret;
+
+  // We have the same number of slots with values of the same type.
+  // Now compare the values directly.
+  return compare_nodes
+    (a.m_top.get (), b.m_top.get (),
+     [] (value const *va, value const *vb)
+     {
+       if (va != nullptr && vb != nullptr)
+	 switch (va->cmp (*vb))
+	   {
+	   case cmp_result::fail:
+	     assert (! "Comparison of same-typed slots shouldn't fail!");
+	     abort ();
+	   case cmp_result::less:
+	     return -1;
+	   case cmp_result::greater:
+	     return 1;
+	   case cmp_result::equal:
+	     break;
+	   }
+       return 0;
+     });
+}
+
+size_t
+stack::node::hash () const
+{
+  size_t ret = m_hash.load (std::memory_order_relaxed);
+  if (ret == 0)
     {
-      auto it = a.begin ();
-      auto jt = b.begin ();
-      for (; it != a.end (); ++it, ++jt)
-	if (*it != nullptr && *jt != nullptr)
-	  switch ((*it)->cmp (**jt))
-	    {
-	    case cmp_result::fail:
-	      assert (! "Comparison of same-typed slots shouldn't fail!");
-	      abort ();
-	    case cmp_result::less:
-	      return -1;
-	    case cmp_result::greater:
-	      return 1;
-	    case cmp_result::equal:
-	      break;
-	    }
+      ret = m_below != nullptr ? m_below->hash () : 0;
+      if (m_value != nullptr)
+	ret = hash_combine (ret, hash_combine (m_value->get_type ().code (),
+					       m_value->hash ()));
+      else
+	ret = hash_combine (ret, 0);
+
+      // 0 is reserved for "not computed".
+      if (ret == 0)
+	ret = 1;
+      m_hash.store (ret, std::memory_order_relaxed);
     }
+  return ret;
+}
 
-    // The stacks are the same!
-    return 0;
-  }
+size_t
+stack::hash () const
+{
+  return m_top != nullptr ? m_top->hash () : 0;
 }
 
 bool
 stack::operator< (stack const &that) const
 {
-  return compare_stack (m_values, that.m_values) < 0;
+  return compare (*this, that) < 0;
 }
 
 bool
 stack::operator== (stack const &that) const
 {
-  return compare_stack (m_values, that.m_values) == 0;
+  return compare (*this, that) == 0;
 }
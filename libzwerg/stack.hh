@@ -29,20 +29,23 @@
 #ifndef _STK_H_
 #define _STK_H_
 
+#include <atomic>
 #include <memory>
 #include <vector>
 
+#include "pool.hh"
 #include "value.hh"
 #include "selector.hh"
 
 enum var_id: unsigned {};
 
 // Stack frame, or activation record, of a running procedure (or other
-// sort of context).
+// sort of context).  Bound values are never changed, so clones of a
+// frame share them.
 struct frame
 {
   std::shared_ptr <frame> m_parent;
-  std::vector <std::unique_ptr <value>> m_values;
+  std::vector <std::shared_ptr <value>> m_values;
 
   frame (std::shared_ptr <frame> parent, size_t vars)
     : m_parent {parent}
@@ -57,22 +60,83 @@ struct frame
 
 // Value file is a container type that's used for maintaining stacks
 // of dwgrep values.
+//
+// Stacks are persistent lists linked from TOS down.  Copying a stack
+// shares all its values with the original, which makes forking the
+// computation cheap.  A value is only cloned when a stack that shares
+// it pops it or asks for mutable access to it.
 class stack
 {
-  std::vector <std::unique_ptr <value>> m_values;
+  struct node
+  {
+    std::shared_ptr <node> m_below;
+    std::unique_ptr <value> m_value;
+
+    // Hash of this node and those below it, or 0 if it wasn't
+    // computed yet.  Nodes are shared between stacks, and so are
+    // the hashes.  Pushing to a stack whose hash is known thus only
+    // costs a hash of the pushed value.
+    mutable std::atomic <size_t> m_hash;
+
+    node (std::shared_ptr <node> below, std::unique_ptr <value> value)
+      : m_below {std::move (below)}
+      , m_value {std::move (value)}
+      , m_hash {0}
+    {}
+
+    size_t hash () const;
+  };
+
+  std::shared_ptr <node> m_top;
+  size_t m_size;
   std::shared_ptr <frame> m_frame;
   selector::sel_t m_profile;
 
+  // A copy of a stack shares the top frame with the original until it
+  // binds a variable, at which point it gets a clone.
+  bool m_frame_shared;
+
+  // Checked stacks maintain their profile and check that values are
+  // there before they are accessed.  Programs that were proven not to
+  // need either (see verify_stack_effects) run on unchecked stacks.
+  bool m_checked;
+
+  node *
+  nth_node (unsigned depth) const
+  {
+    node *ret = m_top.get ();
+    for (unsigned i = 0; i < depth; ++i)
+      ret = ret->m_below.get ();
+    return ret;
+  }
+
+  static int compare (stack const &a, stack const &b);
+
 public:
   typedef std::unique_ptr <stack> uptr;
 
   stack ()
-    : m_profile {0}
+    : m_size {0}
+    , m_profile {0}
+    , m_frame_shared {false}
+    , m_checked {true}
   {}
 
   stack (stack const &other);
   stack (stack &&other) = default;
-  ~stack () = default;
+  ~stack ();
+
+  static void *
+  operator new (size_t size)
+  {
+    return pool_allocate (size);
+  }
+
+  static void
+  operator delete (void *ptr, size_t size)
+  {
+    pool_deallocate (ptr, size);
+  }
 
   std::shared_ptr <frame>
   nth_frame (size_t depth) const
@@ -87,32 +151,56 @@ public:
   set_frame (std::shared_ptr <frame> frame)
   {
     m_frame = frame;
+    m_frame_shared = false;
   }
 
+  // Bind VAL to variable INDEX in the frame DEPTH levels up.
+  void bind_value (size_t depth, var_id index, std::unique_ptr <value> val);
+
   size_t
   size () const
   {
-    return m_values.size ();
+    return m_size;
+  }
+
+  bool
+  checked () const
+  {
+    return m_checked;
+  }
+
+  // Stop maintaining profile and checking accesses.  Copies of this
+  // stack are unchecked as well.
+  void
+  uncheck ()
+  {
+    m_checked = false;
   }
 
   selector::sel_t
   profile () const
   {
+    assert (m_checked);
     return m_profile;
   }
 
   void
   push (std::unique_ptr <value> vp)
   {
-    m_profile <<= 8;
-    m_profile |= vp->get_type ().code ();
-    m_values.push_back (std::move (vp));
+    if (m_checked)
+      {
+	m_profile <<= 8;
+	m_profile |= vp->get_type ().code ();
+      }
+    m_top = std::allocate_shared <node> (pool_allocator <node> (),
+					 std::move (m_top), std::move (vp));
+    ++m_size;
   }
 
   void
   need (unsigned depth) const
   {
-    if (depth > m_values.size ())
+    if (m_checked && depth > m_size)
       throw std::runtime_error ("stack overflow");
   }
 
@@ -120,13 +208,23 @@ public:
   pop ()
   {
     need (1);
-    auto ret = std::move (m_values.back ());
-    m_values.pop_back ();
-    m_profile >>= 8;
-    if (m_values.size () >= selector::W)
+    std::unique_ptr <value> ret;
+    std::shared_ptr <node> top = std::move (m_top);
+    m_top = top->m_below;
+    --m_size;
+    if (top.use_count () == 1)
+      ret = std::move (top->m_value);
+    else
+      ret = top->m_value->clone ();
+
+    if (m_checked)
       {
-	auto code = get (selector::W - 1).get_type ().code ();
-	m_profile |= ((selector::sel_t) code) << 24;
+	m_profile >>= 8;
+	if (m_size >= selector::W)
+	  {
+	    auto code = get (selector::W - 1).get_type ().code ();
+	    m_profile |= ((selector::sel_t) code) << 24;
+	  }
       }
     return ret;
   }
@@ -140,45 +238,46 @@ public:
     return std::unique_ptr <T> (static_cast <T *> (vp.release ()));
   }
 
-  value &
-  top ()
+  // Values may be shared with other stacks, so only const access is
+  // given out.  Use get_mutable for values that are to be changed.
+  value const &
+  top () const
   {
     need (1);
-    return *m_values.back ().get ();
-  }
-
-  value &
-  get (unsigned depth)
-  {
-    need (depth + 1);
-    return *(m_values.rbegin () + depth)->get ();
+    return *m_top->m_value;
   }
 
   value const &
   get (unsigned depth) const
   {
     need (depth + 1);
-    return *(m_values.rbegin () + depth)->get ();
+    return *nth_node (depth)->m_value;
   }
 
+  // Return the value DEPTH slots down for modification.  Nodes down
+  // to it that are shared with other stacks are copied first, so that
+  // the change is only seen by this stack.
+  value &get_mutable (unsigned depth);
+
   template <class T>
   T *
   top_as ()
   {
-    value const &ret = top ();
-    return value::as <T> (const_cast <value *> (&ret));
+    return value::as <T> (&get_mutable (0));
   }
 
   template <class T>
   T *
   get_as (unsigned depth)
   {
-    value const &ret = get (depth);
-    return value::as <T> (const_cast <value *> (&ret));
+    return value::as <T> (&get_mutable (depth));
   }
 
   bool operator< (stack const &that) const;
   bool operator== (stack const &that) const;
+
+  // Stacks that compare equal have equal hashes.
+  size_t hash () const;
 };
 
 #endif /* _STK_H_ */
@@ -27,6 +27,11 @@
    not, see <http://www.gnu.org/licenses/>.  */
 
 #include <gtest/gtest.h>
+#include <numeric>
+#include <sstream>
+#include <thread>
+#include <dirent.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 
@@ -34,10 +39,20 @@
 #include "builtin-dw.hh"
 #include "builtin-dw-abbrev.hh"
 #include "init.hh"
+#include "value-cst.hh"
 #include "value-dw.hh"
+#include "value-str.hh"
 #include "stack.hh"
 #include "parser.hh"
 #include "op.hh"
+#include "overload.hh"
+#include "parallel.hh"
+#include "planner.hh"
+#include "pool.hh"
+#include "cache.hh"
+#include "dwcache.hh"
+#include "dwit.hh"
+#include "dwfl_context.hh"
 
 std::string
 test_file (std::string name)
@@ -412,6 +427,811 @@ TEST_F (ZwTest, dies_from_two_files_neq)
 	      "[raw unit root] (elem (pos == 0) == elem (pos == 1))").size ());
 }
 
+TEST_F (ZwTest, parallel_matches_serial)
+{
+  auto check = [this] (std::string fn, std::string q)
+    {
+      // Share one Dwarf, DIE's from different Dwarfs never compare
+      // equal.
+      auto dwv = dw (fn, doneness::cooked);
+      tree t = parse_query (*builtins, q);
+      auto serial = run_query (*builtins, stack_with_value (dwv->clone ()), q);
+
+      for (unsigned nthreads: {1, 3})
+	{
+	  auto op = build_exec_parallel
+	    (t, stack_with_value (dwv->clone ()), nthreads, true);
+
+	  std::vector <std::unique_ptr <stack>> yielded;
+	  while (auto r = op->next ())
+	    yielded.push_back (std::move (r));
+
+	  ASSERT_EQ (serial.size (), yielded.size ()) << q;
+	  for (size_t i = 0; i < serial.size (); ++i)
+	    ASSERT_TRUE (*serial[i] == *yielded[i]) << q;
+
+	  // Unordered mode yields the same results, just perhaps not in
+	  // the same order.
+	  op = build_exec_parallel
+	    (t, stack_with_value (dwv->clone ()), nthreads, false);
+	  size_t n = 0;
+	  while (op->next () != nullptr)
+	    ++n;
+	  ASSERT_EQ (serial.size (), n) << q;
+	}
+    };
+
+  check ("twocus", "entry");
+  check ("twocus", "entry ?TAG_subprogram name");
+  check ("twocus", "unit root");
+  check ("twocus", "entry ?TAG_subprogram parent* ?root offset");
+  check ("dwz-partial", "entry (offset == 0x14) (|A| A A parent* ?root)");
+  check ("a1.out", "entry (offset == 0x14) parent");
+  check ("nontrivial-types.o", "entry ?TAG_member @AT_type");
+
+  // An error comes after the results that preceded it, like in serial
+  // evaluation.
+  auto collect = [] (std::shared_ptr <op> op,
+		     std::vector <std::unique_ptr <stack>> &yielded)
+    {
+      try
+	{
+	  while (auto r = op->next ())
+	    yielded.push_back (std::move (r));
+	}
+      catch (std::runtime_error &e)
+	{
+	  return true;
+	}
+      return false;
+    };
+
+  auto dwv = dw ("twocus", doneness::cooked);
+  tree t = parse_query (*builtins, "unit (root, drop drop)");
+  std::vector <std::unique_ptr <stack>> serial, yielded;
+  ASSERT_TRUE (collect (t.build_exec (std::make_shared <op_origin>
+				      (stack_with_value (dwv->clone ()))),
+			serial));
+  ASSERT_TRUE (collect (build_exec_parallel
+			(t, stack_with_value (dwv->clone ()), 3, true),
+			yielded));
+  ASSERT_EQ (1, serial.size ());
+  ASSERT_EQ (serial.size (), yielded.size ());
+  ASSERT_TRUE (*serial[0] == *yielded[0]);
+}
+
+TEST_F (ZwTest, shared_dwarf_concurrent_queries)
+{
+  std::vector <std::string> queries = {
+    "entry ?TAG_subprogram parent* ?root offset",
+    "entry ?TAG_member @AT_type",
+    "unit root",
+    "entry name",
+  };
+
+  // Run all queries over one Dwarf from several threads at once,
+  // before any of its caches are populated.
+  auto dwv = dw ("nontrivial-types.o", doneness::cooked);
+  std::vector <std::vector <size_t>> counts (4);
+  std::vector <std::thread> threads;
+  for (size_t i = 0; i < counts.size (); ++i)
+    threads.push_back (std::thread {[&, i] ()
+	{
+	  for (size_t j = 0; j < queries.size (); ++j)
+	    {
+	      auto const &q = queries[(i + j) % queries.size ()];
+	      counts[i].push_back
+		(run_query (*builtins, stack_with_value (dwv->clone ()),
+			    q).size ());
+	    }
+	}});
+  for (auto &thread: threads)
+    thread.join ();
+
+  for (size_t i = 0; i < counts.size (); ++i)
+    for (size_t j = 0; j < queries.size (); ++j)
+      {
+	auto const &q = queries[(i + j) % queries.size ()];
+	ASSERT_EQ (run_dwquery (*builtins, "nontrivial-types.o", q).size (),
+		   counts[i][j]) << q;
+      }
+}
+
+TEST (DwValueTest, dwfl_context_cache)
+{
+  // The cache is disabled by default.
+  ASSERT_NE (dw ("twocus", doneness::cooked)->get_dwctx (),
+	     dw ("twocus", doneness::cooked)->get_dwctx ());
+
+  set_dwfl_context_cache_limits (2, (uint64_t) -1);
+  auto a = dw ("twocus", doneness::cooked)->get_dwctx ();
+  ASSERT_EQ (a, dw ("twocus", doneness::raw)->get_dwctx ());
+
+  // Opening two more files evicts the least recently used one.
+  auto b = dw ("a1.out", doneness::cooked)->get_dwctx ();
+  ASSERT_EQ (a, dw ("twocus", doneness::cooked)->get_dwctx ());
+  dw ("empty", doneness::cooked);
+  ASSERT_EQ (a, dw ("twocus", doneness::cooked)->get_dwctx ());
+  ASSERT_NE (b, dw ("a1.out", doneness::cooked)->get_dwctx ());
+
+  // Files bigger than the byte limit are not cached at all.
+  set_dwfl_context_cache_limits (2, 1);
+  ASSERT_NE (dw ("twocus", doneness::cooked)->get_dwctx (),
+	     dw ("twocus", doneness::cooked)->get_dwctx ());
+
+  set_dwfl_context_cache_limits (0, 0);
+  clear_dwfl_context_cache ();
+}
+
+TEST_F (ZwTest, borrowed_strings)
+{
+  auto yielded = run_dwquery (*builtins, "twocus",
+			      "entry name ?(== \"main\")");
+  ASSERT_EQ (1, yielded.size ());
+  auto &name = *yielded[0]->top_as <value_str> ();
+
+  // Names are borrowed from the Dwarf, but compare and hash the same
+  // as owned strings.
+  value_str owned {"main", 0};
+  ASSERT_EQ (cmp_result::equal, name.cmp (owned));
+  ASSERT_EQ (cmp_result::equal, owned.cmp (name));
+  ASSERT_EQ (owned.hash (), name.hash ());
+  ASSERT_EQ (cmp_result::less, name.cmp (value_str {"mainx", 0}));
+  ASSERT_EQ (cmp_result::greater, name.cmp (value_str {"mai", 0}));
+
+  // Copies of a borrowed string are borrowed as well, modification
+  // makes a string owned.
+  auto copy = name.clone ();
+  ASSERT_EQ (name.c_str (), static_cast <value_str &> (*copy).c_str ());
+  name.get_string () += "x";
+  ASSERT_EQ (std::string {"mainx"}, name.c_str ());
+  ASSERT_EQ (std::string {"main"}, static_cast <value_str &> (*copy).c_str ());
+}
+
+TEST (DwValueTest, attr_iterator)
+{
+  for (auto fn: {"a1.out", "nullptr.o", "nontrivial-types.o"})
+    {
+      auto dwv = dw (fn, doneness::raw);
+      Dwarf *dwarf = (*dwfl_module_iterator {dwv->get_dwctx ()->get_dwfl ()})
+	.first;
+
+      for (all_dies_iterator it {dwarf}; it != all_dies_iterator::end (); ++it)
+	{
+	  size_t n = 0;
+	  for (attr_iterator at {*it}; at != attr_iterator::end (); ++at, ++n)
+	    {
+	      Dwarf_Attribute attr;
+	      ASSERT_TRUE (dwarf_attr (*it, (*at)->code, &attr) != nullptr);
+	      ASSERT_EQ (attr.form, (*at)->form);
+	      ASSERT_EQ (attr.valp, (*at)->valp);
+	    }
+
+	  size_t count = 0;
+	  dwarf_getattrs (*it, [] (Dwarf_Attribute *, void *data)
+			  {
+			    ++*static_cast <size_t *> (data);
+			    return (int) DWARF_CB_OK;
+			  }, &count, 0);
+	  ASSERT_EQ (count, n) << fn;
+	}
+    }
+}
+
+TEST_F (ZwTest, persistent_die_index)
+{
+  char dir[] = "/tmp/dwgrep-test-XXXXXX";
+  ASSERT_TRUE (mkdtemp (dir) != nullptr);
+
+  char const *orig = getenv ("XDG_CACHE_HOME");
+  std::string saved = orig != nullptr ? orig : "";
+  setenv ("XDG_CACHE_HOME", dir, 1);
+
+  auto show = [this] (std::string fn, std::string q)
+    {
+      std::ostringstream ss;
+      for (auto const &stk: run_dwquery (*builtins, fn, q))
+	{
+	  stk->top ().show (ss, brevity::full);
+	  ss << '\n';
+	}
+      return ss.str ();
+    };
+
+  // Indices are stored in a subdirectory of the cache directory.
+  std::string idxdir = std::string (dir) + "/dwgrep";
+
+  auto count_files = [&idxdir] ()
+    {
+      size_t n = 0;
+      if (DIR *d = opendir (idxdir.c_str ()))
+	{
+	  while (dirent *ent = readdir (d))
+	    if (ent->d_name[0] != '.')
+	      ++n;
+	  closedir (d);
+	}
+      return n;
+    };
+
+  auto dir_size = [&idxdir] ()
+    {
+      uint64_t size = 0;
+      if (DIR *d = opendir (idxdir.c_str ()))
+	{
+	  while (dirent *ent = readdir (d))
+	    {
+	      struct stat st;
+	      if (ent->d_name[0] != '.'
+		  && stat ((idxdir + "/" + ent->d_name).c_str (), &st) == 0)
+		size += st.st_size;
+	    }
+	  closedir (d);
+	}
+      return size;
+    };
+
+  auto build_indices = [this] (std::string fn)
+    {
+      auto dwv = dw (fn, doneness::cooked);
+      auto ctx = dwv->get_dwctx ();
+      for (dwfl_module_iterator it {ctx->get_dwfl ()};
+	   it != dwfl_module_iterator::end (); ++it)
+	ctx->get_die_index ((*it).first);
+    };
+
+  // Indices are only persisted on request.
+  build_indices ("twocus");
+  ASSERT_EQ (0, count_files ());
+
+  set_die_index_cache_limit ((uint64_t) -1);
+
+  // Lookups of single DIE's don't build the whole index.
+  show ("twocus", "entry parent");
+  ASSERT_EQ (0, count_files ());
+
+  // Queries answered from the lazy caches and from an index that was
+  // built, written, and mapped back in should give the same results.
+  for (auto fn: {"a1.out", "dwz-partial", "twocus"})
+    {
+      std::vector <std::string> queries
+	= {"entry parent", "entry ?root", "unit root parent*"};
+      std::vector <std::string> lazy;
+      for (auto const &q: queries)
+	lazy.push_back (show (fn, q));
+
+      build_indices (fn);
+      size_t nfiles = count_files ();
+      ASSERT_LT (0, nfiles);
+
+      for (size_t i = 0; i < queries.size (); ++i)
+	ASSERT_EQ (lazy[i], show (fn, queries[i])) << fn << ": " << queries[i];
+      ASSERT_EQ (nfiles, count_files ());
+    }
+
+  // Lowering the limit evicts indices until the rest fits.
+  {
+    size_t nfiles = count_files ();
+    uint64_t size = dir_size ();
+    set_die_index_cache_limit (size - 1);
+    ASSERT_GT (nfiles, count_files ());
+    ASSERT_GE (size - 1, dir_size ());
+  }
+
+  {
+    auto dwv = dw ("twocus", doneness::cooked);
+    Dwarf *dwarf = (*dwfl_module_iterator {dwv->get_dwctx ()->get_dwfl ()})
+      .first;
+    die_index const &idx = dwv->get_dwctx ()->get_die_index (dwarf);
+    ASSERT_EQ (2, idx.roots ().size ());
+    ASSERT_EQ (2, idx.tag_offsets (DW_TAG_compile_unit).size ());
+    ASSERT_EQ (1, idx.name_offsets ("main").size ());
+    ASSERT_TRUE (idx.name_offsets ("no such name").empty ());
+    ASSERT_TRUE (idx.tag_offsets (DW_TAG_lo_user).empty ());
+  }
+
+  set_die_index_cache_limit (0);
+  if (DIR *d = opendir (idxdir.c_str ()))
+    {
+      while (dirent *ent = readdir (d))
+	if (ent->d_name[0] != '.')
+	  unlink ((idxdir + "/" + ent->d_name).c_str ());
+      closedir (d);
+    }
+  rmdir (idxdir.c_str ());
+  rmdir (dir);
+
+  if (orig != nullptr)
+    setenv ("XDG_CACHE_HOME", saved.c_str (), 1);
+  else
+    unsetenv ("XDG_CACHE_HOME");
+}
+
+TEST_F (ZwTest, parent_cache)
+{
+  for (auto fn: {"a1.out", "dwz-partial", "twocus", "nontrivial-types.o"})
+    {
+      auto dwv = dw (fn, doneness::cooked);
+      Dwarf *dwarf = (*dwfl_module_iterator {dwv->get_dwctx ()->get_dwfl ()})
+	.first;
+
+      auto idx = die_index::build (dwarf);
+
+      // 0 means the cache is built lazily by the first lookup.
+      for (unsigned nthreads: {0, 1, 3, 8})
+	{
+	  parent_cache cache;
+	  if (nthreads > 0)
+	    cache.prebuild (dwarf, nthreads);
+
+	  for (all_dies_iterator it {dwarf};
+	       it != all_dies_iterator::end (); ++it)
+	    {
+	      Dwarf_Off paroff;
+	      ASSERT_TRUE (idx->find_parent (dwarf_dieoffset (*it), paroff));
+	      ASSERT_EQ (paroff, cache.find (**it)) << fn << ", " << nthreads;
+	    }
+	}
+    }
+}
+
+namespace
+{
+  // Run QUERY on FN twice: once with the `%s' in QUERY removed, and
+  // once with `dup drop' in its place, which keeps reductions from
+  // happening.  Both should yield the same stacks.
+  void
+  expect_same_as_unreduced (vocabulary &voc,
+			    std::string fn, std::string query)
+  {
+    size_t pos = query.find ("%s");
+    ASSERT_NE (std::string::npos, pos) << query;
+    std::string q1 = std::string (query).replace (pos, 2, "");
+    std::string q2 = std::string (query).replace (pos, 2, "dup drop ");
+
+    auto dwv = dw (fn, doneness::cooked);
+    auto reduced = run_query (voc, stack_with_value (dwv->clone ()), q1);
+    auto full = run_query (voc, stack_with_value (dwv->clone ()), q2);
+
+    EXPECT_EQ (full.size (), reduced.size ()) << fn << ": " << q1;
+    if (full.size () != reduced.size ())
+      return;
+    for (size_t i = 0; i < full.size (); ++i)
+      EXPECT_TRUE (*full[i] == *reduced[i]) << fn << ": " << q1;
+  }
+}
+
+TEST_F (ZwTest, name_lookup_reduction)
+{
+  for (auto fn: {"twocus", "a1.out", "dwz-partial", "char_16_32.o"})
+    for (std::string mode: {"", "raw "})
+      for (std::string filter: {"(name == \"int\")",
+				"?(\"main\" == @AT_name)",
+				"(name == \"long long unsigned int\")",
+				"(@AT_linkage_name == \"_Z5foo16PDs\")",
+				"(name == \"no such name\")"})
+	expect_same_as_unreduced (*builtins, fn,
+				  mode + "entry %s" + filter + " pos");
+}
+
+TEST_F (ZwTest, tag_lookup_reduction)
+{
+  for (auto fn: {"twocus", "dwz-partial", "dwz-partial4-1.o",
+		 "nontrivial-types.o"})
+    for (std::string mode: {"", "raw ", "unit ", "raw unit "})
+      for (std::string filter: {"?TAG_base_type", "?DW_TAG_member",
+				"?(?TAG_subprogram)", "?TAG_partial_unit",
+				"?TAG_subprogram (name == \"main\")"})
+	expect_same_as_unreduced (*builtins, fn,
+				  mode + "entry %s" + filter + " pos");
+}
+
+TEST_F (ZwTest, abbrev_filter_reduction)
+{
+  for (auto fn: {"twocus", "a1.out", "dwz-partial", "nullptr.o",
+		 "nontrivial-types.o"})
+    for (std::string mode: {"", "raw ", "unit ", "raw unit "})
+      for (std::string filter: {"?AT_location ?TAG_variable", "?AT_name",
+				"?AT_external", "?DW_AT_decl_line",
+				"?AT_declaration !AT_name",
+				"?(?AT_type ?TAG_pointer_type)",
+				"?TAG_subprogram ?TAG_variable"})
+	expect_same_as_unreduced (*builtins, fn,
+				  mode + "entry %s" + filter + " pos");
+}
+
+TEST_F (ZwTest, depth_bound_reduction)
+{
+  for (auto fn: {"twocus", "a1.out", "dwz-partial", "nullptr.o",
+		 "nontrivial-types.o"})
+    for (std::string mode: {"", "raw ", "unit ", "raw unit "})
+      for (std::string filter: {"?root", "?TAG_compile_unit",
+				"?(parent ?root)",
+				"?(parent parent ?root) ?AT_name",
+				"?(parent ?TAG_partial_unit)",
+				"?(parent ?root) ?TAG_subprogram"})
+	expect_same_as_unreduced (*builtins, fn,
+				  mode + "entry %s" + filter + " (offset, pos)");
+
+  // The depth-bounded walk visits the same DIE's as a full one,
+  // minus those that are too deep.
+  for (auto fn: {"a1.out", "twocus", "nontrivial-types.o"})
+    {
+      auto dwv = dw (fn, doneness::raw);
+      Dwarf *dwarf = (*dwfl_module_iterator {dwv->get_dwctx ()->get_dwfl ()})
+	.first;
+
+      for (size_t max_depth: {0, 1, 2})
+	{
+	  std::vector <Dwarf_Off> full, bounded;
+	  for (all_dies_iterator it {dwarf};
+	       it != all_dies_iterator::end (); ++it)
+	    if (it.stack ().size () <= max_depth + 1)
+	      full.push_back (dwarf_dieoffset (*it));
+
+	  for (all_dies_iterator it {cu_iterator {dwarf}, max_depth};
+	       it != all_dies_iterator::end (); ++it)
+	    bounded.push_back (dwarf_dieoffset (*it));
+
+	  ASSERT_EQ (full, bounded) << fn << ", " << max_depth;
+	}
+    }
+}
+
+TEST_F (ZwTest, offset_lookup_reduction)
+{
+  for (auto fn: {"twocus", "dwz-partial", "dwz-partial2-1"})
+    for (std::string prefix: {"", "raw "})
+      for (std::string query: {"entry %s", "unit %s", "unit entry %s",
+			       "entry child %s", "unit root child %s",
+			       "entry ?root raw child %s"})
+	for (std::string off: {"0", "0xb", "0x14", "0x53", "0x76", "0x80",
+			       "0x9a", "0x103", "0x1000"})
+	  {
+	    std::string q = prefix + query + " pos";
+	    q.replace (q.find ("%s"), 2, "%s(offset == " + off + ")");
+	    expect_same_as_unreduced (*builtins, fn, q);
+	  }
+}
+
+TEST_F (ZwTest, address_lookup_reduction)
+{
+  for (auto fn: {"testfile_const_type", "aranges.o", "bitcount.o", "a1.out"})
+    for (std::string addr: {"0", "0x10004", "0x10009", "0x10010", "0x80482f0",
+			    "0x80482f3", "0x80483f0", "0x4004fb"})
+      {
+	auto dwv = dw (fn, doneness::cooked);
+	auto run = [&] (std::string q)
+	  {
+	    return run_query (*builtins, stack_with_value (dwv->clone ()), q);
+	  };
+
+	std::string contains = "?(address ?(" + addr + " ?contains))";
+	for (std::string filter: {contains,
+				  "?(address " + addr + " ?contains)",
+				  "?TAG_subprogram " + contains})
+	  expect_same_as_unreduced (*builtins, fn,
+				    "raw entry %s" + filter + " pos");
+
+	// `lookup' yields covering DIE's without covering children.
+	auto looked_up = run ("raw " + addr + " lookup offset");
+	auto innermost = run ("raw entry dup drop " + contains
+			      + " !(child+ " + contains + ") offset");
+	ASSERT_EQ (innermost.size (), looked_up.size ()) << fn << ": " << addr;
+	for (size_t i = 0; i < innermost.size (); ++i)
+	  ASSERT_TRUE (*innermost[i] == *looked_up[i]) << fn << ": " << addr;
+      }
+}
+
+namespace
+{
+  bool
+  is_dispatched (tree const &t)
+  {
+    return std::dynamic_pointer_cast <overloaded_builtin const>
+      (t.m_builtin) != nullptr;
+  }
+}
+
+TEST_F (ZwTest, overload_pegging)
+{
+  auto dwv = dw ("nontrivial-types.o", doneness::cooked);
+  auto input = stack_with_value (dwv->clone ());
+
+  {
+    // Types of what entry yields depend on input.
+    tree t = parse_query (*builtins, "entry name");
+    peg_overloads (t);
+    ASSERT_TRUE (is_dispatched (t.child (0)));
+    ASSERT_TRUE (is_dispatched (t.child (1)));
+
+    // But entry on a Dwarf yields DIE's.
+    peg_overloads (t, *input);
+    ASSERT_FALSE (is_dispatched (t.child (0)));
+    ASSERT_FALSE (is_dispatched (t.child (1)));
+    ASSERT_STREQ ("name", t.child (1).m_builtin->name ());
+  }
+
+  {
+    // Stack shuffling keeps track of types.
+    tree t = parse_query (*builtins, "\"a\" 1 swap drop dup add");
+    peg_overloads (t);
+    ASSERT_FALSE (is_dispatched (t.child (5)));
+  }
+
+  {
+    // An overload that might be picked is not the one that will be.
+    tree t = parse_query (*builtins, "(1, \"a\") length");
+    peg_overloads (t);
+    ASSERT_TRUE (is_dispatched (t.child (1)));
+  }
+
+  for (std::string q: {"entry name", "entry !root (offset, name)",
+		       "entry ?root child* ?TAG_member name",
+		       "entry ?TAG_subprogram [child] elem (pos == 1) name",
+		       "entry (name, @AT_name) length",
+		       "entry ?TAG_subprogram dup swap over rot drop drop name",
+		       "1 name"})
+    {
+      auto full = run_query (*builtins,
+			     stack_with_value (dwv->clone ()), q);
+
+      tree t = parse_query (*builtins, q);
+      peg_overloads (t, *input);
+      auto op = t.build_exec (std::make_shared <op_origin>
+			      (stack_with_value (dwv->clone ())));
+      std::vector <std::unique_ptr <stack>> pegged;
+      while (auto r = op->next ())
+	pegged.push_back (std::move (r));
+
+      ASSERT_EQ (full.size (), pegged.size ()) << q;
+      for (size_t i = 0; i < full.size (); ++i)
+	ASSERT_TRUE (*full[i] == *pegged[i]) << q;
+    }
+}
+
+TEST_F (ZwTest, stack_effect_verification)
+{
+  auto dwv = dw ("nontrivial-types.o", doneness::cooked);
+  auto input = stack_with_value (dwv->clone ());
+
+  auto verify = [&] (std::string q)
+    {
+      tree t = parse_query (*builtins, q);
+      peg_overloads (t, *input);
+      return verify_stack_effects (t, *input);
+    };
+
+  // Certain underruns are left for the run-time check, the path may
+  // never be taken.
+  ASSERT_FALSE (verify ("drop drop"));
+  ASSERT_FALSE (verify ("(drop, drop 1) swap"));
+  ASSERT_FALSE (verify ("entry ?(drop drop)"));
+  ASSERT_FALSE (verify ("let A := drop; 1"));
+  ASSERT_FALSE (verify ("entry name \"%s-%s\""));
+  ASSERT_FALSE (verify ("?(0 == 1) drop drop"));
+  ASSERT_EQ (0, run_query (*builtins, stack_with_value (dwv->clone ()),
+			   "?(0 == 1) drop drop").size ());
+  ASSERT_THROW (run_query (*builtins, stack_with_value (dwv->clone ()),
+			   "drop drop"), std::runtime_error);
+
+  // Possible ones, dynamic dispatch and closures need checked stacks.
+  ASSERT_FALSE (verify ("(drop)*"));
+  ASSERT_FALSE (verify ("(1, \"a\") length"));
+  ASSERT_FALSE (verify ("{drop} apply"));
+  ASSERT_FALSE (verify ("let F := {1}; F"));
+
+  for (std::string q: {"entry name", "entry !root (offset, name)",
+		       "entry ?root child* ?TAG_member name",
+		       "entry ?TAG_subprogram [child] (length == 1)",
+		       "entry ?TAG_subprogram dup swap over rot drop drop name",
+		       "let A := entry; A \"%s\"", "(1 drop)* 2 drop"})
+    {
+      ASSERT_TRUE (verify (q)) << q;
+
+      auto full = run_query (*builtins,
+			     stack_with_value (dwv->clone ()), q);
+
+      tree t = parse_query (*builtins, q);
+      peg_overloads (t, *input);
+      auto stk = stack_with_value (dwv->clone ());
+      stk->uncheck ();
+      auto op = t.build_exec (std::make_shared <op_origin> (std::move (stk)));
+      std::vector <std::unique_ptr <stack>> unchecked;
+      while (auto r = op->next ())
+	unchecked.push_back (std::move (r));
+
+      ASSERT_EQ (full.size (), unchecked.size ()) << q;
+      for (size_t i = 0; i < full.size (); ++i)
+	ASSERT_TRUE (*full[i] == *unchecked[i]) << q;
+    }
+}
+
+TEST_F (ZwTest, batched_next)
+{
+  auto dwv = dw ("nontrivial-types.o", doneness::cooked);
+  auto input = stack_with_value (dwv->clone ());
+
+  for (std::string q: {"entry name", "entry ?TAG_subprogram child offset",
+		       "entry (pos < 3) \"%s\"", "entry @AT_decl_line 1 add",
+		       "entry ?root (name, 1)", "entry (name, @AT_decl_line)"})
+    for (bool pegged: {false, true})
+      {
+	auto full = run_query (*builtins,
+			       stack_with_value (dwv->clone ()), q);
+
+	tree t = parse_query (*builtins, q);
+	if (pegged)
+	  peg_overloads (t, *input);
+	auto op = t.build_exec (std::make_shared <op_origin>
+				(stack_with_value (dwv->clone ())));
+
+	// An odd batch size so that batches end mid-producer.
+	stack_batch batched;
+	while (op->next_batch (batched, 3))
+	  ;
+
+	ASSERT_EQ (full.size (), batched.size ()) << q;
+	for (size_t i = 0; i < full.size (); ++i)
+	  ASSERT_TRUE (*full[i] == *batched[i]) << q;
+      }
+
+  // Results produced before an error are delivered, the error is
+  // raised on the following call.
+  auto origin = std::make_shared <op_origin>
+    (stack_with_value (dwv->clone ()));
+  auto op = parse_query (*builtins, "(1, 2, drop drop) 3")
+    .build_exec (origin);
+  stack_batch batched;
+  ASSERT_TRUE (op->next_batch (batched));
+  ASSERT_EQ (2, batched.size ());
+  ASSERT_THROW (op->next_batch (batched), std::runtime_error);
+
+  // An error held back when the op is reset is dropped with it.
+  for (int i = 0; i < 2; ++i)
+    {
+      batched.clear ();
+      op->reset ();
+      origin->set_next (stack_with_value (dwv->clone ()));
+      ASSERT_TRUE (op->next_batch (batched));
+      ASSERT_EQ (2, batched.size ());
+    }
+}
+
+TEST_F (ZwTest, filter_fusion)
+{
+  for (auto fn: {"twocus", "dwz-partial", "nontrivial-types.o"})
+    for (std::string mode: {"", "raw "})
+      for (std::string filter: {"?TAG_subprogram (name == \"main\")",
+				"!TAG_member ?AT_name",
+				"?(?TAG_base_type) !(name == \"int\")",
+				"?(\"main\" == name)",
+				"?root", "(name == \"no such name\")"})
+	{
+	  auto dwv = dw (fn, doneness::cooked);
+	  auto input = stack_with_value (dwv->clone ());
+	  std::string q = mode + "entry " + filter;
+
+	  // Without pegging, types are not known and nothing is fused.
+	  auto full = run_query (*builtins,
+				 stack_with_value (dwv->clone ()), q);
+
+	  tree t = parse_query (*builtins, q);
+	  peg_overloads (t, *input);
+	  auto op = t.build_exec (std::make_shared <op_origin>
+				  (stack_with_value (dwv->clone ())));
+	  ASSERT_EQ (0, op->name ().find ("fused")) << q;
+
+	  std::vector <std::unique_ptr <stack>> fused;
+	  while (auto r = op->next ())
+	    fused.push_back (std::move (r));
+
+	  ASSERT_EQ (full.size (), fused.size ()) << fn << ": " << q;
+	  for (size_t i = 0; i < full.size (); ++i)
+	    ASSERT_TRUE (*full[i] == *fused[i]) << fn << ": " << q;
+	}
+}
+
+TEST_F (ZwTest, acyclic_closure)
+{
+  for (auto fn: {"twocus", "dwz-partial", "nontrivial-types.o"})
+    for (std::string q: {"raw unit root child*", "unit root child*",
+			 "raw entry parent*", "entry parent*",
+			 "raw unit root child* ?TAG_subprogram"})
+      {
+	auto dwv = dw (fn, doneness::cooked);
+	auto input = stack_with_value (dwv->clone ());
+
+	auto full = run_query (*builtins, stack_with_value (dwv->clone ()), q);
+
+	// Once pegged, closures over raw DIE's stop deduplicating.
+	tree t = parse_query (*builtins, q);
+	peg_overloads (t, *input);
+	auto op = t.build_exec (std::make_shared <op_origin>
+				(stack_with_value (dwv->clone ())));
+	std::vector <std::unique_ptr <stack>> pegged;
+	while (auto r = op->next ())
+	  pegged.push_back (std::move (r));
+
+	ASSERT_EQ (full.size (), pegged.size ()) << fn << ": " << q;
+	for (size_t i = 0; i < full.size (); ++i)
+	  {
+	    ASSERT_TRUE (*full[i] == *pegged[i]) << fn << ": " << q;
+	    ASSERT_EQ (full[i]->hash (), pegged[i]->hash ()) << fn << ": " << q;
+	  }
+      }
+}
+
+TEST (PoolTest, blocks_are_recycled)
+{
+  void *a = pool_allocate (40);
+  pool_deallocate (a, 40);
+  void *b = pool_allocate (48);
+  ASSERT_EQ (a, b);
+  pool_deallocate (b, 48);
+
+  // Blocks that other threads free are good for reuse as well.
+  std::vector <void *> ptrs;
+  for (size_t i = 0; i < 1000; ++i)
+    ptrs.push_back (pool_allocate (24));
+  std::thread t {[&ptrs] ()
+      {
+	for (void *ptr: ptrs)
+	  pool_deallocate (ptr, 24);
+      }};
+  t.join ();
+
+  std::vector <int, pool_allocator <int>> v (10, 7);
+  ASSERT_EQ (70, std::accumulate (v.begin (), v.end (), 0));
+}
+
+TEST (StackTest, copies_share_values)
+{
+  auto cst = [] (int i)
+    {
+      return std::make_unique <value_cst> (constant {i, &dec_constant_dom}, 0);
+    };
+
+  stack a;
+  a.push (cst (1));
+  a.push (cst (2));
+  a.set_frame (std::make_shared <frame> (nullptr, 1));
+
+  stack b {a};
+  ASSERT_TRUE (a == b);
+  ASSERT_EQ (&a.get (1), &b.get (1));
+
+  // Popping from the copy leaves the original alone.
+  auto v = b.pop ();
+  ASSERT_TRUE (v->cmp (*cst (2)) == cmp_result::equal);
+  b.push (cst (3));
+  ASSERT_EQ (2, a.size ());
+  ASSERT_TRUE (a.get (0).cmp (*cst (2)) == cmp_result::equal);
+  ASSERT_EQ (&a.get (1), &b.get (1));
+  ASSERT_TRUE (a < b);
+
+  // And so does mutable access, to the shared value and to those
+  // above it.
+  stack c {a};
+  value const *shared = &a.get (1);
+  ASSERT_TRUE (c.get_as <value_cst> (1) != nullptr);
+  ASSERT_EQ (shared, &a.get (1));
+  ASSERT_EQ (shared, &b.get (1));
+  ASSERT_NE (shared, &c.get (1));
+  ASSERT_NE (&a.get (0), &c.get (0));
+  ASSERT_TRUE (a == c);
+
+  // A value that no other stack refers to is accessed in place.
+  value const *own = &b.get (0);
+  ASSERT_EQ (own, &b.get_mutable (0));
+
+  // So does binding a variable.
+  b.bind_value (0, var_id (0), cst (4));
+  ASSERT_EQ (nullptr, a.nth_frame (0)->m_values[0]);
+  ASSERT_TRUE (b.nth_frame (0)->read_value (var_id (0)).cmp (*cst (4))
+	       == cmp_result::equal);
+}
+
 namespace
 {
   template <class T>
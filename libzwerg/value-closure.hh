@@ -38,19 +38,25 @@ class scope;
 class value_closure
   : public value
 {
-  std::unique_ptr <tree> m_t;
+  // The tree is shared by all closures that the same lambda makes,
+  // which lets op_apply recognize a tree that it has built before.
+  std::shared_ptr <tree const> m_t;
   std::shared_ptr <frame> m_frame;
 
 public:
   static value_type const vtype;
 
-  value_closure (tree const &t, std::shared_ptr <frame> frame, size_t pos);
+  value_closure (std::shared_ptr <tree const> t,
+		 std::shared_ptr <frame> frame, size_t pos);
   value_closure (value_closure const &that);
   ~value_closure();
 
   tree const &get_tree () const
   { return *m_t; }
 
+  std::shared_ptr <tree const> get_tree_ptr () const
+  { return m_t; }
+
   std::shared_ptr <frame> get_frame () const
   { return m_frame; }
 
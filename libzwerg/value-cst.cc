@@ -93,6 +93,18 @@ value_cst::cmp (value const &that) const
     return cmp_result::fail;
 }
 
+size_t
+value_cst::hash () const
+{
+  // Constants from different arithmetic domains compare equal if
+  // their values do, so the domain is left out.  So is signedness,
+  // only negative values need telling apart from unsigned ones with
+  // the same bits.
+  mpz_class const &v = m_cst.value ();
+  bool negative = v.m_sign == signedness::sign && v.m_i < 0;
+  return hash_combine (v.m_u, negative);
+}
+
 
 // value
 
@@ -35,6 +35,7 @@
 #include <memory>
 #include <system_error>
 #include <cerrno>
+#include <functional>
 
 #include "atval.hh"
 #include "dwcst.hh"
@@ -152,7 +153,11 @@ value_dwarf::value_dwarf (std::string const &fn, size_t pos, doneness d)
   : value {vtype, pos}
   , doneness_aspect {d}
   , m_fn {fn}
-  , m_dwctx {std::make_shared <dwfl_context> (open_dwfl (fn))}
+  , m_dwctx {cached_dwfl_context (fn, [&fn] ()
+				  {
+				    return std::make_shared <dwfl_context>
+				      (open_dwfl (fn), fn);
+				  })}
 {}
 
 value_dwarf::value_dwarf (std::string const &fn,
@@ -185,6 +190,12 @@ value_dwarf::cmp (value const &that) const
     return cmp_result::fail;
 }
 
+size_t
+value_dwarf::hash () const
+{
+  return std::hash <Dwfl *> {} (m_dwctx->get_dwfl ());
+}
+
 
 value_type const value_cu::vtype = value_type::alloc ("T_CU",
 R"docstring(
@@ -221,6 +232,12 @@ value_cu::cmp (value const &that) const
     return cmp_result::fail;
 }
 
+size_t
+value_cu::hash () const
+{
+  return std::hash <Dwarf_CU const *> {} (&m_cu);
+}
+
 
 namespace
 {
@@ -310,6 +327,15 @@ value_die::cmp (value const &that) const
     return cmp_result::fail;
 }
 
+size_t
+value_die::hash () const
+{
+  // Import paths are left out, cmp doesn't always look at them.
+  return hash_combine
+    (std::hash <Dwarf *> {} (dwarf_cu_getdwarf (m_die.cu)),
+     dwarf_dieoffset ((Dwarf_Die *) &m_die));
+}
+
 
 value_type const value_attr::vtype = value_type::alloc ("T_ATTR",
 R"docstring(
@@ -378,6 +404,13 @@ value_attr::cmp (value const &that) const
     return cmp_result::fail;
 }
 
+size_t
+value_attr::hash () const
+{
+  return hash_combine (dwarf_dieoffset ((Dwarf_Die *) &m_die),
+		       dwarf_whatattr ((Dwarf_Attribute *) &m_attr));
+}
+
 
 value_type const value_abbrev_unit::vtype = value_type::alloc ("T_ABBREV_UNIT",
 R"docstring(
@@ -413,6 +446,12 @@ value_abbrev_unit::cmp (value const &that) const
     return cmp_result::fail;
 }
 
+size_t
+value_abbrev_unit::hash () const
+{
+  return std::hash <Dwarf_CU const *> {} (&m_cu);
+}
+
 
 value_type const value_abbrev::vtype = value_type::alloc ("T_ABBREV",
 R"docstring(
@@ -475,6 +514,12 @@ value_abbrev::cmp (value const &that) const
     return cmp_result::fail;
 }
 
+size_t
+value_abbrev::hash () const
+{
+  return std::hash <Dwarf_Abbrev const *> {} (&m_abbrev);
+}
+
 
 value_type const value_abbrev_attr::vtype = value_type::alloc ("T_ABBREV_ATTR",
 R"docstring(
@@ -84,6 +84,7 @@ public:
 
   void show (std::ostream &o, brevity brv) const override;
   cmp_result cmp (value const &that) const override;
+  size_t hash () const override;
   std::unique_ptr <value> clone () const override;
 };
 
@@ -106,7 +107,7 @@ public:
 	    Dwarf_Off offset, size_t pos, doneness d)
     : value {vtype, pos}
     , doneness_aspect {d}
-    , m_dwctx {dwctx}
+    , m_dwctx {std::move (dwctx)}
     , m_offset {offset}
     , m_cu (cu)
   {}
@@ -124,6 +125,7 @@ public:
 
   void show (std::ostream &o, brevity brv) const override;
   cmp_result cmp (value const &that) const override;
+  size_t hash () const override;
   std::unique_ptr <value> clone () const override;
 };
 
@@ -150,9 +152,9 @@ public:
 	     Dwarf_Die die, size_t pos, doneness d)
     : value {vtype, pos}
     , doneness_aspect {d}
-    , m_dwctx {(assert (dwctx != nullptr), dwctx)}
+    , m_dwctx {(assert (dwctx != nullptr), std::move (dwctx))}
     , m_die (die)
-    , m_import {import}
+    , m_import {std::move (import)}
   {}
 
   value_die (std::shared_ptr <dwfl_context> dwctx,
@@ -179,6 +181,7 @@ public:
   { return std::make_unique <value_die> (*this); }
 
   cmp_result cmp (value const &that) const override;
+  size_t hash () const override;
 };
 
 // -------------------------------------------------------------------
@@ -200,7 +203,7 @@ public:
 	      Dwarf_Attribute attr, Dwarf_Die die, size_t pos, doneness d)
     : value {vtype, pos}
     , doneness_aspect {d}
-    , m_dwctx {dwctx}
+    , m_dwctx {std::move (dwctx)}
     , m_die (die)
     , m_attr (attr)
   {}
@@ -219,6 +222,7 @@ public:
   void show (std::ostream &o, brevity brv) const override;
   std::unique_ptr <value> clone () const override;
   cmp_result cmp (value const &that) const override;
+  size_t hash () const override;
 };
 
 // -------------------------------------------------------------------
@@ -237,7 +241,7 @@ public:
   value_abbrev_unit (std::shared_ptr <dwfl_context> dwctx,
 		     Dwarf_CU &cu, size_t pos)
     : value {vtype, pos}
-    , m_dwctx {dwctx}
+    , m_dwctx {std::move (dwctx)}
     , m_cu (cu)
   {}
 
@@ -252,6 +256,7 @@ public:
   void show (std::ostream &o, brevity brv) const override;
   std::unique_ptr <value> clone () const override;
   cmp_result cmp (value const &that) const override;
+  size_t hash () const override;
 };
 
 // -------------------------------------------------------------------
@@ -270,7 +275,7 @@ public:
   value_abbrev (std::shared_ptr <dwfl_context> dwctx,
 		Dwarf_Abbrev &abbrev, size_t pos)
     : value {vtype, pos}
-    , m_dwctx {dwctx}
+    , m_dwctx {std::move (dwctx)}
     , m_abbrev (abbrev)
   {}
 
@@ -285,6 +290,7 @@ public:
   void show (std::ostream &o, brevity brv) const override;
   std::unique_ptr <value> clone () const override;
   cmp_result cmp (value const &that) const override;
+  size_t hash () const override;
 };
 
 // -------------------------------------------------------------------
@@ -336,7 +342,7 @@ public:
 		      Dwarf_Addr low, Dwarf_Addr high,
 		      Dwarf_Op *expr, size_t exprlen, size_t pos)
     : value {vtype, pos}
-    , m_dwctx {dwctx}
+    , m_dwctx {std::move (dwctx)}
     , m_attr (attr)
     , m_low {low}
     , m_high {high}
@@ -415,7 +421,7 @@ public:
   value_loclist_op (std::shared_ptr <dwfl_context> dwctx, Dwarf_Attribute attr,
 		    Dwarf_Op *dwop, size_t pos)
     : value {vtype, pos}
-    , m_dwctx {dwctx}
+    , m_dwctx {std::move (dwctx)}
     , m_attr (attr)
     , m_dwop (dwop)
   {}
@@ -29,10 +29,12 @@
 #include <memory>
 #include <iostream>
 #include <algorithm>
+#include <cstdint>
 
 #include "value-seq.hh"
 #include "overload.hh"
 #include "value-cst.hh"
+#include "planner.hh"
 
 value_type const value_seq::vtype = value_type::alloc ("T_SEQ",
 R"docstring(
@@ -140,6 +142,15 @@ value_seq::cmp (value const &that) const
   else
     return cmp_result::fail;
 }
+size_t
+value_seq::hash () const
+{
+  size_t ret = m_seq->size ();
+  for (auto const &v: *m_seq)
+    ret = hash_combine (ret, hash_combine (v->get_type ().code (),
+					   v->hash ()));
+  return ret;
+}
 
 value_seq
 op_add_seq::operate (std::unique_ptr <value_seq> a,
@@ -202,14 +213,18 @@ run on.  Attributes for which their abbreviation suggests
 
 namespace
 {
+  // Producers of elements at positions [IDX, END) of a sequence.
   struct seq_elem_producer_base
   {
     std::shared_ptr <value_seq::seq_t> m_seq;
     size_t m_idx;
+    size_t m_end;
 
-    seq_elem_producer_base (std::shared_ptr <value_seq::seq_t> seq)
+    seq_elem_producer_base (std::shared_ptr <value_seq::seq_t> seq,
+			    size_t idx = 0, size_t end = -1)
       : m_seq {seq}
-      , m_idx {0}
+      , m_idx {idx}
+      , m_end {std::min (end, m_seq->size ())}
     {}
   };
 
@@ -222,7 +237,7 @@ namespace
     std::unique_ptr <value>
     next () override
     {
-      if (m_idx < m_seq->size ())
+      if (m_idx < m_end)
 	{
 	  std::unique_ptr <value> v = (*m_seq)[m_idx]->clone ();
 	  v->set_pos (m_idx++);
@@ -242,7 +257,7 @@ namespace
     std::unique_ptr <value>
     next () override
     {
-      if (m_idx < m_seq->size ())
+      if (m_idx < m_end)
 	{
 	  std::unique_ptr <value> v
 	    = (*m_seq)[m_seq->size () - 1 - m_idx]->clone ();
@@ -255,6 +270,46 @@ namespace
   };
 }
 
+namespace
+{
+  // `elem` or `relem` followed by (pos == N).  Only the N-th element
+  // can pass, so don't bother producing the others.
+  template <class Producer>
+  struct op_elem_seq_at
+    : public op_yielding_overload <value, value_seq>
+  {
+    size_t m_idx;
+
+    op_elem_seq_at (std::shared_ptr <op> upstream, size_t idx)
+      : op_yielding_overload {upstream}
+      , m_idx {idx}
+    {}
+
+    std::unique_ptr <value_producer <value>>
+    operate (std::unique_ptr <value_seq> a) override
+    {
+      return std::make_unique <Producer> (a->get_seq (), m_idx, m_idx + 1);
+    }
+  };
+
+  template <class Producer>
+  std::shared_ptr <builtin>
+  reduce_elem_seq (tree const *begin, tree const *end)
+  {
+    if (auto cst = find_cst_equality (begin, end, {"pos"}))
+      if (cst->value () < mpz_class {(uint64_t) SIZE_MAX})
+	return make_reduced_overload <op_elem_seq_at <Producer>>
+	  ((size_t) cst->value ().uval ());
+    return nullptr;
+  }
+}
+
+std::shared_ptr <builtin>
+op_elem_seq::reduce (tree const *begin, tree const *end)
+{
+  return reduce_elem_seq <seq_elem_producer> (begin, end);
+}
+
 std::unique_ptr <value_producer <value>>
 op_elem_seq::operate (std::unique_ptr <value_seq> a)
 {
@@ -289,6 +344,12 @@ The expression could be simplified a bit on expense of clarity::
 	[1, 2, 3] ["a", "b", "c"]
 	(|A B| A elem B elem (pos == drop pos)) [|A B| A, B]
 
+To get only the first *N* results of an expression *X*, capture them
+and bound position of the element.  *X* is then not evaluated past
+what can pass::
+
+	[X] elem (pos < N)
+
 ``relem`` operates in the same fashion as ``elem``, but backwards.
 
 )docstring";
@@ -300,6 +361,12 @@ op_elem_seq::docstring ()
   return elem_seq_docstring;
 }
 
+std::shared_ptr <builtin>
+op_relem_seq::reduce (tree const *begin, tree const *end)
+{
+  return reduce_elem_seq <seq_relem_producer> (begin, end);
+}
+
 std::unique_ptr <value_producer <value>>
 op_relem_seq::operate (std::unique_ptr <value_seq> a)
 {
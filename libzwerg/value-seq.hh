@@ -67,6 +67,7 @@ public:
   void show (std::ostream &o, brevity brv) const override;
   std::unique_ptr <value> clone () const override;
   cmp_result cmp (value const &that) const override;
+  size_t hash () const override;
 };
 
 struct op_add_seq
@@ -98,6 +99,8 @@ struct op_elem_seq
   std::unique_ptr <value_producer <value>>
   operate (std::unique_ptr <value_seq> a) override;
 
+  static std::shared_ptr <builtin> reduce (tree const *begin,
+					   tree const *end);
   static std::string docstring ();
 };
 
@@ -109,6 +112,8 @@ struct op_relem_seq
   std::unique_ptr <value_producer <value>>
   operate (std::unique_ptr <value_seq> a) override;
 
+  static std::shared_ptr <builtin> reduce (tree const *begin,
+					   tree const *end);
   static std::string docstring ();
 };
 
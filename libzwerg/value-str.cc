@@ -26,6 +26,9 @@
    the GNU Lesser General Public License along with this program.  If
    not, see <http://www.gnu.org/licenses/>.  */
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <memory>
 #include <regex.h>
@@ -33,6 +36,7 @@
 #include "value-str.hh"
 #include "overload.hh"
 #include "value-cst.hh"
+#include "planner.hh"
 
 value_type const value_str::vtype = value_type::alloc ("T_STR",
 R"docstring(
@@ -47,10 +51,22 @@ work.  Zwerg strings are not NUL-terminated::
 
 )docstring");
 
+std::string &
+value_str::get_string ()
+{
+  if (m_borrowed != nullptr)
+    {
+      m_str.assign (m_borrowed, m_len);
+      m_borrowed = nullptr;
+      m_owner = nullptr;
+    }
+  return m_str;
+}
+
 void
 value_str::show (std::ostream &o, brevity brv) const
 {
-  o << m_str;
+  o.write (c_str (), length ());
 }
 
 std::unique_ptr <value>
@@ -63,17 +79,38 @@ cmp_result
 value_str::cmp (value const &that) const
 {
   if (auto v = value::as <value_str> (&that))
-    return compare (m_str, v->m_str);
+    {
+      size_t len = length ();
+      size_t vlen = v->length ();
+      if (int c = std::memcmp (c_str (), v->c_str (), std::min (len, vlen)))
+	return c < 0 ? cmp_result::less : cmp_result::greater;
+      return compare (len, vlen);
+    }
   else
     return cmp_result::fail;
 }
 
+size_t
+value_str::hash () const
+{
+  char const *str = c_str ();
+  size_t len = length ();
+  size_t ret = len;
+  for (size_t i = 0; i < len; ++i)
+    ret = hash_combine (ret, (unsigned char) str[i]);
+  return ret;
+}
+
 
 value_str
 op_add_str::operate (std::unique_ptr <value_str> a,
 		     std::unique_ptr <value_str> b)
 {
-  return value_str {a->get_string () + b->get_string (), 0};
+  std::string str;
+  str.reserve (a->length () + b->length ());
+  str.append (a->c_str (), a->length ());
+  str.append (b->c_str (), b->length ());
+  return value_str {std::move (str), 0};
 }
 
 std::string
@@ -99,7 +136,7 @@ Using formatting strings may be a better way to concatenate strings::
 value_cst
 op_length_str::operate (std::unique_ptr <value_str> a)
 {
-  constant t {a->get_string ().length (), &dec_constant_dom};
+  constant t {a->length (), &dec_constant_dom};
   return value_cst {t, 0};
 }
 
@@ -121,18 +158,22 @@ Yields length of string on TOS::
 
 namespace
 {
+  // Producers of characters at positions [IDX, END) of a string.
   struct str_elem_producer_base
   {
     std::unique_ptr <value_str> m_v;
     size_t m_sz;
     char const *m_buf;
     size_t m_idx;
+    size_t m_end;
 
-    str_elem_producer_base (std::unique_ptr <value_str> v)
+    str_elem_producer_base (std::unique_ptr <value_str> v,
+			    size_t idx = 0, size_t end = -1)
       : m_v {std::move (v)}
-      , m_sz {m_v->get_string ().size ()}
-      , m_buf {m_v->get_string ().c_str ()}
-      , m_idx {0}
+      , m_sz {m_v->length ()}
+      , m_buf {m_v->c_str ()}
+      , m_idx {idx}
+      , m_end {std::min (end, m_sz)}
     {}
   };
 
@@ -145,7 +186,7 @@ namespace
     std::unique_ptr <value_str>
     next () override
     {
-      if (m_idx < m_sz)
+      if (m_idx < m_end)
 	{
 	  char c = m_buf[m_idx];
 	  return std::make_unique <value_str> (std::string {c}, m_idx++);
@@ -164,7 +205,7 @@ namespace
     std::unique_ptr <value_str>
     next () override
     {
-      if (m_idx < m_sz)
+      if (m_idx < m_end)
 	{
 	  char c = m_buf[m_sz - 1 - m_idx];
 	  return std::make_unique <value_str> (std::string {c}, m_idx++);
@@ -190,7 +231,47 @@ strings::
 )docstring";
 }
 
+namespace
+{
+  // `elem` or `relem` followed by (pos == N).  Only the N-th
+  // character can pass, so don't bother producing the others.
+  template <class Producer>
+  struct op_elem_str_at
+    : public op_yielding_overload <value_str, value_str>
+  {
+    size_t m_idx;
+
+    op_elem_str_at (std::shared_ptr <op> upstream, size_t idx)
+      : op_yielding_overload {upstream}
+      , m_idx {idx}
+    {}
+
+    std::unique_ptr <value_producer <value_str>>
+    operate (std::unique_ptr <value_str> a) override
+    {
+      return std::make_unique <Producer> (std::move (a), m_idx, m_idx + 1);
+    }
+  };
+
+  template <class Producer>
+  std::shared_ptr <builtin>
+  reduce_elem_str (tree const *begin, tree const *end)
+  {
+    if (auto cst = find_cst_equality (begin, end, {"pos"}))
+      if (cst->value () < mpz_class {(uint64_t) SIZE_MAX})
+	return make_reduced_overload <op_elem_str_at <Producer>>
+	  ((size_t) cst->value ().uval ());
+    return nullptr;
+  }
+}
+
 // elem
+std::shared_ptr <builtin>
+op_elem_str::reduce (tree const *begin, tree const *end)
+{
+  return reduce_elem_str <str_elem_producer> (begin, end);
+}
+
 std::unique_ptr <value_producer <value_str>>
 op_elem_str::operate (std::unique_ptr <value_str> a)
 {
@@ -205,6 +286,12 @@ op_elem_str::docstring ()
 
 
 // relem
+std::shared_ptr <builtin>
+op_relem_str::reduce (tree const *begin, tree const *end)
+{
+  return reduce_elem_str <str_relem_producer> (begin, end);
+}
+
 std::unique_ptr <value_producer <value_str>>
 op_relem_str::operate (std::unique_ptr <value_str> a)
 {
@@ -222,7 +309,7 @@ op_relem_str::docstring ()
 pred_result
 pred_empty_str::result (value_str &a)
 {
-  return pred_result (a.get_string () == "");
+  return pred_result (a.length () == 0);
 }
 
 std::string
@@ -250,8 +337,11 @@ extern char const g_find_docstring[];
 pred_result
 pred_find_str::result (value_str &haystack, value_str &needle)
 {
-  return pred_result (haystack.get_string ().find (needle.get_string ())
-		      != std::string::npos);
+  char const *hay = haystack.c_str ();
+  char const *end = hay + haystack.length ();
+  return pred_result (std::search (hay, end, needle.c_str (),
+				   needle.c_str () + needle.length ())
+		      != end || needle.length () == 0);
 }
 
 std::string
@@ -268,11 +358,10 @@ extern char const g_starts_docstring[];
 pred_result
 pred_starts_str::result (value_str &haystack, value_str &needle)
 {
-  auto const &hay = haystack.get_string ();
-  auto const &need = needle.get_string ();
+  size_t len = needle.length ();
   return pred_result
-    (hay.size () >= need.size ()
-     && hay.compare (0, need.size (), need) == 0);
+    (haystack.length () >= len
+     && std::memcmp (haystack.c_str (), needle.c_str (), len) == 0);
 }
 
 std::string
@@ -289,11 +378,11 @@ extern char const g_ends_docstring[];
 pred_result
 pred_ends_str::result (value_str &haystack, value_str &needle)
 {
-  auto const &hay = haystack.get_string ();
-  auto const &need = needle.get_string ();
+  size_t len = needle.length ();
   return pred_result
-    (hay.size () >= need.size ()
-     && hay.compare (hay.size () - need.size (), need.size (), need) == 0);
+    (haystack.length () >= len
+     && std::memcmp (haystack.c_str () + haystack.length () - len,
+		     needle.c_str (), len) == 0);
 }
 
 std::string
@@ -305,37 +394,164 @@ pred_ends_str::docstring ()
 
 // ?match
 
+namespace
+{
+  bool
+  is_regex_special (char c)
+  {
+    return std::strchr (".[]()*+?{}|^$\\", c) != nullptr;
+  }
+
+  bool
+  is_regex_quantifier (char c)
+  {
+    return c == '*' || c == '+' || c == '?' || c == '{';
+  }
+}
+
+struct pred_match_str::pattern
+{
+  regex_t m_re;
+  bool m_ok;
+
+  // Literals that a matching string has to start, resp. end with,
+  // or, if M_LITERAL, contain.  These are cheap to look for and let
+  // most strings be rejected without running the regex.
+  std::string m_prefix;
+  std::string m_suffix;
+  std::string m_contains;
+  bool m_literal;
+
+  explicit pattern (std::string const &str)
+    : m_ok {regcomp (&m_re, str.c_str (), REG_EXTENDED | REG_NOSUB) == 0}
+    , m_literal {false}
+  {
+    // Alternation could make any of the following optional.
+    if (! m_ok || str.find ('|') != std::string::npos)
+      return;
+
+    if (std::none_of (str.begin (), str.end (), is_regex_special))
+      {
+	m_contains = str;
+	m_literal = true;
+	return;
+      }
+
+    if (str[0] == '^')
+      {
+	size_t i = 1;
+	while (i < str.size () && ! is_regex_special (str[i]))
+	  ++i;
+	// A quantifier applies to the last character of the run.
+	if (i < str.size () && is_regex_quantifier (str[i]))
+	  --i;
+	if (i > 1)
+	  m_prefix = str.substr (1, i - 1);
+      }
+
+    size_t n = str.size ();
+    if (n >= 2 && str[n - 1] == '$' && str[n - 2] != '\\')
+      {
+	size_t i = n - 1;
+	while (i > 0 && ! is_regex_special (str[i - 1]))
+	  --i;
+	// The first character of the run may be escaped.
+	if (i > 0 && str[i - 1] == '\\')
+	  ++i;
+	if (i < n - 1)
+	  m_suffix = str.substr (i, n - 1 - i);
+      }
+  }
+
+  ~pattern ()
+  {
+    if (m_ok)
+      regfree (&m_re);
+  }
+
+  // Whether a string that regexec sees as HAY (which ends at the
+  // first NUL) might match at all.
+  bool
+  maybe_matches (char const *hay) const
+  {
+    if (! m_prefix.empty ()
+	&& std::strncmp (hay, m_prefix.c_str (), m_prefix.size ()) != 0)
+      return false;
+
+    if (! m_suffix.empty ())
+      {
+	size_t len = std::strlen (hay);
+	if (len < m_suffix.size ()
+	    || std::memcmp (hay + len - m_suffix.size (),
+			    m_suffix.c_str (), m_suffix.size ()) != 0)
+	  return false;
+      }
+
+    if (! m_contains.empty ()
+	&& std::strstr (hay, m_contains.c_str ()) == nullptr)
+      return false;
+
+    return true;
+  }
+};
+
+pred_match_str::~pred_match_str ()
+{}
+
 pred_result
 pred_match_str::result (value_str &haystack, value_str &needle)
 {
-  regex_t re;
-  if (regcomp (&re, needle.get_string ().c_str(),
-	       REG_EXTENDED | REG_NOSUB) != 0)
+  // The needle may be shared with other stacks, so look it up
+  // without get_string, which would modify a borrowed one.
+  char const *str = needle.c_str ();
+  size_t len = needle.length ();
+  auto it = std::find_if (m_patterns.begin (), m_patterns.end (),
+			  [str, len] (decltype (m_patterns)::value_type const &p)
+			  {
+			    return p.first.length () == len
+			      && std::memcmp (p.first.c_str (), str, len) == 0;
+			  });
+  if (it == m_patterns.end ())
+    {
+      // Needles that are computed could differ for each haystack.
+      if (m_patterns.size () >= 16)
+	m_patterns.clear ();
+      std::string key {str, len};
+      auto pat = std::make_unique <pattern> (key);
+      m_patterns.emplace_back (std::move (key), std::move (pat));
+      it = m_patterns.end () - 1;
+    }
+
+  pattern &pat = *it->second;
+  if (! pat.m_ok)
     {
       std::cerr << "Error: could not compile regular expression: '"
-		<< needle.get_string () << "'\n";
+		<< it->first << "'\n";
       return pred_result::fail;
     }
 
-  const int reti = regexec (&re, haystack.get_string ().c_str (),
+  char const *hay = haystack.c_str ();
+  if (! pat.maybe_matches (hay))
+    return pred_result::no;
+  if (pat.m_literal)
+    return pred_result::yes;
+
+  const int reti = regexec (&pat.m_re, hay,
 			    /* nmatch: size of pmatch array */ 0,
 			    /* pmatch: array of matches */ NULL,
 			    /* no extra flags */ 0);
 
-  pred_result retval = pred_result::fail;
   if (reti == 0)
-    retval = pred_result::yes;
+    return pred_result::yes;
   else if (reti == REG_NOMATCH)
-    retval = pred_result::no;
+    return pred_result::no;
   else
     {
       char msgbuf[100];
-      regerror (reti, &re, msgbuf, sizeof (msgbuf));
+      regerror (reti, &pat.m_re, msgbuf, sizeof (msgbuf));
       std::cerr << "Error: match failed: " << msgbuf << "\n";
+      return pred_result::fail;
     }
-
-  regfree (&re);
-  return retval;
 }
 
 std::string
@@ -29,7 +29,10 @@
 #ifndef _VALUE_STR_H_
 #define _VALUE_STR_H_
 
+#include <cstring>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "value.hh"
 #include "op.hh"
@@ -39,7 +42,16 @@
 class value_str
   : public value
 {
+  // The string is either owned, in M_STR, or, when M_BORROWED is
+  // non-null, borrowed: M_BORROWED then points at M_LEN characters
+  // followed by a NUL, which M_OWNER keeps alive.  Strings that come
+  // from Dwarf files are borrowed from sections that dwfl_context
+  // keeps mapped, so that neither making them nor copying them
+  // copies characters.
   std::string m_str;
+  char const *m_borrowed;
+  size_t m_len;
+  std::shared_ptr <void> m_owner;
 
 public:
   static value_type const vtype;
@@ -47,14 +59,33 @@ public:
   value_str (std::string &&str, size_t pos)
     : value {vtype, pos}
     , m_str {std::move (str)}
+    , m_borrowed {nullptr}
+    , m_len {0}
   {}
 
-  std::string &get_string ()
-  { return m_str; }
+  // Borrow NUL-terminated STR, which OWNER keeps alive.
+  value_str (char const *str, std::shared_ptr <void> owner, size_t pos)
+    : value {vtype, pos}
+    , m_borrowed {str}
+    , m_len {std::strlen (str)}
+    , m_owner {std::move (owner)}
+  {}
+
+  char const *c_str () const
+  { return m_borrowed != nullptr ? m_borrowed : m_str.c_str (); }
+
+  size_t length () const
+  { return m_borrowed != nullptr ? m_len : m_str.length (); }
+
+  // Return the string for modification.  A borrowed string is copied
+  // first, which modifies this value, so don't call this on values
+  // that may be shared between stacks.  Use c_str and length to read.
+  std::string &get_string ();
 
   void show (std::ostream &o, brevity brv) const override;
   std::unique_ptr <value> clone () const override;
   cmp_result cmp (value const &that) const override;
+  size_t hash () const override;
 };
 
 struct op_add_str
@@ -86,6 +117,8 @@ struct op_elem_str
   std::unique_ptr <value_producer <value_str>>
   operate (std::unique_ptr <value_str> a) override;
 
+  static std::shared_ptr <builtin> reduce (tree const *begin,
+					   tree const *end);
   static std::string docstring ();
 };
 
@@ -97,6 +130,8 @@ struct op_relem_str
   std::unique_ptr <value_producer <value_str>>
   operate (std::unique_ptr <value_str> a) override;
 
+  static std::shared_ptr <builtin> reduce (tree const *begin,
+					   tree const *end);
   static std::string docstring ();
 };
 
@@ -139,7 +174,16 @@ struct pred_ends_str
 struct pred_match_str
   : public pred_overload <value_str, value_str>
 {
+  struct pattern;
+
+  // Compiled patterns, keyed by the needle.  The needle is most
+  // often a literal, so this usually holds just one.
+  std::vector <std::pair <std::string, std::unique_ptr <pattern>>>
+	m_patterns;
+
   using pred_overload::pred_overload;
+  ~pred_match_str ();
+
   pred_result result (value_str &haystack, value_str &needle) override;
 
   static std::string docstring ();
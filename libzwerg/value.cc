@@ -147,6 +147,12 @@ static struct
 
 constant_dom const &slot_type_dom = slot_type_dom_obj;
 
+size_t
+value::hash () const
+{
+  return 0;
+}
+
 constant
 value::get_type_const () const
 {
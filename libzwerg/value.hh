@@ -33,6 +33,7 @@
 #include <vector>
 
 #include "constant.hh"
+#include "pool.hh"
 
 enum class cmp_result
   {
@@ -111,6 +112,13 @@ public:
 
 std::ostream &operator<< (std::ostream &o, value_type const &v);
 
+// Mix hash H into SEED.
+inline size_t
+hash_combine (size_t seed, size_t h)
+{
+  return seed ^ (h + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+}
+
 // A domain for slot type constants.
 extern constant_dom const &slot_type_dom;
 
@@ -134,10 +142,28 @@ public:
   constant get_type_const () const;
 
   virtual ~value () {}
+
+  // Values of all types are allocated from pools, see pool.hh.
+  static void *
+  operator new (size_t size)
+  {
+    return pool_allocate (size);
+  }
+
+  static void
+  operator delete (void *ptr, size_t size)
+  {
+    pool_deallocate (ptr, size);
+  }
+
   virtual void show (std::ostream &o, brevity brv) const = 0;
   virtual std::unique_ptr <value> clone () const = 0;
   virtual cmp_result cmp (value const &that) const = 0;
 
+  // Values that cmp equal have equal hashes.  The default is
+  // correct for any type, but useless for hash tables.
+  virtual size_t hash () const;
+
   void
   set_pos (size_t pos)
   {
@@ -6,6 +6,9 @@ cd $(dirname $0)
 failures=0
 total=0
 
+# Keep whatever the tests persist away from the user's cache.
+export XDG_CACHE_HOME=$(mktemp -d)
+
 expect_count ()
 {
     export total=$((total + 1))
@@ -129,6 +132,12 @@ expect_count 3 ./empty -e '
 	[2, 1, 0] relem dup (== pos)'
 expect_count 1 ./empty -e '
 	["210" relem] == ["012" elem]'
+expect_count 1 ./empty -e '
+	[1, 2, 3] relem (pos == 0) (== 3)'
+expect_count 1 ./empty -e '
+	"abc" relem (pos == 1) (== "b")'
+expect_count 0 ./empty -e '
+	"abc" elem (pos == 3)'
 
 # Check literal assertions.
 expect_count 1 ./empty -e '
@@ -171,6 +180,16 @@ expect_count 1 ./nontrivial-types.o -e '
 	entry ?(@AT_language "%s" "DW_LANG_C89" ?match)'
 expect_count 1 ./nontrivial-types.o -e '
 	entry ?(@AT_encoding "%s" "^DW_ATE_signed$" ?match)'
+expect_count 2 ./empty -e '
+	["foo", "xfoox", "fo"] elem ?("foo" ?match)'
+expect_count 1 ./empty -e '
+	["_ZN3FooE", "_ZL3Foo", "_ZN3Bar"] elem ?("^_ZN.*Foo" ?match)'
+expect_count 2 ./empty -e '
+	["a.b", "xa.b", "a.bx", "axb"] elem ?("a\\.b$" ?match)'
+expect_count 2 ./empty -e '
+	["ac", "abc", "abbc"] elem ?("^ab?c" ?match)'
+expect_count 2 ./empty -e '
+	("foo", "bar") ("foo", "bar") ?match'
 expect_count 7 ./duplicate-const -e '
 	entry (@AT_decl_file =~ "")'
 expect_count 7 ./duplicate-const -e '
@@ -309,6 +328,14 @@ expect_count 1 ./empty -e '
 	?(5 -1 slice [5, 6, 7, 8] ?eq)
 	?(-2 -1 slice [8] ?eq)'
 
+# Check that functions applied over and over see their own arguments.
+expect_count 1 ./empty -e '
+	let twice := {|x| x, x};
+	[(1, 2, 3) twice] ?([1, 1, 2, 2, 3, 3] ?eq)'
+expect_count 1 ./empty -e '
+	let mk := {|x| {x 10 mul}};
+	[(1, 2, 3) mk apply] ?([10, 20, 30] ?eq)'
+
 # Check that bindings remember position.
 expect_count 3 ./empty -e '
 	let E := [0, 1, 2] elem; E (== pos)'
@@ -585,6 +612,16 @@ expect_count 1 ./aranges.o -e '
 	     0x1000e, 0x1000f, 0x10010, 0x10011, 0x10012, 0x10013, 0x10014]
 	    relem]'
 
+# lookup
+expect_count 1 ./aranges.o -e '
+	0x10010 lookup ?TAG_lexical_block'
+expect_count 0 ./aranges.o -e '
+	0x1000a lookup ?TAG_lexical_block'
+expect_count 1 ./testfile_const_type -e '
+	0x80482f0 lookup (name == "main")'
+expect_count 1 ./testfile_const_type -e '
+	entry ?TAG_subprogram ?(address ?(0x80483f0 ?contains)) (name == "f1")'
+
 expect_count 1 ./pointer_const_value.o -e '
 	entry @AT_const_value == 0'
 
@@ -721,6 +758,37 @@ expect_count 1 ./empty -e 'raw name == "./empty"'
 expect_count 1 ./empty -e 'entry name == "empty.c"'
 expect_count 1 ./empty -e 'raw entry name == "empty.c"'
 
+# Test that name lookups through the DIE index agree with full scans.
+expect_count 2 ./twocus -e 'entry (name == "int")'
+expect_count 1 ./twocus -e 'entry ?("int" == @AT_name) (pos == 4)'
+expect_count 4 ./dwz-partial -e 'entry (name == "long long unsigned int")'
+expect_count 1 ./dwz-partial -e 'raw entry (name == "long long unsigned int")'
+expect_count 1 ./char_16_32.o -e '
+	entry (@AT_linkage_name == "_Z5foo16PDs") (name == "foo16")'
+
+# Same for tag lookups, including those that go through imports.
+expect_count 2 ./twocus -e 'entry ?TAG_compile_unit'
+expect_count 12 ./dwz-partial -e 'entry ?TAG_pointer_type'
+expect_count 3 ./dwz-partial -e 'raw entry ?TAG_pointer_type'
+expect_count 1 ./dwz-partial -e 'raw unit entry ?TAG_partial_unit'
+
+# Same for offset lookups.
+expect_count 4 ./dwz-partial -e 'entry (offset == 0x14)'
+expect_count 1 ./dwz-partial -e 'raw entry (offset == 0x14)'
+expect_count 0 ./twocus -e 'entry (offset == 0x15)'
+expect_count 1 ./twocus -e 'unit (offset == 0x53) (pos == 1)'
+expect_count 0 ./dwz-partial -e 'unit (offset == 0)'
+expect_count 1 ./dwz-partial -e 'raw unit (offset == 0) (pos == 0)'
+expect_count 1 ./dwz-partial2-1 -e '
+	unit root (offset == 0xe7) raw child (offset == 0x103) (pos == 2)'
+expect_count 1 ./dwz-partial2-1 -e '
+	unit root (offset == 0xe7) child (offset == 0x76) (pos == 0)'
+
+# Test that words that would underrun the stack only fail if they are
+# reached.
+expect_count 0 ./empty -e '?(0 == 1) drop drop'
+expect_count 1 ./empty -e '(?(0 == 1) drop drop, 1)'
+
 # Test for inconsistent types.
 expect_count 1 ./inconsistent-types -e '
 	let A := entry ?TAG_subprogram;
@@ -728,11 +796,44 @@ expect_count 1 ./inconsistent-types -e '
 	let C := A @AT_specification child ?TAG_formal_parameter;
 	(B pos == C pos) (B @AT_type != C @AT_type)'
 
+# An error that a subexpression would raise after ?() has seen what
+# it needs doesn't surface when ?() moves on to the next entry.
+expect_count 3 ./haschildren_childless -e 'entry ?((1 1, drop) drop drop 3)'
+
+# Test that -m stops after given number of results, and that a bound
+# on positions of captured elements stops the captured expression.
+expect_count 2 -m 2 ./twocus -e 'entry'
+expect_count 0 -m 0 ./twocus -e 'entry'
+expect_count 3 ./empty -e '[0 (1 add)*] elem (pos < 3)'
+expect_count 3 ./empty -e '[0 (1 add)*] elem (pos <= 2)'
+expect_count 3 ./empty -e '[0 (1 add)*] elem (3 > pos)'
+expect_count 1 ./empty -e '[0 (1 add)*] elem (pos == 4) (== 4)'
+expect_count 2 ./empty -e '[1, 2, 3] elem (2 >= pos) (pos >= 1)'
+
+# Strings borrowed from Dwarf sections behave like any other.
+expect_count 1 ./twocus -e '
+	entry name ?(== "main") ?(length == 4) ?("ma" ?starts) ?("in" ?ends)
+	?(elem == "n") ("x" add == "mainx")'
+
 # Test that zero bytes don't terminate the query too soon.
 TMP=$(mktemp)
 echo -e '7 == "foo\x00bar" length' > $TMP
 expect_count 1 ./empty -f $TMP
 rm $TMP
 
+# Test that DIE indices are only saved on request, and that a saved
+# index gives the same results as a freshly built one.
+expect_count 1 ./twocus -e 'entry (name == "main")'
+total=$((total + 1))
+if [ -n "$(ls -A $XDG_CACHE_HOME)" ]; then
+    echo "FAIL: index saved without --index-cache"
+    failures=$((failures + 1))
+fi
+expect_count 1 --index-cache ./twocus -e 'entry (name == "main")'
+expect_count 1 --index-cache ./twocus -e 'entry (name == "main")'
+expect_count 2 --index-cache=1 ./twocus -e 'entry ?TAG_compile_unit'
+
+rm -rf $XDG_CACHE_HOME
+
 echo "$total tests total, $failures failures."
 [ $failures -eq 0 ]